@@ -0,0 +1,145 @@
+// Undo and forks on example3. First plays random turns while a HISTORY::History records
+// every one of them, against no history and against a ring that deep copies the state per
+// turn, and reports ns per turn and bytes per retained turn. Then forks [forks] sessions
+// from one point, lets every fork take a different option and a few random turns, and
+// reports the cost per fork and the memory all of them keep.
+//
+//   g++ -std=c++17 -O2 -pthread bench/history_bench.cpp -o history_bench
+//   ./history_bench [turns] [undo depth] [forks]
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+#define TBA_NO_MAIN
+#include "../example3.cpp"
+#include "../engine/history.hpp"
+
+enum MODE { NONE, SNAPSHOTS, COPIES };
+
+static uint64_t nextRandom(uint64_t& state) {
+    state = state * 6364136223846793005ull + 1442695040888963407ull;
+    return state >> 33;
+}
+
+// Random playthroughs, restarted at every end; every 8th turn undoes one turn instead
+static double play(const STORY::Story& story, MODE mode, uint64_t turns, size_t depth, size_t& bytes, size_t& kept) {
+    HISTORY::History history(depth);
+    std::vector<SESSION::State> copies(depth); // COPIES: the same ring, deep copied
+    std::vector<STORY::NodeId> copyNodes(depth);
+    size_t copyFirst = 0, copyCount = 0;
+    auto copy = [&](const SESSION::Session& session) {
+        size_t at = (copyFirst + copyCount) % depth;
+        copies[at].inv = session.inventory();
+        copies[at].vars = session.variables();
+        copyNodes[at] = session.node();
+        if (copyCount < depth) ++copyCount; else copyFirst = (copyFirst + 1) % depth;
+    };
+
+    SESSION::Session session(story);
+    session.start();
+    uint64_t random = 1;
+    auto begin = std::chrono::steady_clock::now();
+    for (uint64_t n = 0; n < turns; ++n) {
+        if (session.ended()) {
+            session = SESSION::Session(story);
+            session.start();
+            history.clear();
+            copyCount = 0;
+        }
+        uint64_t r = nextRandom(random);
+        if (r % 8 == 0) {
+            if (mode == SNAPSHOTS) {
+                history.undo(session);
+            } else if (mode == COPIES && copyCount > 1) {
+                --copyCount;
+                const size_t at = (copyFirst + copyCount - 1) % depth;
+                session.restore(copyNodes[at], copies[at].inv, &copies[at].vars);
+            }
+            continue;
+        }
+        session.step(static_cast<int>(r % story.node(session.node()).optionCount));
+        if (mode == SNAPSHOTS) history.record(session);
+        if (mode == COPIES) copy(session);
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+    // what a full ring costs: play on without restarts or undo until it is full
+    session = SESSION::Session(story);
+    session.start();
+    history.clear();
+    copyCount = 0;
+    for (size_t n = 0; n < depth * 4; ++n) {
+        if (session.ended()) break;
+        session.step(static_cast<int>(nextRandom(random) % story.node(session.node()).optionCount));
+        if (mode == SNAPSHOTS) history.record(session);
+        if (mode == COPIES) copy(session);
+    }
+    bytes = 0;
+    kept = 0;
+    if (mode == SNAPSHOTS) {
+        bytes = history.memory();
+        kept = history.size();
+    } else if (mode == COPIES) {
+        bytes = depth * (sizeof(SESSION::State) + sizeof(STORY::NodeId));
+        for (size_t i = 0; i < copyCount; ++i) bytes += HISTORY::bytes(copies[(copyFirst + i) % depth]) - sizeof(SESSION::State) - 2 * sizeof(void*);
+        kept = copyCount;
+    }
+    return seconds;
+}
+
+int main(int argc, char** argv) {
+    uint64_t turns = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 10000000;
+    size_t depth = argc > 2 ? static_cast<size_t>(std::atoi(argv[2])) : 256;
+    uint32_t forkCount = argc > 3 ? static_cast<uint32_t>(std::atoi(argv[3])) : 100000;
+    if (depth == 0) depth = 1;
+
+    STORY::Story story = STORY::compile(buildEchoesOfTheVoid());
+    std::cout << turns << " turns, undo depth " << depth << "\n";
+    const char* names[] = {"no history:       ", "snapshots:        ", "deep copied ring: "};
+    for (MODE mode : {NONE, SNAPSHOTS, COPIES}) {
+        size_t bytes = 0, kept = 0;
+        double seconds = play(story, mode, turns, depth, bytes, kept);
+        std::cout << names[mode] << seconds * 1e9 / turns << " ns/turn";
+        if (kept) std::cout << ", " << kept << " turns kept in " << bytes << " bytes (" << bytes / kept << " per turn)";
+        std::cout << "\n";
+    }
+
+    // play into the story until the inventory holds something, then fork from there
+    SESSION::Session trunk(story);
+    trunk.start();
+    uint64_t random = 3;
+    while (trunk.inventory().stacks.empty() || trunk.ended()) {
+        if (trunk.ended()) {
+            trunk = SESSION::Session(story);
+            trunk.start();
+        }
+        trunk.step(static_cast<int>(nextRandom(random) % story.node(trunk.node()).optionCount));
+    }
+    uint32_t options = story.node(trunk.node()).optionCount;
+
+    std::vector<SESSION::Session> forks;
+    forks.reserve(forkCount);
+    auto begin = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < forkCount; ++i) forks.push_back(trunk.fork());
+    auto forked = std::chrono::steady_clock::now();
+    std::vector<SESSION::Snapshot> tips;
+    tips.reserve(forkCount);
+    for (uint32_t i = 0; i < forkCount; ++i) {
+        SESSION::Session& fork = forks[i];
+        fork.step(static_cast<int>(i % options));
+        for (int n = 0; n < 4 && !fork.ended(); ++n) {
+            fork.step(static_cast<int>(nextRandom(random) % story.node(fork.node()).optionCount));
+        }
+        tips.push_back(fork.snapshot());
+    }
+    auto played = std::chrono::steady_clock::now();
+    size_t shared = HISTORY::retained(tips.begin(), tips.end());
+    size_t copied = 0;
+    for (const auto& tip : tips) copied += HISTORY::bytes(*tip.state);
+    std::cout << forkCount << " forks of one session: " << std::chrono::duration<double, std::nano>(forked - begin).count() / forkCount
+              << " ns/fork, 5 turns each in " << std::chrono::duration<double, std::milli>(played - forked).count() << " ms\n"
+              << "state kept by the forks: " << shared << " bytes shared, " << copied << " bytes if every fork had its own copy\n";
+    return 0;
+}
@@ -0,0 +1,164 @@
+// Checks MASKS::OptionMasks against the session rules, then times it. Every option of the
+// examples and of a generated story with many items, long action lists and wide nodes is
+// judged on random inventories both by the masks and by running its actions one by one
+// through SESSION::runAction; any difference is printed and fails the run. Build with
+// -mavx2 to check and time the SIMD path.
+//
+//   g++ -std=c++17 -O2 -mavx2 bench/masks_bench.cpp -o masks_bench
+//   ./masks_bench [inventories per story]
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#define TBA_NO_MAIN
+#include "../example1.cpp"
+#include "../example2.cpp"
+#include "../example3.cpp"
+#include "../engine/masks.hpp"
+#include "../engine/session.hpp"
+
+// splitmix64
+static uint64_t nextRandom(uint64_t& state) {
+    uint64_t z = (state += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+// Nodes of 1 to 12 options, each option up to ACTION::MAX_ACTIONS actions over 150 items:
+// pickups of several items, uses of up to 3 of an item (or of nothing), NONE and an opcode
+// nobody registered
+static STORY::Story generate(uint32_t nodeCount) {
+    auto arrays = std::make_shared<STORY::Storage>();
+    uint64_t random = 11;
+    for (uint32_t i = 0; i < 150; ++i) arrays->items.push_back(INVENTORY::itemTable().intern("Part " + std::to_string(i)));
+    auto anyItem = [&] { return arrays->items[nextRandom(random) % arrays->items.size()]; };
+
+    for (uint32_t id = 0; id < nodeCount; ++id) {
+        STORY::NodeRecord node;
+        node.firstOption = static_cast<uint32_t>(arrays->options.size());
+        node.optionCount = 1 + static_cast<uint32_t>(nextRandom(random) % 12);
+        for (uint32_t i = 0; i < node.optionCount; ++i) {
+            STORY::OptionRecord option;
+            option.next = static_cast<STORY::NodeId>(nextRandom(random) % nodeCount);
+            option.actions.first = static_cast<uint32_t>(arrays->actions.size());
+            option.actions.count = static_cast<uint32_t>(nextRandom(random) % (ACTION::MAX_ACTIONS + 1));
+            for (uint32_t a = 0; a < option.actions.count; ++a) {
+                static const uint32_t opcodes[] = { ACTION::PICKUP, ACTION::USE, ACTION::USE, ACTION::NONE, 9 };
+                ACTION::Operands action;
+                action.opcode = opcodes[nextRandom(random) % 5];
+                action.firstItem = static_cast<uint32_t>(arrays->pickups.size());
+                if (action.opcode != ACTION::USE) {
+                    action.itemCount = static_cast<uint32_t>(nextRandom(random) % 4);
+                    for (uint32_t p = 0; p < action.itemCount; ++p) arrays->pickups.push_back(anyItem());
+                }
+                if (action.opcode == ACTION::USE) action.item = nextRandom(random) % 16 ? anyItem() : INVENTORY::NO_ITEM;
+                action.count = 1 + static_cast<uint32_t>(nextRandom(random) % 3);
+                arrays->actions.push_back(action);
+            }
+            arrays->options.push_back(option);
+        }
+        arrays->nodes.push_back(node);
+    }
+    return STORY::Story::fromStorage(arrays);
+}
+
+// Holds each of the story's items with chance 1 in `sparse`, 1 to 3 of it, and sometimes
+// items the story never mentions (ids past the masks)
+static INVENTORY::Inventory randomInventory(const STORY::Story& story, uint64_t& random) {
+    INVENTORY::Inventory inv;
+    uint64_t sparse = 2 + nextRandom(random) % 30;
+    for (INVENTORY::ItemId id : story.items) {
+        if (nextRandom(random) % sparse == 0) inv.addItem(id, 1 + static_cast<uint32_t>(nextRandom(random) % 3));
+    }
+    if (nextRandom(random) % 4 == 0) inv.addItem(INVENTORY::itemTable().intern("Stranger " + std::to_string(nextRandom(random) % 300)));
+    return inv;
+}
+
+// Whether the option's actions take effect, by the session rules, each judged on inv as it
+// is before the option runs
+static bool works(const STORY::Story& story, const STORY::OptionRecord& option, const INVENTORY::Inventory& inv) {
+    const ACTION::Operands* actions = story.actionList(option.actions);
+    for (uint32_t a = 0; a < option.actions.count; ++a) {
+        INVENTORY::Inventory copy = inv;
+        ACTION::RESULT result = SESSION::runAction(story, copy, actions[a]).result;
+        if (result == ACTION::MISSING_ITEM || result == ACTION::ALREADY_HAVE) return false;
+    }
+    return true;
+}
+
+// Compares every node of story on `inventories` random inventories, returns the mismatches
+static uint64_t check(const char* name, const STORY::Story& story, uint32_t inventories) {
+    MASKS::OptionMasks masks(story);
+    uint64_t random = 5;
+    uint64_t mismatches = 0, options = 0;
+    std::vector<uint64_t> bits;
+    for (uint32_t n = 0; n < inventories; ++n) {
+        INVENTORY::Inventory inv = randomInventory(story, random);
+        for (STORY::NodeId node = 0; node < story.nodeCount(); ++node) {
+            const STORY::NodeRecord& record = story.node(node);
+            bits.assign((record.optionCount + 63) / 64 + 1, 0);
+            masks.available(node, inv, bits.data());
+            for (uint32_t i = 0; i < record.optionCount; ++i) {
+                bool expected = works(story, story.option(node, i), inv);
+                bool got = (bits[i >> 6] >> (i & 63)) & 1;
+                ++options;
+                if (expected == got) continue;
+                if (++mismatches <= 5) {
+                    std::cerr << "[MISMATCH] " << name << " node " << node << " option " << i << ": masks say " << got
+                              << ", the session says " << expected << "\n";
+                }
+            }
+        }
+    }
+    std::cout << name << ": " << options << " options checked, " << mismatches << " mismatches\n";
+    return mismatches;
+}
+
+int main(int argc, char** argv) {
+    uint32_t inventories = argc > 1 ? static_cast<uint32_t>(std::atoi(argv[1])) : 2000;
+#ifdef MASKS_AVX2
+    std::cout << "AVX2 path\n";
+#else
+    std::cout << "scalar path\n";
+#endif
+
+    STORY::Story generated = generate(2000);
+    uint64_t mismatches = check("example1", STORY::compile(buildTestGame()), inventories)
+                        + check("example2", STORY::compile(buildTheForest()), inventories)
+                        + check("example3", STORY::compile(buildEchoesOfTheVoid()), inventories)
+                        + check("generated", generated, inventories / 20 + 1);
+    if (mismatches != 0) return 1;
+
+    // every node of the generated story against one inventory at a time
+    MASKS::OptionMasks masks(generated);
+    uint64_t random = 9;
+    std::vector<INVENTORY::Inventory> players;
+    for (uint32_t i = 0; i < 64; ++i) players.push_back(randomInventory(generated, random));
+    uint64_t bits[1] = {}, sum = 0, nodes = 0;
+    auto begin = std::chrono::steady_clock::now();
+    for (uint32_t round = 0; round < 64; ++round) {
+        for (STORY::NodeId node = 0; node < generated.nodeCount(); ++node, ++nodes) {
+            masks.available(node, players[round], bits);
+            sum += bits[0];
+        }
+    }
+    double masked = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - begin).count() / nodes;
+
+    begin = std::chrono::steady_clock::now();
+    for (uint32_t round = 0; round < 64; ++round) {
+        for (STORY::NodeId node = 0; node < generated.nodeCount(); ++node) {
+            const STORY::NodeRecord& record = generated.node(node);
+            uint64_t each = 0;
+            for (uint32_t i = 0; i < record.optionCount; ++i) each |= uint64_t(works(generated, generated.option(node, i), players[round])) << i;
+            sum -= each;
+        }
+    }
+    double session = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - begin).count() / nodes;
+    std::cout << "generated, per node: masks " << masked << " ns, session rules " << session << " ns"
+              << (sum == 0 ? "" : " (the two disagree)") << "\n";
+    return 0;
+}
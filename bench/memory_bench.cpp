@@ -0,0 +1,135 @@
+// Plays [sessions] example3 sessions side by side, one turn of each in turn, for up to
+// [turns] turns. Every session renders into its own output buffer and keeps the snapshot
+// of its last turn (one step of undo). Three ways to get their memory: the global heap,
+// the global heap through a MEMORY::Account per session, and a MEMORY::Arena per session.
+// Reports play and teardown time, heap allocations, and per-session bytes for the counted
+// modes.
+//
+//   g++ -std=c++17 -O2 -pthread bench/memory_bench.cpp -o memory_bench
+//   ./memory_bench [sessions] [turns]
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <vector>
+
+#define TBA_NO_MAIN
+#include "../example3.cpp"
+#include "../engine/memory.hpp"
+#include "../engine/render.hpp"
+
+// Counts every heap allocation in the process
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete" // malloc/free behind new/delete is intended
+#endif
+static std::atomic<uint64_t> allocations{ 0 };
+
+void* operator new(size_t size) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = std::malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, size_t) noexcept { std::free(p); }
+// std::pmr::new_delete_resource() asks for its alignment explicitly
+void* operator new(size_t size, std::align_val_t alignment) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    size_t align = static_cast<size_t>(alignment);
+    if (void* p = std::aligned_alloc(align, (std::max<size_t>(size, 1) + align - 1) / align * align)) return p;
+    throw std::bad_alloc();
+}
+void operator delete(void* p, std::align_val_t) noexcept { std::free(p); }
+void operator delete(void* p, size_t, std::align_val_t) noexcept { std::free(p); }
+
+enum MODE { HEAP, ACCOUNTS, ARENAS };
+
+struct Player {
+    Player(const STORY::Story& story, std::pmr::memory_resource* memory) : session(story, memory), out(memory) {}
+
+    SESSION::Session session;
+    OUTPUT::Buffer out;
+    SESSION::Snapshot last;
+};
+
+// Members go in reverse: the player before the memory it lives in
+struct Slot {
+    std::unique_ptr<MEMORY::Arena> arena;
+    std::unique_ptr<MEMORY::Account> account;
+    std::unique_ptr<Player> player;
+};
+
+static uint64_t nextRandom(uint64_t& state) {
+    state = state * 6364136223846793005ull + 1442695040888963407ull;
+    return state >> 33;
+}
+
+static void run(const STORY::Story& story, MODE mode, uint32_t sessions, uint32_t turns) {
+    uint64_t before = allocations.load();
+    auto begin = std::chrono::steady_clock::now();
+    std::vector<Slot> slots(sessions);
+    for (Slot& slot : slots) {
+        std::pmr::memory_resource* memory = std::pmr::get_default_resource();
+        if (mode == ACCOUNTS) {
+            slot.account.reset(new MEMORY::Account());
+            memory = slot.account.get();
+        } else if (mode == ARENAS) {
+            slot.arena.reset(new MEMORY::Arena());
+            memory = slot.arena->resource();
+        }
+        slot.player.reset(new Player(story, memory));
+        SESSION::TurnResult turn = slot.player->session.start();
+        RENDER::arrival(slot.player->out, story, turn);
+        slot.player->out.clear();
+    }
+    uint64_t random = 1;
+    for (uint32_t t = 0; t < turns; ++t) {
+        for (Slot& slot : slots) {
+            Player& player = *slot.player;
+            if (player.session.ended()) continue;
+            player.last = player.session.snapshot();
+            SESSION::TurnResult turn = player.session.step(static_cast<int>(nextRandom(random) % story.node(player.session.node()).optionCount));
+            RENDER::turn(player.out, story, turn);
+            player.out.clear();
+        }
+    }
+    auto played = std::chrono::steady_clock::now();
+    uint64_t playAllocations = allocations.load() - before;
+
+    std::vector<size_t> peaks;
+    size_t footprint = 0;
+    for (const Slot& slot : slots) {
+        if (slot.account) peaks.push_back(slot.account->peak());
+        if (slot.arena) {
+            peaks.push_back(slot.arena->peak());
+            footprint += slot.arena->footprint();
+        }
+    }
+    slots.clear();
+    auto freed = std::chrono::steady_clock::now();
+
+    const char* names[] = {"heap:     ", "accounts: ", "arenas:   "};
+    std::cout << names[mode] << std::chrono::duration<double, std::milli>(played - begin).count() << " ms to play, "
+              << std::chrono::duration<double, std::milli>(freed - played).count() << " ms to free, "
+              << static_cast<double>(playAllocations) / sessions << " heap allocations per session\n";
+    if (!peaks.empty()) {
+        std::sort(peaks.begin(), peaks.end());
+        std::cout << "          peak bytes per session: p50 " << peaks[peaks.size() / 2] << "  p99 " << peaks[peaks.size() * 99 / 100]
+                  << "  max " << peaks.back();
+        if (footprint) std::cout << ", heap footprint " << footprint / sessions << " bytes per session";
+        std::cout << "\n";
+    }
+}
+
+int main(int argc, char** argv) {
+    uint32_t sessions = argc > 1 ? static_cast<uint32_t>(std::atoi(argv[1])) : 100000;
+    uint32_t turns = argc > 2 ? static_cast<uint32_t>(std::atoi(argv[2])) : 40;
+
+    STORY::Story story = STORY::compile(buildEchoesOfTheVoid());
+    std::cout << sessions << " sessions, up to " << turns << " turns each\n";
+    for (MODE mode : {HEAP, ACCOUNTS, ARENAS}) run(story, mode, sessions, turns);
+    return 0;
+}
@@ -0,0 +1,108 @@
+// Ticks [npcs] NPCs of a few kinds over the example3 map, once per frame, on 1 up to
+// [threads] threads. A player walks the story at random so followers, shy ones and guards
+// have something to react to. Reports ms per frame and ns per NPC for every thread count,
+// checks that all of them end in the same world, then times presence queries.
+//
+//   g++ -std=c++17 -O2 -pthread bench/npc_bench.cpp -o npc_bench
+//   ./npc_bench [npcs] [frames] [threads]
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <thread>
+
+#define TBA_NO_MAIN
+#include "../example3.cpp"
+#include "../engine/npc.hpp"
+
+// Position of every NPC folded into one number, equal worlds give equal sums
+static uint64_t checksum(const NPC::World& world) {
+    uint64_t sum = 1469598103934665603ull;
+    for (NPC::NpcId id = 0; id < world.size(); ++id) {
+        sum = (sum ^ (world.node(id) * 4u + world.moodOf(id))) * 1099511628211ull;
+    }
+    return sum;
+}
+
+struct Result {
+    double seconds = 0;
+    uint64_t sum = 0;
+};
+
+static Result run(const STORY::Story& story, uint32_t npcs, uint32_t frames, size_t threads) {
+    NPC::World world(story, threads);
+    NPC::KindId kinds[] = {
+        world.addKind({"wanderer", NPC::WANDER, 1}),
+        world.addKind({"drifter", NPC::WANDER, 3}),
+        world.addKind({"follower", NPC::FOLLOW, 1}),
+        world.addKind({"shade", NPC::SHY, 1}),
+        world.addKind({"sentinel", NPC::GUARD, 4}),
+    };
+    world.reserve(npcs);
+    for (uint32_t i = 0; i < npcs; ++i) {
+        world.spawn(kinds[i % 5], static_cast<STORY::NodeId>(i % story.nodes.size), i + 1);
+    }
+
+    SESSION::Session player(story);
+    SESSION::TurnResult turn = player.start();
+    uint64_t random = 7;
+    auto begin = std::chrono::steady_clock::now();
+    for (uint32_t frame = 0; frame < frames; ++frame) {
+        STORY::NodeId from = STORY::NO_NODE;
+        if (turn.ended) {
+            player = SESSION::Session(story);
+            turn = player.start();
+        } else {
+            random = random * 6364136223846793005ull + 1442695040888963407ull;
+            from = turn.node;
+            turn = player.step(static_cast<int>((random >> 33) % story.node(turn.node).optionCount));
+        }
+        world.notify(from, turn);
+        world.tick();
+    }
+    Result result;
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    result.sum = checksum(world);
+
+    if (threads == 1) {
+        // presence: who is in a node and how many of one kind
+        uint64_t seen = 0;
+        const uint32_t QUERIES = 1000000;
+        auto start = std::chrono::steady_clock::now();
+        for (uint32_t q = 0; q < QUERIES; ++q) {
+            STORY::NodeId node = static_cast<STORY::NodeId>(q % story.nodes.size);
+            seen += world.present(node).size;
+        }
+        auto middle = std::chrono::steady_clock::now();
+        for (uint32_t q = 0; q < QUERIES; ++q) {
+            seen += world.count(static_cast<STORY::NodeId>(q % story.nodes.size), kinds[q % 5]);
+        }
+        auto end = std::chrono::steady_clock::now();
+        std::cout << "present(node): " << std::chrono::duration<double, std::nano>(middle - start).count() / QUERIES
+                  << " ns, count(node, kind): " << std::chrono::duration<double, std::nano>(end - middle).count() / QUERIES
+                  << " ns (" << seen << ")\n";
+    }
+    return result;
+}
+
+int main(int argc, char** argv) {
+    uint32_t npcs = argc > 1 ? static_cast<uint32_t>(std::atoi(argv[1])) : 1000000;
+    uint32_t frames = argc > 2 ? static_cast<uint32_t>(std::atoi(argv[2])) : 200;
+    size_t maxThreads = argc > 3 ? static_cast<size_t>(std::atoi(argv[3])) : std::max(1u, std::thread::hardware_concurrency());
+    if (maxThreads == 0) maxThreads = 1;
+
+    STORY::Story story = STORY::compile(buildEchoesOfTheVoid());
+    std::cout << npcs << " NPCs over " << story.nodes.size << " nodes, " << frames << " frames\n";
+
+    uint64_t expected = 0;
+    bool same = true;
+    for (size_t threads = 1; threads <= maxThreads; threads *= 2) {
+        Result result = run(story, npcs, frames, threads);
+        if (threads == 1) expected = result.sum;
+        same = same && result.sum == expected;
+        std::cout << threads << " threads: " << result.seconds * 1000 / frames << " ms/frame, "
+                  << result.seconds * 1e9 / (double(frames) * npcs) << " ns/NPC\n";
+    }
+    std::cout << (same ? "same world on every thread count\n" : "[ERROR] worlds differ between thread counts\n");
+    return same ? 0 : 1;
+}
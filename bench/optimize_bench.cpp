@@ -0,0 +1,91 @@
+// Runs OPTIMIZE::optimize over the example stories and over a generated one of [rooms]
+// rooms. Every generated room has a way on through a corridor of pass-through nodes, a
+// hatch into a pit that ends the game (the same text everywhere), and a look around that
+// leads back. Reports nodes, options and compiled bytes before and after, how long the pass
+// takes, and the turns and time a session needs to walk from the first room to the last.
+//
+//   g++ -std=c++17 -O2 -pthread bench/optimize_bench.cpp -o optimize_bench
+//   ./optimize_bench [rooms] [corridor length]
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#define TBA_NO_MAIN
+#include "../example1.cpp"
+#include "../example2.cpp"
+#include "../example3.cpp"
+#include "../engine/optimize.hpp"
+#include "../engine/session.hpp"
+
+static NODE::Option plain(const char* text) {
+    return NODE::Option(text, ACTION::Action(ACTION::TYPE::NONE), INVENTORY::ItemVec(), INVENTORY::Item());
+}
+
+static NODE::NodePtr generate(uint32_t rooms, uint32_t corridor) {
+    auto node = [](const std::string& text) {
+        return NODE::createNode(text, ACTION::TYPE::NONE, INVENTORY::Item(), INVENTORY::ItemVec());
+    };
+    std::vector<NODE::NodePtr> room(rooms);
+    for (uint32_t i = 0; i < rooms; ++i) room[i] = node("Room " + std::to_string(i) + ". Dust hangs in the air of this deck.");
+    NODE::NodePtr ending = node("You reach the bridge. The end.");
+    for (uint32_t i = 0; i < rooms; ++i) {
+        NODE::NodePtr next = i + 1 < rooms ? room[i + 1] : ending;
+        for (uint32_t k = corridor; k > 0; --k) {
+            NODE::NodePtr step = node("The corridor past room " + std::to_string(i) + " bends, step " + std::to_string(k) + ".");
+            step->addNextNode(next, plain("Keep going"));
+            next = step;
+        }
+        room[i]->addNextNode(next, plain("Walk on"));
+        NODE::NodePtr pit = node("The hatch gives way and you fall down a shaft. The end.");
+        room[i]->addNextNode(pit, plain("Open the hatch"));
+        NODE::NodePtr look = node("Nothing but dust and scattered panels.");
+        look->addNextNode(room[i], plain("Back"));
+        room[i]->addNextNode(look, plain("Look around"));
+    }
+    return room[0];
+}
+
+// Always takes the first option: turns and ns per turn until the story ends
+static void walk(const char* name, const STORY::Story& story) {
+    SESSION::Session session(story);
+    auto begin = std::chrono::steady_clock::now();
+    SESSION::TurnResult turn = session.start();
+    uint64_t turns = 0;
+    while (!turn.ended) {
+        turn = session.step(0);
+        ++turns;
+    }
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+    std::cout << "  walk " << name << turns << " turns, " << ms << " ms\n";
+}
+
+static void run(const char* name, const NODE::NodePtr& root, bool walkIt) {
+    OPTIMIZE::Report report;
+    auto begin = std::chrono::steady_clock::now();
+    NODE::NodePtr optimized = OPTIMIZE::optimize(root, nullptr);
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+    OPTIMIZE::optimize(root, &report);
+
+    std::cout << name << ": " << report.nodesBefore << " -> " << report.nodesAfter << " nodes, " << report.edgesBefore << " -> "
+              << report.edgesAfter << " options, " << report.bytesBefore << " -> " << report.bytesAfter << " bytes ("
+              << report.duplicates << " duplicates, " << report.chained << " chained, " << report.rounds << " rounds), "
+              << ms << " ms\n";
+    if (walkIt) {
+        walk("before: ", STORY::compile(root));
+        walk("after:  ", STORY::compile(optimized));
+    }
+}
+
+int main(int argc, char** argv) {
+    uint32_t rooms = argc > 1 ? static_cast<uint32_t>(std::atoi(argv[1])) : 100000;
+    uint32_t corridor = argc > 2 ? static_cast<uint32_t>(std::atoi(argv[2])) : 3;
+
+    run("example1", buildTestGame(), false);
+    run("example2", buildTheForest(), false);
+    run("example3", buildEchoesOfTheVoid(), false);
+    run("generated", generate(rooms, corridor), true);
+    return 0;
+}
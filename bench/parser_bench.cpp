@@ -0,0 +1,138 @@
+// Builds the typed command lexicon for example3 and resolves commands made from its option
+// texts (the whole text, its last two words, "use" and the last word) plus some that are
+// not in the story, at every node that has options. Reports the build time, nanoseconds
+// per command and heap allocations while matching (should be 0), next to a plain matcher
+// that lowercases and splits every option text for every command.
+//
+//   g++ -std=c++17 -O2 -pthread bench/parser_bench.cpp -o parser_bench
+//   ./parser_bench [rounds]
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#define TBA_NO_MAIN
+#include "../example3.cpp"
+#include "../engine/parser.hpp"
+
+// Counts every heap allocation in the process
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete" // malloc/free behind new/delete is intended
+#endif
+static std::atomic<uint64_t> allocations{ 0 };
+
+void* operator new(size_t size) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = std::malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, size_t) noexcept { std::free(p); }
+
+struct Command {
+    STORY::NodeId node;
+    std::string text;
+};
+
+static std::vector<std::string> split(const std::string& text) {
+    std::vector<std::string> words;
+    std::string word;
+    std::istringstream in(text);
+    while (in >> word) {
+        std::string clean;
+        for (char c : word) {
+            if (std::isalnum(static_cast<unsigned char>(c))) clean += static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+        }
+        if (!clean.empty()) words.push_back(clean);
+    }
+    return words;
+}
+
+// What one would write first: the option sharing the most words with the command
+static int plainMatch(const STORY::Story& story, STORY::NodeId node, const std::string& input) {
+    std::vector<std::string> typed = split(input);
+    int best = 0, choice = 0;
+    for (uint32_t i = 0; i < story.node(node).optionCount; ++i) {
+        std::vector<std::string> words = split(std::string(story.text(story.option(node, i).text)));
+        int score = 0;
+        for (const std::string& word : typed) score += std::count(words.begin(), words.end(), word) != 0;
+        if (score > best) {
+            best = score;
+            choice = static_cast<int>(i) + 1;
+        }
+    }
+    return choice;
+}
+
+int main(int argc, char** argv) {
+    uint32_t rounds = argc > 1 ? static_cast<uint32_t>(std::atoi(argv[1])) : 200;
+
+    STORY::Story story = STORY::compile(buildEchoesOfTheVoid());
+    std::string error;
+    const uint32_t BUILDS = 100;
+    PARSER::Lexicon lexicon;
+    auto begin = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < BUILDS; ++i) {
+        lexicon = PARSER::Lexicon();
+        if (!lexicon.build(story, &error)) {
+            std::cerr << "[ERROR] " << error << "\n";
+            return 1;
+        }
+    }
+    auto built = std::chrono::steady_clock::now();
+    std::cout << "lexicon: " << lexicon.wordCount() << " words, " << lexicon.trieSize() << " trie nodes, "
+              << std::chrono::duration<double, std::micro>(built - begin).count() / BUILDS << " us to build\n";
+
+    std::vector<Command> commands;
+    for (STORY::NodeId node = 0; node < story.nodeCount(); ++node) {
+        for (uint32_t i = 0; i < story.node(node).optionCount; ++i) {
+            std::string text(story.text(story.option(node, i).text));
+            std::vector<std::string> words = split(text);
+            commands.push_back({node, text});
+            if (words.size() >= 2) commands.push_back({node, words[words.size() - 2] + " " + words.back()});
+            if (!words.empty()) commands.push_back({node, "use " + words.back()});
+        }
+        if (story.node(node).optionCount) {
+            commands.push_back({node, "dance with the xyzzy"});
+            commands.push_back({node, "inventory"});
+            commands.push_back({node, "look"});
+        }
+    }
+
+    uint64_t statuses[6] = {};
+    for (const Command& command : commands) ++statuses[lexicon.match(story, command.node, command.text).status];
+    std::cout << commands.size() << " commands: " << statuses[PARSER::MATCHED] << " matched, " << statuses[PARSER::COMMAND]
+              << " commands, " << statuses[PARSER::AMBIGUOUS] << " ambiguous, " << statuses[PARSER::NO_MATCH] << " no match, "
+              << statuses[PARSER::UNKNOWN_WORD] << " unknown words\n";
+
+    INVENTORY::Inventory inventory;
+    uint64_t checksum = 0;
+    uint64_t before = allocations.load();
+    begin = std::chrono::steady_clock::now();
+    for (uint32_t r = 0; r < rounds; ++r) {
+        for (const Command& command : commands) checksum += PARSER::choice(lexicon.match(story, command.node, command.text, &inventory)) + 5;
+    }
+    auto matched = std::chrono::steady_clock::now();
+    uint64_t matchAllocations = allocations.load() - before;
+    double total = static_cast<double>(rounds) * commands.size();
+    std::cout << "lexicon: " << std::chrono::duration<double, std::nano>(matched - begin).count() / total << " ns per command, "
+              << matchAllocations << " heap allocations\n";
+
+    before = allocations.load();
+    begin = std::chrono::steady_clock::now();
+    for (uint32_t r = 0; r < rounds; ++r) {
+        for (const Command& command : commands) checksum += plainMatch(story, command.node, command.text);
+    }
+    auto plain = std::chrono::steady_clock::now();
+    std::cout << "plain:   " << std::chrono::duration<double, std::nano>(plain - begin).count() / total << " ns per command, "
+              << static_cast<double>(allocations.load() - before) / total << " heap allocations per command\n";
+    std::cout << "(checksum " << checksum << ")\n";
+    return 0;
+}
@@ -0,0 +1,97 @@
+// Plays example3 with a million sessions round robin and, a third of the way in, reloads a
+// new version of the story (one more room off the cryo bay, so every node id after it
+// moves) from another thread. Reports the swap pause, turn latency before the reload, while
+// the sessions migrate and after, and whether the old version was freed.
+//
+//   g++ -std=c++17 -O2 -pthread bench/reload_bench.cpp -o reload_bench
+//   ./reload_bench [sessions] [turns]
+
+#include <algorithm>
+#include <iostream>
+#include <chrono>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+#define TBA_NO_MAIN
+#include "../example3.cpp"
+#include "../engine/reload.hpp"
+
+// The next version: a new first option on the root, the rest of the graph as it was
+static STORY::Story nextVersion() {
+    NODE::NodePtr root = buildEchoesOfTheVoid();
+    NODE::NodePtr log = NODE::createNode("The pod's log screen flickers: CRYO CYCLE 4471. NO FURTHER ENTRIES.",
+                                         ACTION::TYPE::NONE, INVENTORY::Item(), INVENTORY::ItemVec());
+    log->addNextNode(root, NODE::Option("Look away", ACTION::Action(ACTION::TYPE::NONE), INVENTORY::ItemVec(), INVENTORY::Item()));
+    root->nextNodes.insert(root->nextNodes.begin(), log);
+    root->options.insert(root->options.begin(),
+                         NODE::Option("Read the pod's log", ACTION::Action(ACTION::TYPE::NONE), INVENTORY::ItemVec(), INVENTORY::Item()));
+    return STORY::compile(root);
+}
+
+static void report(const char* name, std::vector<uint32_t>& samples) {
+    if (samples.empty()) return;
+    std::sort(samples.begin(), samples.end());
+    auto percentile = [&](double p) {
+        return samples[std::min(samples.size() - 1, static_cast<size_t>(p * samples.size()))];
+    };
+    std::cout << name << samples.size() << " turns, ns/turn p50 " << percentile(0.50) << "  p99 " << percentile(0.99)
+              << "  p99.9 " << percentile(0.999) << "  max " << samples.back() << "\n";
+}
+
+int main(int argc, char** argv) {
+    uint32_t sessionCount = argc > 1 ? static_cast<uint32_t>(std::atoi(argv[1])) : 1000000;
+    uint64_t turns = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 4000000;
+    if (sessionCount == 0) sessionCount = 1;
+
+    RELOAD::Library library(STORY::compile(buildEchoesOfTheVoid()));
+    std::vector<RELOAD::Session> sessions;
+    sessions.reserve(sessionCount);
+    for (uint32_t i = 0; i < sessionCount; ++i) {
+        sessions.emplace_back(library);
+        sessions.back().start();
+    }
+    std::cout << "story: " << library.current()->story.nodeCount() << " nodes, " << sessionCount << " sessions, "
+              << turns << " turns\n";
+
+    std::vector<uint32_t> before, migrating, after; // ns per turn
+    before.reserve(static_cast<size_t>(turns));
+    RELOAD::PublishStats published;
+    std::thread reloader;
+    uint64_t reloadAt = turns / 3;
+    uint64_t migrated = 0;
+    uint64_t allMigratedAt = 0;
+    uint64_t random = 5;
+
+    for (uint64_t n = 0; n < turns; ++n) {
+        if (n == reloadAt) {
+            reloader = std::thread([&] { published = library.publish(nextVersion()); });
+        }
+        RELOAD::Session& session = sessions[n % sessionCount];
+        uint64_t generation = session.generation();
+        random = random * 6364136223846793005ull + 1442695040888963407ull;
+
+        auto begin = std::chrono::steady_clock::now();
+        SESSION::TurnResult result;
+        if (session.state().ended()) {
+            result = session.start();
+        } else {
+            uint32_t optionCount = session.story().node(session.state().node()).optionCount;
+            result = session.step(static_cast<int>((random >> 33) % optionCount));
+        }
+        uint32_t ns = static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - begin).count());
+
+        if (session.generation() != generation && ++migrated == sessionCount) allMigratedAt = n;
+        (library.generation() == 1 ? before : migrated < sessionCount ? migrating : after).push_back(ns);
+    }
+    if (reloader.joinable()) reloader.join();
+
+    std::cout << "reload: build " << published.buildSeconds * 1000 << " ms, swap pause " << published.pauseNs << " ns\n";
+    report("before:    ", before);
+    report("migrating: ", migrating);
+    report("after:     ", after);
+    std::cout << "migrated: " << migrated << " of " << sessionCount << " sessions";
+    if (allMigratedAt) std::cout << ", all by turn " << allMigratedAt;
+    std::cout << "\nold versions still held: " << library.retiring() << "\n";
+    return migrated == sessionCount ? 0 : 1;
+}
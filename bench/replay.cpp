@@ -0,0 +1,174 @@
+// Replays recorded playthroughs against a story at full speed and reports throughput,
+// per turn latency percentiles and heap allocations per turn. Output is rendered exactly
+// like Game::Run renders it and sent to a NullSink.
+//
+//   g++ -std=c++17 -O2 bench/replay.cpp -o replay
+//   ./replay example3 bench/playthroughs/example3.txt
+//   ./replay story.tbs recorded.txt 2000000
+//
+// Streamed story files (storyc with a chapter size) are rendered through their pages, the
+// way Game::Run plays them.
+//
+// A playthrough file has one playthrough per line: the 1-based choices a player typed,
+// separated by spaces. Lines starting with # are comments.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <new>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "../tools/common.hpp"
+#include "../engine/render.hpp"
+
+// Counts every heap allocation in the process
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete" // malloc/free behind new/delete is intended
+#endif
+static std::atomic<uint64_t> allocations{ 0 };
+
+void* operator new(size_t size) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = std::malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, size_t) noexcept { std::free(p); }
+// std::pmr::new_delete_resource() asks for its alignment explicitly
+void* operator new(size_t size, std::align_val_t alignment) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    size_t align = static_cast<size_t>(alignment);
+    if (void* p = std::aligned_alloc(align, (std::max<size_t>(size, 1) + align - 1) / align * align)) return p;
+    throw std::bad_alloc();
+}
+void operator delete(void* p, std::align_val_t) noexcept { std::free(p); }
+void operator delete(void* p, size_t, std::align_val_t) noexcept { std::free(p); }
+
+struct Playthrough {
+    size_t line = 0; // in the playthrough file, for errors
+    std::vector<int> choices;
+};
+
+static bool loadPlaythroughs(const std::string& path, std::vector<Playthrough>& playthroughs) {
+    std::ifstream file(path);
+    if (!file) {
+        std::cerr << "[ERROR] cannot open " << path << "\n";
+        return false;
+    }
+    std::string line;
+    size_t lineNumber = 0;
+    while (std::getline(file, line)) {
+        ++lineNumber;
+        if (line.empty() || line[0] == '#' || line[0] == '\r') continue;
+        std::istringstream numbers(line);
+        Playthrough playthrough;
+        playthrough.line = lineNumber;
+        int choice;
+        while (numbers >> choice) playthrough.choices.push_back(choice - 1);
+        playthroughs.push_back(std::move(playthrough));
+    }
+    return true;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 3) {
+        std::cerr << "usage: replay <example1|example2|example3|example4|story.tbs> <playthroughs.txt> [min turns]\n";
+        return 1;
+    }
+    uint64_t minTurns = argc > 3 ? std::strtoull(argv[3], nullptr, 10) : 1000000;
+
+    STORY::Story story;
+    std::vector<Playthrough> playthroughs;
+    if (!loadStory(argv[1], story) || !loadPlaythroughs(argv[2], playthroughs)) return 1;
+
+    uint64_t turnsPerPass = 0;
+    for (const auto& playthrough : playthroughs) turnsPerPass += playthrough.choices.size() + 1; // + start()
+    if (turnsPerPass == 0) {
+        std::cerr << "[ERROR] no playthroughs in " << argv[2] << "\n";
+        return 1;
+    }
+    uint64_t passes = std::max<uint64_t>(1, (minTurns + turnsPerPass - 1) / turnsPerPass);
+
+    OUTPUT::Buffer out;
+    OUTPUT::NullSink sink;
+    std::vector<uint32_t> samples; // ns per turn
+    samples.reserve(static_cast<size_t>(passes * turnsPerPass));
+
+    // the story to render a node with: a page of a streamed story, which also reads ahead
+    STREAM::Page page;
+    auto textOf = [&](STORY::NodeId node) -> const STORY::Story& {
+        if (story.chapters.size == 0) return story;
+        std::string error;
+        if (!storyBook().page(node, page, &error)) {
+            std::cerr << "[ERROR] " << error << "\n";
+            std::exit(1);
+        }
+        storyBook().prefetch(node);
+        return page.story();
+    };
+
+    auto playPass = [&](bool record) {
+        for (const auto& playthrough : playthroughs) {
+            auto begin = std::chrono::steady_clock::now();
+            SESSION::Session session(story);
+            SESSION::TurnResult turn = session.start();
+            RENDER::turn(out, textOf(turn.node), turn);
+            sink.write(out);
+            out.clear();
+            auto end = std::chrono::steady_clock::now();
+            if (record) samples.push_back(static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count()));
+
+            for (size_t i = 0; i < playthrough.choices.size(); ++i) {
+                begin = end;
+                turn = session.step(playthrough.choices[i]);
+                if (turn.status != SESSION::OK) { // the recording is not for this story
+                    static const char* reasons[] = { "ok", "is not an option", "comes after the end", "is locked" };
+                    std::cerr << "[ERROR] " << argv[2] << ":" << playthrough.line << ": choice " << i + 1 << " ("
+                              << playthrough.choices[i] + 1 << ") " << reasons[turn.status] << "\n";
+                    std::exit(1);
+                }
+                RENDER::turn(out, textOf(turn.node), turn);
+                sink.write(out);
+                out.clear();
+                end = std::chrono::steady_clock::now();
+                if (record) samples.push_back(static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count()));
+            }
+        }
+    };
+
+    playPass(false); // warm up the buffers
+
+    uint64_t allocationsBefore = allocations.load();
+    auto begin = std::chrono::steady_clock::now();
+    for (uint64_t pass = 0; pass < passes; ++pass) playPass(true);
+    auto end = std::chrono::steady_clock::now();
+    uint64_t allocated = allocations.load() - allocationsBefore;
+
+    double seconds = std::chrono::duration<double>(end - begin).count();
+    uint64_t turns = samples.size();
+    std::sort(samples.begin(), samples.end());
+    auto percentile = [&](double p) {
+        return samples[std::min(samples.size() - 1, static_cast<size_t>(p * samples.size()))];
+    };
+
+    std::cout << "story:        " << argv[1] << " (" << story.nodeCount() << " nodes)\n"
+              << "playthroughs: " << playthroughs.size() << " x " << passes << " passes\n"
+              << "turns:        " << turns << " in " << seconds * 1000 << " ms\n"
+              << "turns/s:      " << static_cast<uint64_t>(turns / seconds) << "\n"
+              << "ns/turn:      p50 " << percentile(0.50) << "  p90 " << percentile(0.90)
+              << "  p99 " << percentile(0.99) << "  max " << samples.back() << "\n"
+              << "allocs/turn:  " << static_cast<double>(allocated) / turns << "\n"
+              << "output:       " << sink.bytes << " bytes\n";
+    if (story.chapters.size != 0) {
+        STREAM::Cache::Stats cache = storyBook().stats();
+        std::cout << "chapters:     " << story.chapters.size << ", " << cache.hits << " hits, " << cache.misses << " misses, "
+                  << cache.prefetched << " read ahead, peak " << cache.peakBytes << " of " << cache.capacity << " bytes\n";
+    }
+    return 0;
+}
@@ -0,0 +1,68 @@
+// Drives 1M scripted turns over example3's story through the scheduler at 1, 2, 4, ... N
+// worker threads and reports throughput and scaling.
+//
+//   g++ -std=c++17 -O2 -pthread bench/scheduler_bench.cpp -o scheduler_bench
+//   ./scheduler_bench [turns] [sessions] [max threads]
+
+#include <iostream>
+#include <chrono>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+#define TBA_NO_MAIN
+#include "../example3.cpp"
+#include "../engine/scheduler.hpp"
+
+// Deterministic per-session "player": picks an option from the turn count
+static int scriptedChoice(SCHEDULER::SessionId session, uint32_t turn, uint32_t optionCount) {
+    uint32_t x = session * 2654435761u ^ turn * 40503u;
+    x ^= x >> 13;
+    return static_cast<int>(x % optionCount);
+}
+
+static double runOnce(const STORY::Story& story, size_t threads, uint32_t turns, uint32_t sessionCount) {
+    uint32_t turnsPerSession = turns / sessionCount;
+    std::vector<uint32_t> played(sessionCount, 0); // each entry only touched by the turn in flight
+
+    SCHEDULER::Scheduler* scheduler = nullptr;
+    SCHEDULER::Scheduler sched(story, threads, [&](SCHEDULER::SessionId id, const SESSION::TurnResult& result) {
+        if (result.ended || ++played[id] >= turnsPerSession) return;
+        uint32_t optionCount = story.node(result.node).optionCount;
+        scheduler->submit(id, scriptedChoice(id, played[id], optionCount));
+    });
+    scheduler = &sched;
+
+    for (uint32_t i = 0; i < sessionCount; ++i) sched.addSession();
+
+    auto begin = std::chrono::steady_clock::now();
+    sched.start();
+    for (uint32_t i = 0; i < sessionCount; ++i) sched.submit(i, -1);
+    sched.wait();
+    auto end = std::chrono::steady_clock::now();
+    sched.stop();
+
+    return std::chrono::duration<double>(end - begin).count();
+}
+
+int main(int argc, char** argv) {
+    uint32_t turns = argc > 1 ? static_cast<uint32_t>(std::atoi(argv[1])) : 1000000;
+    uint32_t sessions = argc > 2 ? static_cast<uint32_t>(std::atoi(argv[2])) : 10000;
+    size_t maxThreads = argc > 3 ? static_cast<size_t>(std::atoi(argv[3])) : std::thread::hardware_concurrency();
+    if (maxThreads == 0) maxThreads = 1;
+
+    STORY::Story story = STORY::compile(buildEchoesOfTheVoid());
+    std::cout << "story: " << story.nodeCount() << " nodes, " << turns << " turns over " << sessions << " sessions\n";
+
+    double base = 0;
+    for (size_t threads = 1; ; threads *= 2) {
+        if (threads > maxThreads) threads = maxThreads;
+        double seconds = runOnce(story, threads, turns, sessions);
+        if (base == 0) base = seconds;
+        std::cout << threads << " threads: " << seconds * 1000 << " ms, "
+                  << static_cast<uint64_t>(turns / seconds) << " turns/s, speedup "
+                  << base / seconds << "x\n";
+        if (threads == maxThreads) break;
+    }
+    return 0;
+}
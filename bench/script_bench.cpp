@@ -0,0 +1,64 @@
+// Evaluates a compiled option condition against a spread of inventories and variables and
+// reports evaluations per second, next to the same check written as plain C++.
+//
+//   g++ -std=c++17 -O2 -pthread bench/script_bench.cpp -o script_bench
+//   ./script_bench [evaluations]
+
+#include <iostream>
+#include <chrono>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "../engine/inventory.hpp"
+#include "../engine/script.hpp"
+
+static const char* CONDITION = "has(Prybar) && !flag(panelOpen) && count(Cell) >= 2";
+
+int main(int argc, char** argv) {
+    uint64_t evaluations = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 50000000;
+
+    std::vector<SCRIPT::Instr> code;
+    SCRIPT::Variables variables;
+    SCRIPT::Compiler compiler(code, variables);
+    SCRIPT::ScriptRef condition;
+    std::string error;
+    if (!compiler.condition(CONDITION, condition, &error)) {
+        std::cerr << "[ERROR] " << error << "\n";
+        return 1;
+    }
+
+    // 64 players: every mix of prybar, 0-3 cells and the panel flag, plus a few junk items
+    INVENTORY::ItemId prybar = INVENTORY::itemTable().intern("Prybar");
+    INVENTORY::ItemId cell = INVENTORY::itemTable().intern("Cell");
+    std::vector<INVENTORY::Inventory> players(64);
+    std::vector<std::vector<int32_t>> vars(64, std::vector<int32_t>(variables.size(), 0));
+    for (uint32_t i = 0; i < players.size(); ++i) {
+        if (i & 1) players[i].addItem(prybar);
+        if (i & 6) players[i].addItem(cell, (i >> 1) & 3);
+        if (i & 8) vars[i][0] = 1;
+        for (uint32_t j = 0; j < (i >> 4); ++j) players[i].addItem(INVENTORY::itemTable().intern("Junk" + std::to_string(j)));
+    }
+    std::cout << "condition: " << CONDITION << " (" << condition.count << " instructions)\n";
+
+    uint64_t hits = 0;
+    auto begin = std::chrono::steady_clock::now();
+    for (uint64_t n = 0; n < evaluations; ++n) {
+        size_t i = n & 63;
+        hits += SCRIPT::test(code.data() + condition.first, condition.count, players[i], vars[i].data());
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    std::cout << "bytecode: " << seconds * 1000 << " ms, " << static_cast<uint64_t>(evaluations / seconds)
+              << " evaluations/s (" << hits << " true)\n";
+
+    uint64_t nativeHits = 0;
+    begin = std::chrono::steady_clock::now();
+    for (uint64_t n = 0; n < evaluations; ++n) {
+        size_t i = n & 63;
+        nativeHits += players[i].hasItem(prybar) && vars[i][0] == 0 && players[i].count(cell) >= 2;
+    }
+    seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    std::cout << "native:   " << seconds * 1000 << " ms, " << static_cast<uint64_t>(evaluations / seconds)
+              << " evaluations/s (" << nativeHits << " true)\n";
+    return hits == nativeHits ? 0 : 1;
+}
@@ -0,0 +1,215 @@
+// Loopback load generator for SERVER: starts the server on example3, opens [connections]
+// sockets (all kept open, one game each), then every connection replays a scripted random
+// playthrough with one line in flight. Reports round trip latency per turn (send to the
+// next prompt) and turns per second.
+//
+//   g++ -std=c++17 -O2 -pthread bench/server_bench.cpp -o server_bench
+//   ./server_bench [connections] [server threads] [max turns per game]
+//
+// Each connection costs two descriptors here (both ends are in this process), so the
+// connection count is capped by RLIMIT_NOFILE. Sources are spread over 127.0.0.x so more
+// connections than one address has ephemeral ports work.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <sys/resource.h>
+
+#define TBA_NO_MAIN
+#include "../example3.cpp"
+#include "../engine/server.hpp"
+
+static const std::string PROMPT = "Enter your choice: ";
+
+struct Client {
+    int fd = -1;
+    uint32_t step = 0;   // next line of its script
+    std::chrono::steady_clock::time_point sentAt;
+    std::string tail;    // last bytes received, to spot the prompt
+    bool ready = false;  // got a prompt, may send
+    bool waiting = false; // a timed line is in flight
+    bool done = false;
+};
+
+static uint64_t nextRandom(uint64_t& state) {
+    state = state * 6364136223846793005ull + 1442695040888963407ull;
+    return state >> 33;
+}
+
+// A playthrough: options picked at random, now and then a look at the inventory, and -2 if
+// the game is not over after maxTurns
+static std::vector<int> script(const STORY::Story& story, uint64_t seed, uint32_t maxTurns) {
+    std::vector<int> lines;
+    SESSION::Session session(story);
+    SESSION::TurnResult turn = session.start();
+    uint64_t random = seed;
+    for (uint32_t i = 0; i < maxTurns && !turn.ended; ++i) {
+        if (nextRandom(random) % 10 == 0) lines.push_back(-1);
+        int choice = static_cast<int>(nextRandom(random) % story.node(turn.node).optionCount);
+        lines.push_back(choice + 1);
+        turn = session.step(choice);
+    }
+    if (!turn.ended) lines.push_back(-2);
+    return lines;
+}
+
+int main(int argc, char** argv) {
+    uint32_t connections = argc > 1 ? static_cast<uint32_t>(std::atoi(argv[1])) : 50000;
+    size_t threads = argc > 2 ? static_cast<size_t>(std::atoi(argv[2])) : 1;
+    uint32_t maxTurns = argc > 3 ? static_cast<uint32_t>(std::atoi(argv[3])) : 30;
+
+    rlimit limit;
+    getrlimit(RLIMIT_NOFILE, &limit);
+    limit.rlim_cur = limit.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &limit);
+    uint32_t fit = static_cast<uint32_t>(std::min<rlim_t>((limit.rlim_cur - 64) / 2, UINT32_MAX));
+    if (connections > fit) {
+        std::cout << "descriptor limit " << limit.rlim_cur << " allows " << fit << " connections, using that many\n";
+        connections = fit;
+    }
+
+    STORY::Story story = STORY::compile(buildEchoesOfTheVoid());
+    SERVER::Options options;
+    options.port = 0;
+    options.threads = threads;
+    SERVER::Server server(story, options);
+    std::string error;
+    if (!server.start(&error)) {
+        std::cerr << "[ERROR] " << error << "\n";
+        return 1;
+    }
+
+    std::vector<std::vector<int>> scripts(connections);
+    for (uint32_t i = 0; i < connections; ++i) scripts[i] = script(story, i + 1, maxTurns);
+
+    int epoll = epoll_create1(EPOLL_CLOEXEC);
+    std::vector<Client> clients(connections);
+    std::vector<uint32_t> samples; // ns per turn
+    uint32_t finished = 0;
+    uint32_t readyCount = 0;
+    bool measuring = false;
+
+    auto send = [&](uint32_t id) {
+        Client& client = clients[id];
+        int line = scripts[id][client.step++];
+        std::string text = std::to_string(line) + "\n";
+        client.ready = false;
+        client.waiting = line != -2;
+        client.sentAt = std::chrono::steady_clock::now();
+        if (::write(client.fd, text.data(), text.size()) != static_cast<ssize_t>(text.size())) {
+            std::cerr << "[ERROR] short write\n";
+            std::exit(1);
+        }
+    };
+
+    // A turn is over when the prompt arrives, or when the server closes after the last node
+    auto received = [&](uint32_t id, bool closed) {
+        Client& client = clients[id];
+        if (client.waiting && measuring) {
+            samples.push_back(static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - client.sentAt).count()));
+        }
+        client.waiting = false;
+        if (closed) {
+            ::close(client.fd);
+            client.done = true;
+            ++finished;
+            return;
+        }
+        if (!client.ready) {
+            client.ready = true;
+            ++readyCount;
+        }
+        if (measuring && client.step < scripts[id].size()) send(id);
+    };
+
+    auto pump = [&](int timeoutMs) {
+        epoll_event events[512];
+        int count = epoll_wait(epoll, events, 512, timeoutMs);
+        char chunk[8192];
+        for (int i = 0; i < count; ++i) {
+            uint32_t id = events[i].data.u32;
+            Client& client = clients[id];
+            while (true) {
+                ssize_t got = ::read(client.fd, chunk, sizeof(chunk));
+                if (got > 0) {
+                    client.tail.append(chunk, static_cast<size_t>(got));
+                    if (client.tail.size() > PROMPT.size()) client.tail.erase(0, client.tail.size() - PROMPT.size());
+                    continue;
+                }
+                if (got < 0 && errno == EINTR) continue;
+                if (got < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                    if (client.tail == PROMPT) {
+                        client.tail.clear();
+                        received(id, false);
+                    }
+                } else {
+                    received(id, true);
+                }
+                break;
+            }
+        }
+    };
+
+    // connect in batches so the accept queue never overflows
+    auto begin = std::chrono::steady_clock::now();
+    const uint32_t BATCH = 1000;
+    for (uint32_t first = 0; first < connections; first += BATCH) {
+        uint32_t last = std::min(connections, first + BATCH);
+        for (uint32_t id = first; id < last; ++id) {
+            int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+            if (fd < 0) {
+                std::cerr << "[ERROR] socket: " << std::strerror(errno) << "\n";
+                return 1;
+            }
+            int one = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            setsockopt(fd, IPPROTO_IP, IP_BIND_ADDRESS_NO_PORT, &one, sizeof(one));
+            sockaddr_in source{};
+            source.sin_family = AF_INET;
+            source.sin_addr.s_addr = htonl(0x7F000002u + id / 20000); // 127.0.0.2, .3, ...
+            bind(fd, reinterpret_cast<sockaddr*>(&source), sizeof(source));
+            sockaddr_in target{};
+            target.sin_family = AF_INET;
+            target.sin_port = htons(server.port());
+            target.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            if (connect(fd, reinterpret_cast<sockaddr*>(&target), sizeof(target)) != 0 && errno != EINPROGRESS) {
+                std::cerr << "[ERROR] connect: " << std::strerror(errno) << "\n";
+                return 1;
+            }
+            clients[id].fd = fd;
+            epoll_event event{};
+            event.events = EPOLLIN | EPOLLET;
+            event.data.u32 = id;
+            epoll_ctl(epoll, EPOLL_CTL_ADD, fd, &event);
+        }
+        while (readyCount < last) pump(1000);
+    }
+    double connectSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    std::cout << connections << " connections open in " << connectSeconds * 1000 << " ms, " << threads << " server threads\n";
+
+    measuring = true;
+    begin = std::chrono::steady_clock::now();
+    for (uint32_t id = 0; id < connections; ++id) send(id);
+    while (finished < connections) pump(1000);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+    SERVER::Stats stats = server.stats();
+    server.stop();
+    ::close(epoll);
+
+    std::sort(samples.begin(), samples.end());
+    auto percentile = [&](double p) {
+        return samples.empty() ? 0 : samples[std::min(samples.size() - 1, static_cast<size_t>(p * samples.size()))];
+    };
+    std::cout << samples.size() << " turns in " << seconds * 1000 << " ms, " << static_cast<uint64_t>(samples.size() / seconds)
+              << " turns/s (" << stats.turns << " lines served)\n"
+              << "us/turn: p50 " << percentile(0.50) / 1000.0 << "  p99 " << percentile(0.99) / 1000.0
+              << "  max " << (samples.empty() ? 0 : samples.back()) / 1000.0 << "\n";
+    return 0;
+}
@@ -0,0 +1,138 @@
+// Writes a generated story with a lot of prose as a streamed story file, then walks many
+// sessions through it at once and reports how long entering a node waits for its text,
+// how often the chapter cache hits and how much text it holds at most.
+//
+//   g++ -std=c++17 -O2 -pthread bench/stream_bench.cpp -o stream_bench
+//   ./stream_bench [nodes] [cache KB] [entries] [sessions] [file]
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "../engine/render.hpp"
+#include "../engine/stream.hpp"
+
+// splitmix64
+static uint64_t nextRandom(uint64_t& state) {
+    uint64_t z = (state += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+// Node i leads a few nodes further on and now and then somewhere far away, the last nodes
+// are endings. Every node has ~600 bytes of its own text.
+static STORY::Story generate(uint32_t nodeCount) {
+    static const char* words[] = { "the", "corridor", "hums", "with", "a", "low", "light", "dust", "drifts",
+                                   "past", "broken", "panels", "and", "somewhere", "far", "off", "metal", "groans" };
+    auto arrays = std::make_shared<STORY::Storage>();
+    uint64_t random = 7;
+    auto addText = [&](const std::string& text) {
+        STORY::TextRef ref;
+        ref.offset = static_cast<uint32_t>(arrays->textPool.size());
+        ref.length = static_cast<uint32_t>(text.size());
+        arrays->textPool += text;
+        return ref;
+    };
+    std::vector<STORY::TextRef> labels = { addText("Go on"), addText("Take the side passage"), addText("Turn back") };
+
+    for (uint32_t id = 0; id < nodeCount; ++id) {
+        std::string prose = "Room " + std::to_string(id) + ".";
+        while (prose.size() < 600) {
+            prose += ' ';
+            prose += words[nextRandom(random) % (sizeof(words) / sizeof(words[0]))];
+        }
+        STORY::NodeRecord node;
+        node.text = addText(prose);
+        node.firstOption = static_cast<uint32_t>(arrays->options.size());
+        if (id + 4 < nodeCount) {
+            uint32_t targets[3] = { id + 1, id + 2 + static_cast<uint32_t>(nextRandom(random) % 3),
+                                    nextRandom(random) % 16 == 0 ? static_cast<uint32_t>(nextRandom(random) % nodeCount) : (id ? id - 1 : 0) };
+            for (uint32_t i = 0; i < 3; ++i) {
+                STORY::OptionRecord option;
+                option.text = labels[i];
+                option.next = targets[i];
+                arrays->options.push_back(option);
+            }
+            node.optionCount = 3;
+        }
+        arrays->nodes.push_back(node);
+    }
+    STORY::Story story = STORY::Story::fromStorage(arrays);
+    story.hash = STORY::computeHash(story);
+    return story;
+}
+
+int main(int argc, char** argv) {
+    uint32_t nodes = argc > 1 ? static_cast<uint32_t>(std::atoi(argv[1])) : 200000;
+    size_t cacheBytes = argc > 2 ? static_cast<size_t>(std::atoi(argv[2])) * 1024 : 4 * 1024 * 1024;
+    uint64_t entries = argc > 3 ? std::strtoull(argv[3], nullptr, 10) : 2000000;
+    uint32_t sessionCount = argc > 4 ? static_cast<uint32_t>(std::atoi(argv[4])) : 1000;
+    std::string path = argc > 5 ? argv[5] : "stream_bench.tbs";
+
+    size_t textBytes = 0;
+    {
+        STORY::Story story = generate(nodes); // all of its text goes away with this scope
+        textBytes = story.textPool.size();
+        std::string error;
+        if (!STREAM::save(story, path, STREAM::Options(), &error)) {
+            std::cerr << "[ERROR] " << error << "\n";
+            return 1;
+        }
+    }
+
+    STREAM::BookOptions options;
+    options.cacheBytes = cacheBytes;
+    STREAM::Book book;
+    std::string error;
+    if (!book.open(path, options, &error)) {
+        std::cerr << "[ERROR] " << error << "\n";
+        return 1;
+    }
+    const STORY::Story& story = book.story();
+    std::cout << "story: " << nodes << " nodes, " << textBytes / 1024 << " KB of text in " << story.chapters.size
+              << " chapters, cache " << cacheBytes / 1024 << " KB\n";
+
+    // sessions take turns, each entry pages the node in and renders it
+    std::vector<SESSION::Session> sessions(sessionCount, SESSION::Session(story));
+    std::vector<STREAM::Page> pages(sessionCount);
+    std::vector<SESSION::TurnResult> turns(sessionCount);
+    for (uint32_t i = 0; i < sessionCount; ++i) turns[i] = sessions[i].start();
+    OUTPUT::Buffer out;
+    std::vector<uint32_t> samples; // ns per node entry
+    samples.reserve(static_cast<size_t>(entries));
+    uint64_t random = 11;
+
+    auto begin = std::chrono::steady_clock::now();
+    for (uint64_t n = 0; n < entries; ++n) {
+        uint32_t i = static_cast<uint32_t>(n % sessionCount);
+        if (turns[i].ended) turns[i] = sessions[i].start();
+        auto enter = std::chrono::steady_clock::now();
+        if (!book.page(turns[i].node, pages[i], &error)) {
+            std::cerr << "[ERROR] " << error << "\n";
+            return 1;
+        }
+        book.prefetch(turns[i].node);
+        RENDER::arrival(out, pages[i].story(), turns[i]);
+        out.clear();
+        samples.push_back(static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - enter).count()));
+        uint32_t optionCount = story.node(turns[i].node).optionCount;
+        turns[i] = sessions[i].step(static_cast<int>(nextRandom(random) % optionCount));
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+    std::sort(samples.begin(), samples.end());
+    auto percentile = [&](double p) {
+        return samples[std::min(samples.size() - 1, static_cast<size_t>(p * samples.size()))];
+    };
+    STREAM::Cache::Stats cache = book.stats();
+    std::cout << "entries: " << entries << " over " << sessionCount << " sessions in " << seconds * 1000 << " ms\n"
+              << "ns/entry: p50 " << percentile(0.50) << "  p99 " << percentile(0.99) << "  p99.9 " << percentile(0.999)
+              << "  max " << samples.back() << "\n"
+              << "cache: " << cache.hits << " hits, " << cache.misses << " misses, " << cache.prefetched << " read ahead, "
+              << cache.evictions << " evictions, peak " << cache.peakBytes / 1024 << " KB\n";
+    return 0;
+}
@@ -0,0 +1,87 @@
+// Plays example3 on [threads] threads with and without a telemetry recorder and reports
+// what counting costs per turn, then how long adding up the shards and writing the metrics
+// file take, and what it costs when the sessions of a thread alternate between two
+// recorders. Build it with -DTBA_NO_TELEMETRY too to compare against the hooks compiled out.
+//
+//   g++ -std=c++17 -O2 -pthread bench/telemetry_bench.cpp -o telemetry_bench
+//   ./telemetry_bench [turns per thread] [threads] [metrics file]
+
+#include <iostream>
+#include <chrono>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define TBA_NO_MAIN
+#include "../example3.cpp"
+#include "../engine/telemetry.hpp"
+
+// Every thread walks its own 64 sessions with random choices, the odd ones count in other
+static double play(const STORY::Story& story, TELEMETRY::Recorder* recorder, size_t threadCount, uint64_t turns,
+                   TELEMETRY::Recorder* other = nullptr) {
+    if (!other) other = recorder;
+    auto begin = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < threadCount; ++t) {
+        threads.emplace_back([&, t] {
+            std::vector<SESSION::Session> sessions(64, SESSION::Session(story));
+            for (size_t i = 0; i < sessions.size(); ++i) {
+                sessions[i].setTelemetry(i & 1 ? other : recorder);
+                sessions[i].start();
+            }
+            uint64_t random = t + 1;
+            for (uint64_t n = 0; n < turns; ++n) {
+                SESSION::Session& session = sessions[n & 63];
+                if (session.ended()) {
+                    session = SESSION::Session(story);
+                    session.setTelemetry(n & 1 ? other : recorder);
+                    session.start();
+                    continue;
+                }
+                random = random * 6364136223846793005ull + 1442695040888963407ull;
+                session.step(static_cast<int>((random >> 33) % story.node(session.node()).optionCount));
+            }
+        });
+    }
+    for (auto& thread : threads) thread.join();
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+}
+
+int main(int argc, char** argv) {
+    uint64_t turns = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 5000000;
+    size_t threads = argc > 2 ? static_cast<size_t>(std::atoi(argv[2])) : 2;
+    std::string path = argc > 3 ? argv[3] : "telemetry_bench.prom";
+    if (threads == 0) threads = 1;
+
+    STORY::Story story = STORY::compile(buildEchoesOfTheVoid());
+    std::cout << "telemetry " << (TELEMETRY::ENABLED ? "compiled in" : "compiled out") << ", " << threads << " threads x "
+              << turns << " turns\n";
+
+    double off = play(story, nullptr, threads, turns);
+    TELEMETRY::Recorder recorder(story);
+    double on = play(story, &recorder, threads, turns);
+    TELEMETRY::Recorder first(story), second(story);
+    double both = play(story, &first, threads, turns, &second);
+    double total = static_cast<double>(turns * threads);
+    std::cout << "no recorder:   " << off * 1e9 / total << " ns/turn\n"
+              << "recorder:      " << on * 1e9 / total << " ns/turn\n"
+              << "two recorders: " << both * 1e9 / total << " ns/turn\n";
+    if (!TELEMETRY::ENABLED) return 0;
+
+    auto begin = std::chrono::steady_clock::now();
+    TELEMETRY::Snapshot data = recorder.snapshot();
+    auto summed = std::chrono::steady_clock::now();
+    std::string error;
+    if (!TELEMETRY::writeFile(path, TELEMETRY::format(data, story, path), &error)) {
+        std::cerr << "[ERROR] " << error << "\n";
+        return 1;
+    }
+    auto written = std::chrono::steady_clock::now();
+    std::cout << "snapshot of " << recorder.shardCount() << " shards: "
+              << std::chrono::duration<double, std::micro>(summed - begin).count() << " us, export to " << path << ": "
+              << std::chrono::duration<double, std::micro>(written - summed).count() << " us\n"
+              << "turns counted: " << data.turns << " (" << data.samples << " timed), latency p50 " << data.quantile(0.5) << " ns  p99 "
+              << data.quantile(0.99) << " ns  max " << data.latencyMax << " ns\n";
+    return 0;
+}
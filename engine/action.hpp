@@ -1,57 +1,203 @@
 #ifndef ACTION_HPP
 #define ACTION_HPP
 
+#include <cstdint>
 #include <iostream>
 #include <string>
 #include <vector>
 
 // Include the full definition of Inventory and Item here
 #include "inventory.hpp"
+#include "output.hpp"
 
 namespace ACTION {
-    enum TYPE {
+    // Action opcodes. Stories store them as plain numbers, opcodes past NONE are free for
+    // kinds registered at runtime (see Registry).
+    enum TYPE : uint32_t {
         PICKUP,
         USE,
         NONE
     };
 
+    const uint32_t MAX_OPCODES = 64; // size of the dispatch table, every opcode is below it
+    const uint32_t MAX_ACTIONS = 4;  // actions one node or option can run
+    const uint32_t MAX_PICKUPS = 8;  // items one action defined with STORYDEF can pick up
+
+    // What executing an action did, so callers can report it however they like
+    enum RESULT {
+        NOTHING,      // NONE action, or a pickup with nothing to pick up
+        PICKED_UP,
+        USED,
+        MISSING_ITEM, // USE without the item in the inventory
+        ALREADY_HAVE  // skipped because some of the pickup items are already held
+    };
+
+    inline std::string_view itemName(INVENTORY::ItemId id) {
+        return id != INVENTORY::NO_ITEM ? INVENTORY::itemTable().name(id) : std::string_view();
+    }
+
+    // Renders the message the game shows for a result, count is how many of each item
+    inline void print(OUTPUT::Buffer& out, RESULT result, const INVENTORY::ItemId* pickupItems, size_t pickupCount, INVENTORY::ItemId useItem, uint32_t count = 1) {
+        if (result == PICKED_UP) {
+            if (pickupCount == 1) {
+                out << "\n[INFO] You picked up ";
+                if (count == 1) out << "a "; else out << count << " ";
+                out << itemName(pickupItems[0]) << "!\n";
+            } else {
+                out << "\nYou picked up:\n";
+                for (size_t i = 0; i < pickupCount; ++i) {
+                    out << "- " << itemName(pickupItems[i]);
+                    if (count > 1) out << " x" << count;
+                    out << "\n";
+                }
+                out << "\n";
+            }
+        } else if (result == USED) {
+            out << "\n[INFO] You used ";
+            if (count == 1) out << "a "; else out << count << " ";
+            out << itemName(useItem) << "!\n";
+        } else if (result == MISSING_ITEM) {
+            out << "\n[INFO] You don't have ";
+            if (count == 1) out << "a "; else out << count << " ";
+            out << itemName(useItem) << " to use.\n";
+        }
+    }
+
+    // One action as a story stores it. Every kind reads the operands it needs: PICKUP the
+    // item list (a slice of the story's pickup array) and count, USE the item and count.
+    struct Operands {
+        uint32_t opcode = NONE;
+        uint32_t firstItem = 0;
+        uint32_t itemCount = 0;
+        INVENTORY::ItemId item = INVENTORY::NO_ITEM;
+        uint32_t count = 1;
+    };
+
+    // Carries out one kind of action on an inventory. items is the operands' item list.
+    template<typename Inv>
+    using Handler = RESULT (*)(Inv& inv, const Operands& op, const INVENTORY::ItemId* items);
+
+    template<typename Inv>
+    RESULT doNothing(Inv&, const Operands&, const INVENTORY::ItemId*) {
+        return NOTHING; // NONE action or an opcode nobody registered
+    }
+
+    template<typename Inv>
+    RESULT doPickup(Inv& inv, const Operands& op, const INVENTORY::ItemId* items) {
+        if (op.itemCount == 0) return NOTHING; // No items to pick up
+        for (uint32_t i = 0; i < op.itemCount; ++i) {
+            inv.addItem(items[i], op.count);
+        }
+        return PICKED_UP;
+    }
+
+    template<typename Inv>
+    RESULT doUse(Inv& inv, const Operands& op, const INVENTORY::ItemId*) {
+        if (!inv.hasItem(op.item, op.count)) return MISSING_ITEM;
+        inv.removeItem(op.item, op.count);
+        return USED;
+    }
+
+    // Handlers by opcode, one dense table per inventory type, so running an action is one
+    // indexed call however many kinds exist. Register new kinds at startup, before any
+    // session plays: the table is read without locking.
+    //
+    //   ACTION::registry<INVENTORY::Inventory>.add(OPEN_GATE, &openGate);
+    //
+    // Handlers see only the inventory type they were registered for: the analyzers keep
+    // their own (ANALYZE::PackedInventory, FUZZ::CountInventory) and treat opcodes nobody
+    // registered for them as doing nothing.
+    template<typename Inv>
+    class Registry {
+    public:
+        constexpr Registry() {
+            for (uint32_t i = 0; i < MAX_OPCODES; ++i) table[i] = &doNothing<Inv>;
+            table[PICKUP] = &doPickup<Inv>;
+            table[USE] = &doUse<Inv>;
+        }
+
+        // False if the opcode is out of range
+        bool add(uint32_t opcode, Handler<Inv> handler) {
+            if (opcode >= MAX_OPCODES || !handler) return false;
+            table[opcode] = handler;
+            return true;
+        }
+
+        // Opcodes past the table do nothing, like unregistered ones: story files loaded
+        // without verifying and hand-built stories can hold any number
+        RESULT call(Inv& inv, const Operands& op, const INVENTORY::ItemId* items) const {
+            if (op.opcode >= MAX_OPCODES) return doNothing<Inv>(inv, op, items);
+            return table[op.opcode](inv, op, items);
+        }
+
+    private:
+        Handler<Inv> table[MAX_OPCODES] = {};
+    };
+
+    // Constant initialized, there is no guard to check on the turn path
+    template<typename Inv>
+    inline Registry<Inv> registry{};
+
+    // The rules for one action of a story: skipped if *any* of its items are already held,
+    // otherwise dispatched to its handler
+    template<typename Inv>
+    RESULT run(Inv& inv, const Operands& op, const INVENTORY::ItemId* items) {
+        if (op.opcode == NONE) return NOTHING;
+        if (inv.hasItems(items, op.itemCount)) return ALREADY_HAVE;
+        return registry<Inv>.call(inv, op, items);
+    }
+
+    // False when run would leave inv as it is: skipped actions and uses of a missing item.
+    // Anything else reaches a handler and may write.
+    template<typename Inv>
+    bool writes(const Inv& inv, const Operands& op, const INVENTORY::ItemId* items) {
+        if (op.opcode == NONE || inv.hasItems(items, op.itemCount)) return false;
+        return op.opcode != USE || inv.hasItem(op.item, op.count);
+    }
+
     class Action {
     public:
         TYPE type;
+        uint32_t count = 1; // how many of each pickup item it grants, or of the use item it consumes
 
-        Action(TYPE actionType) : type(actionType) {}
+        Action(TYPE actionType, uint32_t count = 1) : type(actionType), count(count) {}
         Action() = default;
         ~Action() = default;
 
         // Implementation of executeAction directly in the header
         bool executeAction(INVENTORY::Inventory& inv, const INVENTORY::ItemVec& pickupItems, const INVENTORY::Item& useItem) {
-            if (this->type == PICKUP) {
-                if (!pickupItems.empty()) {
-                    inv.addItems(pickupItems);
-                    if (pickupItems.size() == 1) {
-                        std::cout << "\n[INFO] You picked up a " << pickupItems[0].name << "!\n";
-                    } else {
-                        std::cout << "\nYou picked up:\n";
-                        for (const auto& item : pickupItems) {
-                            std::cout << "- " << item.name << "\n";
-                        }
-                        std::cout << "\n";
-                    }
-                    return true;
-                }
-                return false; // No items to pick up
-            } else if (this->type == USE) {
-                if (inv.hasItem(useItem.name)) {
-                    inv.removeItem(useItem.name);
-                    std::cout << "\n[INFO] You used a " << useItem.name << "!\n";
-                    return true;
-                } else {
-                    std::cout << "\n[INFO] You don't have a " << useItem.name << " to use.\n";
-                    return false;
-                }
+            if (this->type == NONE) return false; // nothing to copy the items for
+            if (pickupItems.size() > MAX_PICKUPS) { // only a hand-built node can have that many
+                std::vector<INVENTORY::ItemId> pickupIds;
+                pickupIds.reserve(pickupItems.size());
+                for (const auto& item : pickupItems) pickupIds.push_back(item.id);
+                return executeAction(inv, pickupIds.data(), pickupIds.size(), useItem.id);
             }
+            INVENTORY::ItemId pickupIds[MAX_PICKUPS];
+            for (size_t i = 0; i < pickupItems.size(); ++i) pickupIds[i] = pickupItems[i].id;
+            return executeAction(inv, pickupIds, pickupItems.size(), useItem.id);
+        }
+
+        // Same as above on item ids, this is what compiled stories use
+        bool executeAction(INVENTORY::Inventory& inv, const INVENTORY::ItemId* pickupItems, size_t pickupCount, INVENTORY::ItemId useItem) {
+            RESULT result = apply(inv, pickupItems, pickupCount, useItem);
+            OUTPUT::Buffer out;
+            print(out, result, pickupItems, pickupCount, useItem, count);
+            OUTPUT::StreamSink(std::cout).write(out);
+            return result == PICKED_UP || result == USED;
+        }
 
-            return false; // NONE action or unknown type
+        // Changes the inventory without printing anything, through the handler registered
+        // for this type. Inv is INVENTORY::Inventory or anything with the same id based
+        // hasItem/addItem/removeItem taking a count (the analyzers pack counts into bit fields)
+        template<typename Inv>
+        RESULT apply(Inv& inv, const INVENTORY::ItemId* pickupItems, size_t pickupCount, INVENTORY::ItemId useItem) const {
+            Operands op;
+            op.opcode = this->type;
+            op.itemCount = static_cast<uint32_t>(pickupCount);
+            op.item = useItem;
+            op.count = this->count;
+            return registry<Inv>.call(inv, op, pickupItems);
         }
     };
 }
@@ -0,0 +1,585 @@
+#ifndef ANALYZE_HPP
+#define ANALYZE_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "action.hpp"
+#include "inventory.hpp"
+#include "session.hpp"
+#include "story.hpp"
+
+namespace ANALYZE {
+    // Explores every (node, inventory, variables) state a story can reach from its root and
+    // reports what players can never see or can get stuck in. A state is the node plus the
+    // count of every item of the story's catalog and the value of every script variable, turns
+    // go through SESSION::runActions and the option scripts so the rules are exactly the ones
+    // a Session plays by. A story whose variables keep counting up has no end of states and
+    // runs into options.maxStates.
+    //
+    // The search is a level by level BFS on a pool of threads. The visited set is split
+    // into shards, each a small open addressing table behind its own mutex, so threads
+    // inserting different states rarely wait on each other. Every thread records its own
+    // transitions, a backward pass over them afterwards finds the states from which no
+    // ending can be reached any more (softlocks). Options whose condition never holds or
+    // whose action never works in any state are reported too.
+    //
+    // Counts are exact and cheap: a pickup is skipped while any of its items is held, so an
+    // item is only ever granted starting from 0 and can never be held more times than the
+    // biggest single grant of it. Each count is a bit field just that wide.
+
+    typedef uint32_t StateId;
+    const StateId NO_STATE = 0xFFFFFFFF;
+    const uint32_t NO_INDEX = 0xFFFFFFFF; // item outside the story's catalog
+
+    // Where a catalog item's count lives in the state words
+    struct Field {
+        uint32_t word = 0;
+        uint32_t shift = 0;
+        uint64_t mask = 0; // largest count it holds, 0 for items nothing grants
+    };
+
+    inline uint32_t countOf(const Field& field, const uint64_t* words) {
+        return static_cast<uint32_t>((words[field.word] >> field.shift) & field.mask);
+    }
+
+    // The inventory of a state: one count field per catalog item, ids are mapped through indexOf
+    class PackedInventory {
+    public:
+        PackedInventory(const std::vector<uint32_t>& indexOf, const std::vector<Field>& fields, uint64_t* words)
+            : indexOf(indexOf), fields(fields), words(words) {}
+
+        uint32_t count(INVENTORY::ItemId id) const {
+            uint32_t index = find(id);
+            return index != NO_INDEX ? countOf(fields[index], words) : 0;
+        }
+
+        bool hasItem(INVENTORY::ItemId id, uint32_t amount = 1) const {
+            return id != INVENTORY::NO_ITEM && count(id) >= amount;
+        }
+
+        // *any* of the items, like INVENTORY::Inventory::hasItems
+        bool hasItems(const INVENTORY::ItemId* ids, size_t count) const {
+            for (size_t i = 0; i < count; ++i) {
+                if (hasItem(ids[i])) return true;
+            }
+            return false;
+        }
+
+        void addItem(INVENTORY::ItemId id, uint32_t amount = 1) {
+            uint32_t index = find(id);
+            if (index == NO_INDEX || fields[index].mask == 0) return;
+            set(fields[index], std::min<uint64_t>(uint64_t(count(id)) + amount, fields[index].mask));
+        }
+
+        void removeItem(INVENTORY::ItemId id, uint32_t amount = 1) {
+            uint32_t index = find(id);
+            if (index == NO_INDEX) return;
+            uint32_t held = count(id);
+            set(fields[index], held - std::min(amount, held));
+        }
+
+    private:
+        uint32_t find(INVENTORY::ItemId id) const {
+            return id < indexOf.size() ? indexOf[id] : NO_INDEX;
+        }
+
+        void set(const Field& field, uint64_t value) {
+            uint64_t& word = words[field.word];
+            word = (word & ~(field.mask << field.shift)) | (value << field.shift);
+        }
+
+        const std::vector<uint32_t>& indexOf;
+        const std::vector<Field>& fields;
+        uint64_t* words;
+    };
+
+    struct Options {
+        size_t threads = 0;              // 0: one per hardware thread
+        uint64_t maxStates = 100000000;  // explore() gives up past this
+        size_t samples = 10;             // softlocks kept in the report
+    };
+
+    // A turn that leaves the player unable to reach any ending, with the shortest way there
+    struct Softlock {
+        STORY::NodeId node = STORY::NO_NODE;
+        std::vector<INVENTORY::ItemId> items; // held after the turn
+        std::vector<uint32_t> counts;         // of each of the items
+        std::vector<int32_t> variables;       // every script variable, by index
+        std::vector<int> path;                // 0-based choices from the start
+    };
+
+    struct OptionRef {
+        STORY::NodeId node;
+        uint32_t index; // 0-based option of the node
+    };
+
+    struct Report {
+        uint64_t states = 0;
+        uint64_t transitions = 0;
+        uint32_t depth = 0;    // turns to the farthest state
+        size_t threads = 0;
+        double seconds = 0;
+
+        bool endingReachable = false;
+        std::vector<STORY::NodeId> unreachableNodes;
+        std::vector<STORY::NodeId> unreachableEndings;    // end nodes no playthrough gets to
+        uint64_t softlocks = 0;                           // states no ending can be reached from
+        std::vector<Softlock> softlockSamples;            // first softlocked state of a path, shortest first
+        std::vector<INVENTORY::ItemId> unobtainableItems; // catalog items no pickup ever grants
+        std::vector<OptionRef> deadOptions;               // options of reachable nodes that never can be taken or never work
+    };
+
+    namespace detail {
+        const uint32_t SHARD_BITS = 10;
+        const uint32_t SHARDS = 1u << SHARD_BITS;
+        const uint32_t MAX_LOCAL = (NO_STATE >> SHARD_BITS) - 1; // keeps NO_STATE unused
+        const size_t CHUNK = 256; // frontier states a thread takes at a time
+
+        inline void setError(std::string* error, const std::string& message) {
+            if (error) *error = message;
+        }
+
+        inline uint64_t hashState(const uint64_t* state, size_t stride) {
+            uint64_t h = 0x9E3779B97F4A7C15ull;
+            for (size_t i = 0; i < stride; ++i) {
+                h ^= state[i];
+                h *= 0xBF58476D1CE4E5B9ull;
+                h ^= h >> 31;
+            }
+            return h;
+        }
+
+        // How a state was first reached, this is a BFS so it is a shortest path
+        struct Origin {
+            StateId parent;
+            uint32_t choice;
+            uint32_t depth;
+        };
+
+        struct alignas(64) Shard {
+            std::mutex mutex;
+            std::vector<uint64_t> states; // stride words per state, word 0 is the node
+            std::vector<Origin> origins;
+            std::vector<uint32_t> slots;  // local index + 1, 0 is empty
+            uint32_t count = 0;
+        };
+
+        class Explorer {
+        public:
+            Explorer(const STORY::Story& story, const Options& options) : story(story), options(options) {
+                uint32_t maxId = 0;
+                for (INVENTORY::ItemId id : story.items) maxId = std::max(maxId, id + 1);
+                indexOf.assign(maxId, NO_INDEX);
+                for (uint32_t i = 0; i < story.items.size; ++i) indexOf[story.items[i]] = i;
+                itemWords = (story.items.size + 63) / 64;
+                layout();
+                shards.reset(new Shard[SHARDS]);
+            }
+
+            bool run(Report& report, std::string* error) {
+                auto begin = std::chrono::steady_clock::now();
+                report = Report();
+                if (story.nodeCount() == 0) {
+                    setError(error, "the story has no nodes");
+                    return false;
+                }
+
+                size_t threads = options.threads ? options.threads : std::thread::hardware_concurrency();
+                if (threads == 0) threads = 1;
+                workers.resize(threads);
+                for (Worker& worker : workers) {
+                    worker.obtained.assign(itemWords, 0);
+                    worker.scratch.resize(stride);
+                    worker.vars.resize(story.variables.size);
+                    worker.usable.assign((story.options.size + 63) / 64, 0);
+                }
+                report.threads = threads;
+
+                if (!forward(report)) {
+                    setError(error, "more than " + std::to_string(options.maxStates) + " reachable states");
+                    return false;
+                }
+                backward(report);
+                collect(report);
+
+                report.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+                return true;
+            }
+
+        private:
+            struct Worker {
+                std::vector<StateId> nextIds;    // states this thread discovered for the next level
+                std::vector<uint64_t> nextStates;
+                std::vector<std::pair<StateId, StateId>> edges;
+                std::vector<uint64_t> obtained;  // catalog bits of items some pickup granted
+                std::vector<uint64_t> scratch;
+                std::vector<int32_t> vars;       // the variables of scratch, unpacked for the scripts
+                std::vector<uint64_t> usable;    // options whose action worked in some state, by option index
+                uint64_t transitions = 0;
+                bool full = false;
+            };
+
+            // Packs the count fields: each is as wide as the biggest grant of its item
+            // (count times how often a pickup lists it) and never straddles two words.
+            // The variables follow, two to a word.
+            void layout() {
+                std::vector<uint64_t> most(story.items.size, 0);
+                for (const ACTION::Operands& action : story.actions) {
+                    if (action.opcode != ACTION::TYPE::PICKUP) continue;
+                    const INVENTORY::ItemId* ids = story.pickupItems(action);
+                    for (uint32_t i = 0; i < action.itemCount; ++i) {
+                        uint32_t index = ids[i] < indexOf.size() ? indexOf[ids[i]] : NO_INDEX;
+                        if (index == NO_INDEX) continue;
+                        uint64_t times = uint64_t(std::count(ids, ids + action.itemCount, ids[i]));
+                        most[index] = std::max(most[index], std::min<uint64_t>(times * action.count, UINT32_MAX));
+                    }
+                }
+
+                fields.assign(story.items.size, Field());
+                uint32_t word = 1, used = 0; // word 0 is the node
+                for (uint32_t i = 0; i < story.items.size; ++i) {
+                    uint32_t width = 0;
+                    while (width < 32 && (most[i] >> width) != 0) ++width;
+                    if (width == 0) continue;
+                    if (used + width > 64) {
+                        ++word;
+                        used = 0;
+                    }
+                    fields[i].word = word;
+                    fields[i].shift = used;
+                    fields[i].mask = (uint64_t(1) << width) - 1;
+                    used += width;
+                }
+                varWord = used == 0 ? word : word + 1;
+                stride = varWord + (story.variables.size + 1) / 2;
+            }
+
+            void loadVars(Worker& worker) const {
+                if (!worker.vars.empty()) std::memcpy(worker.vars.data(), worker.scratch.data() + varWord, worker.vars.size() * sizeof(int32_t));
+            }
+
+            void storeVars(Worker& worker) const {
+                if (!worker.vars.empty()) std::memcpy(worker.scratch.data() + varWord, worker.vars.data(), worker.vars.size() * sizeof(int32_t));
+            }
+
+            static uint32_t shardOf(StateId id) { return id & (SHARDS - 1); }
+            static uint32_t localOf(StateId id) { return id >> SHARD_BITS; }
+
+            // Finds or adds a state. False when the state limit is hit.
+            bool insert(const uint64_t* state, const Origin& origin, StateId& id, bool& inserted) {
+                uint64_t hash = hashState(state, stride);
+                uint32_t shardIndex = static_cast<uint32_t>(hash & (SHARDS - 1));
+                Shard& shard = shards[shardIndex];
+                std::lock_guard<std::mutex> lock(shard.mutex);
+
+                if (shard.slots.empty()) shard.slots.assign(16, 0);
+                size_t mask = shard.slots.size() - 1;
+                size_t slot = static_cast<size_t>(hash >> SHARD_BITS) & mask;
+                while (shard.slots[slot] != 0) {
+                    uint32_t local = shard.slots[slot] - 1;
+                    if (std::equal(state, state + stride, shard.states.data() + size_t(local) * stride)) {
+                        id = (local << SHARD_BITS) | shardIndex;
+                        inserted = false;
+                        return true;
+                    }
+                    slot = (slot + 1) & mask;
+                }
+
+                if (shard.count >= MAX_LOCAL || stateCount.fetch_add(1, std::memory_order_relaxed) >= options.maxStates) {
+                    return false;
+                }
+                uint32_t local = shard.count++;
+                shard.states.insert(shard.states.end(), state, state + stride);
+                shard.origins.push_back(origin);
+                shard.slots[slot] = local + 1;
+                if (size_t(shard.count) * 10 > shard.slots.size() * 7) grow(shard);
+
+                id = (local << SHARD_BITS) | shardIndex;
+                inserted = true;
+                return true;
+            }
+
+            void grow(Shard& shard) {
+                std::vector<uint32_t> slots(shard.slots.size() * 2, 0);
+                size_t mask = slots.size() - 1;
+                for (uint32_t local = 0; local < shard.count; ++local) {
+                    uint64_t hash = hashState(shard.states.data() + size_t(local) * stride, stride);
+                    size_t slot = static_cast<size_t>(hash >> SHARD_BITS) & mask;
+                    while (slots[slot] != 0) slot = (slot + 1) & mask;
+                    slots[slot] = local + 1;
+                }
+                shard.slots.swap(slots);
+            }
+
+            void note(Worker& worker, const SESSION::ActionReport& action) {
+                if (action.result != ACTION::RESULT::PICKED_UP) return;
+                for (uint32_t i = 0; i < action.itemCount; ++i) {
+                    INVENTORY::ItemId id = action.items[i];
+                    if (id < indexOf.size() && indexOf[id] != NO_INDEX) {
+                        worker.obtained[indexOf[id] >> 6] |= uint64_t(1) << (indexOf[id] & 63);
+                    }
+                }
+            }
+
+            // Every option of one state
+            void expand(Worker& worker, StateId id, const uint64_t* state, uint32_t depth) {
+                STORY::NodeId node = static_cast<STORY::NodeId>(state[0]);
+                if (story.isEndNode(node)) return;
+
+                const STORY::NodeRecord& record = story.node(node);
+                for (uint32_t i = 0; i < record.optionCount; ++i) {
+                    std::copy(state, state + stride, worker.scratch.begin());
+                    PackedInventory inv(indexOf, fields, worker.scratch.data());
+                    loadVars(worker);
+
+                    const STORY::OptionRecord& option = story.option(node, i);
+                    if (!SESSION::allowed(story, option, inv, worker.vars.data())) continue;
+                    bool worked = true;
+                    SESSION::runActions(story, inv, option.actions, [&](const SESSION::ActionReport& action) {
+                        worked = worked && action.result != ACTION::RESULT::MISSING_ITEM && action.result != ACTION::RESULT::ALREADY_HAVE;
+                        note(worker, action);
+                    });
+                    if (worked) {
+                        uint32_t index = record.firstOption + i;
+                        worker.usable[index >> 6] |= uint64_t(1) << (index & 63);
+                    }
+                    SESSION::runEffect(story, option.effect, inv, worker.vars.data());
+                    const STORY::NodeRecord& next = story.node(option.next);
+                    SESSION::runActions(story, inv, next.actions, [&](const SESSION::ActionReport& action) { note(worker, action); });
+                    SESSION::runEffect(story, next.effect, inv, worker.vars.data());
+                    storeVars(worker);
+                    worker.scratch[0] = option.next;
+                    ++worker.transitions;
+
+                    StateId to;
+                    bool inserted;
+                    if (!insert(worker.scratch.data(), Origin{ id, i, depth + 1 }, to, inserted)) {
+                        worker.full = true;
+                        return;
+                    }
+                    if (to != id) worker.edges.emplace_back(id, to); // self loops never help reach an ending
+                    if (inserted) {
+                        worker.nextIds.push_back(to);
+                        worker.nextStates.insert(worker.nextStates.end(), worker.scratch.begin(), worker.scratch.end());
+                    }
+                }
+            }
+
+            bool forward(Report& report) {
+                // the start state: the root with its on enter action applied
+                Worker& first = workers[0];
+                std::fill(first.scratch.begin(), first.scratch.end(), 0);
+                PackedInventory inv(indexOf, fields, first.scratch.data());
+                const STORY::NodeRecord& root = story.node(story.root);
+                SESSION::runActions(story, inv, root.actions, [&](const SESSION::ActionReport& action) { note(first, action); });
+                std::fill(first.vars.begin(), first.vars.end(), 0);
+                SESSION::runEffect(story, root.effect, inv, first.vars.data());
+                storeVars(first);
+                first.scratch[0] = story.root;
+
+                StateId rootId;
+                bool inserted;
+                if (!insert(first.scratch.data(), Origin{ NO_STATE, 0, 0 }, rootId, inserted)) return false;
+                std::vector<StateId> frontierIds(1, rootId);
+                std::vector<uint64_t> frontierStates(first.scratch);
+
+                uint32_t depth = 0;
+                while (!frontierIds.empty()) {
+                    size_t count = frontierIds.size();
+                    std::atomic<size_t> cursor{ 0 };
+                    auto work = [&](Worker& worker) {
+                        while (true) {
+                            size_t from = cursor.fetch_add(CHUNK, std::memory_order_relaxed);
+                            if (from >= count) return;
+                            size_t to = std::min(count, from + CHUNK);
+                            for (size_t i = from; i < to && !worker.full; ++i) {
+                                expand(worker, frontierIds[i], frontierStates.data() + i * stride, depth);
+                            }
+                        }
+                    };
+
+                    // small levels are not worth waking threads for
+                    size_t threads = std::min(workers.size(), (count + CHUNK - 1) / CHUNK);
+                    std::vector<std::thread> pool;
+                    for (size_t t = 1; t < threads; ++t) {
+                        pool.emplace_back([&work, this, t] { work(workers[t]); });
+                    }
+                    work(workers[0]);
+                    for (auto& thread : pool) thread.join();
+
+                    frontierIds.clear();
+                    frontierStates.clear();
+                    for (Worker& worker : workers) {
+                        if (worker.full) return false;
+                        frontierIds.insert(frontierIds.end(), worker.nextIds.begin(), worker.nextIds.end());
+                        frontierStates.insert(frontierStates.end(), worker.nextStates.begin(), worker.nextStates.end());
+                        worker.nextIds.clear();
+                        worker.nextStates.clear();
+                    }
+                    if (!frontierIds.empty()) ++depth;
+                }
+                report.depth = depth;
+                return true;
+            }
+
+            // Dense numbering of the sharded ids
+            size_t dense(StateId id) const { return base[shardOf(id)] + localOf(id); }
+
+            const uint64_t* stateOf(StateId id) const {
+                return shards[shardOf(id)].states.data() + size_t(localOf(id)) * stride;
+            }
+
+            void backward(Report& report) {
+                base.assign(SHARDS + 1, 0);
+                for (uint32_t s = 0; s < SHARDS; ++s) base[s + 1] = base[s] + shards[s].count;
+                size_t states = base[SHARDS];
+                report.states = states;
+
+                // reverse transitions as CSR: the sources of every state
+                std::vector<size_t> first(states + 1, 0);
+                for (const Worker& worker : workers) {
+                    report.transitions += worker.transitions;
+                    for (const auto& edge : worker.edges) ++first[dense(edge.second) + 1];
+                }
+                for (size_t i = 0; i < states; ++i) first[i + 1] += first[i];
+                std::vector<uint32_t> sources(first[states]);
+                std::vector<size_t> fill(first.begin(), first.end() - 1);
+                for (Worker& worker : workers) {
+                    for (const auto& edge : worker.edges) sources[fill[dense(edge.second)]++] = static_cast<uint32_t>(dense(edge.first));
+                    std::vector<std::pair<StateId, StateId>>().swap(worker.edges);
+                }
+
+                // everything that can still get to an end node
+                canEnd.assign(states, 0);
+                std::vector<uint32_t> queue;
+                for (uint32_t s = 0; s < SHARDS; ++s) {
+                    const Shard& shard = shards[s];
+                    for (uint32_t local = 0; local < shard.count; ++local) {
+                        if (story.isEndNode(static_cast<STORY::NodeId>(shard.states[size_t(local) * stride]))) {
+                            canEnd[base[s] + local] = 1;
+                            queue.push_back(static_cast<uint32_t>(base[s] + local));
+                        }
+                    }
+                }
+                report.endingReachable = !queue.empty();
+                for (size_t head = 0; head < queue.size(); ++head) {
+                    uint32_t state = queue[head];
+                    for (size_t i = first[state]; i < first[state + 1]; ++i) {
+                        if (!canEnd[sources[i]]) {
+                            canEnd[sources[i]] = 1;
+                            queue.push_back(sources[i]);
+                        }
+                    }
+                }
+                report.softlocks = states - queue.size();
+            }
+
+            void collect(Report& report) {
+                // nodes and endings no state is in
+                std::vector<char> reached(story.nodeCount(), 0);
+                std::vector<std::pair<uint32_t, StateId>> entries; // (depth, state) of softlock entries
+                for (uint32_t s = 0; s < SHARDS; ++s) {
+                    const Shard& shard = shards[s];
+                    for (uint32_t local = 0; local < shard.count; ++local) {
+                        reached[shard.states[size_t(local) * stride]] = 1;
+                        if (canEnd[base[s] + local]) continue;
+                        // only the turn that locks the player in, not everything after it
+                        const Origin& origin = shard.origins[local];
+                        if (origin.parent == NO_STATE || canEnd[dense(origin.parent)]) {
+                            entries.emplace_back(origin.depth, (local << SHARD_BITS) | s);
+                        }
+                    }
+                }
+                for (STORY::NodeId id = 0; id < story.nodeCount(); ++id) {
+                    if (reached[id]) continue;
+                    report.unreachableNodes.push_back(id);
+                    if (story.isEndNode(id)) report.unreachableEndings.push_back(id);
+                }
+
+                size_t samples = std::min(options.samples, entries.size());
+                std::partial_sort(entries.begin(), entries.begin() + samples, entries.end());
+                for (size_t i = 0; i < samples; ++i) {
+                    StateId id = entries[i].second;
+                    Softlock softlock;
+                    const uint64_t* state = stateOf(id);
+                    softlock.node = static_cast<STORY::NodeId>(state[0]);
+                    for (uint32_t i = 0; i < story.items.size; ++i) {
+                        uint32_t count = countOf(fields[i], state);
+                        if (count == 0) continue;
+                        softlock.items.push_back(story.items[i]);
+                        softlock.counts.push_back(count);
+                    }
+                    softlock.variables.resize(story.variables.size);
+                    if (!softlock.variables.empty()) std::memcpy(softlock.variables.data(), state + varWord, softlock.variables.size() * sizeof(int32_t));
+                    for (StateId at = id; ; ) {
+                        const Origin& origin = shards[shardOf(at)].origins[localOf(at)];
+                        if (origin.parent == NO_STATE) break;
+                        softlock.path.push_back(static_cast<int>(origin.choice));
+                        at = origin.parent;
+                    }
+                    std::reverse(softlock.path.begin(), softlock.path.end());
+                    report.softlockSamples.push_back(std::move(softlock));
+                }
+
+                // items no pickup ever granted
+                std::vector<uint64_t> obtained(itemWords, 0);
+                for (const Worker& worker : workers) {
+                    for (size_t w = 0; w < itemWords; ++w) obtained[w] |= worker.obtained[w];
+                }
+                for (uint32_t bit = 0; bit < story.items.size; ++bit) {
+                    if (!((obtained[bit >> 6] >> (bit & 63)) & 1u)) report.unobtainableItems.push_back(story.items[bit]);
+                }
+
+                // options that were never allowed or whose actions never worked, on nodes some state is in
+                std::vector<uint64_t> usable((story.options.size + 63) / 64, 0);
+                for (const Worker& worker : workers) {
+                    for (size_t w = 0; w < usable.size(); ++w) usable[w] |= worker.usable[w];
+                }
+                for (STORY::NodeId id = 0; id < story.nodeCount(); ++id) {
+                    if (!reached[id]) continue;
+                    const STORY::NodeRecord& record = story.node(id);
+                    for (uint32_t i = 0; i < record.optionCount; ++i) {
+                        uint32_t option = record.firstOption + i;
+                        const STORY::OptionRecord& choice = story.option(id, i);
+                        if (choice.actions.count == 0 && choice.condition.count == 0) continue;
+                        if (!((usable[option >> 6] >> (option & 63)) & 1u)) report.deadOptions.push_back(OptionRef{ id, i });
+                    }
+                }
+            }
+
+            const STORY::Story& story;
+            Options options;
+            std::vector<uint32_t> indexOf; // item id -> catalog index
+            std::vector<Field> fields;     // by catalog index
+            size_t itemWords = 0;          // of the obtained bitmaps
+            size_t varWord = 0;            // first word of the variables in a state
+            size_t stride = 0;             // words per state
+
+            std::unique_ptr<Shard[]> shards;
+            std::atomic<uint64_t> stateCount{ 0 };
+            std::vector<Worker> workers;
+
+            std::vector<size_t> base;    // first dense index of every shard
+            std::vector<char> canEnd;    // by dense index
+        };
+    }
+
+    // Explores the whole state space of a story. False (with error set) if the story is
+    // empty or has more than options.maxStates reachable states.
+    inline bool explore(const STORY::Story& story, Report& report, const Options& options = Options(), std::string* error = nullptr) {
+        detail::Explorer explorer(story, options);
+        return explorer.run(report, error);
+    }
+}
+
+#endif
@@ -0,0 +1,262 @@
+#ifndef FUZZ_HPP
+#define FUZZ_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "action.hpp"
+#include "inventory.hpp"
+#include "session.hpp"
+#include "story.hpp"
+
+namespace FUZZ {
+    // Plays random playthroughs of a story on every core and counts what happens: node
+    // visits, which endings players reach, playthrough lengths and USE actions that fail
+    // because the item is missing. Turns go through SESSION::runActions and the option
+    // scripts, the same rules a Session plays by: players only pick options whose
+    // condition holds.
+    //
+    // Every thread has its own counters (merged at the end) and playthrough n always draws
+    // from a generator seeded with (seed, n), so a seed gives the same report on any
+    // number of threads.
+
+    const uint32_t NO_INDEX = 0xFFFFFFFF; // item outside the story's catalog
+
+    // Counts per catalog item, the same multiset INVENTORY::Inventory keeps, without the
+    // item names
+    class CountInventory {
+    public:
+        explicit CountInventory(const STORY::Story& story) {
+            uint32_t maxId = 0;
+            for (INVENTORY::ItemId id : story.items) maxId = std::max(maxId, id + 1);
+            indexOf.assign(maxId, NO_INDEX);
+            for (uint32_t i = 0; i < story.items.size; ++i) indexOf[story.items[i]] = i;
+            counts.assign(story.items.size, 0);
+        }
+
+        uint32_t count(INVENTORY::ItemId id) const {
+            uint32_t index = find(id);
+            return index != NO_INDEX ? counts[index] : 0;
+        }
+
+        bool hasItem(INVENTORY::ItemId id, uint32_t amount = 1) const {
+            uint32_t index = find(id);
+            return id != INVENTORY::NO_ITEM && (index != NO_INDEX ? counts[index] : 0) >= amount;
+        }
+
+        // *any* of the items, like INVENTORY::Inventory::hasItems
+        bool hasItems(const INVENTORY::ItemId* ids, size_t count) const {
+            for (size_t i = 0; i < count; ++i) {
+                if (hasItem(ids[i])) return true;
+            }
+            return false;
+        }
+
+        void addItem(INVENTORY::ItemId id, uint32_t amount = 1) {
+            uint32_t index = find(id);
+            if (index != NO_INDEX) counts[index] += std::min(amount, UINT32_MAX - counts[index]);
+        }
+
+        void removeItem(INVENTORY::ItemId id, uint32_t amount = 1) {
+            uint32_t index = find(id);
+            if (index != NO_INDEX) counts[index] -= std::min(amount, counts[index]);
+        }
+
+        void clear() { std::fill(counts.begin(), counts.end(), 0); }
+
+    private:
+        uint32_t find(INVENTORY::ItemId id) const {
+            return id < indexOf.size() ? indexOf[id] : NO_INDEX;
+        }
+
+        std::vector<uint32_t> indexOf; // item id -> catalog index
+        std::vector<uint32_t> counts;
+    };
+
+    struct Options {
+        uint64_t playthroughs = 1000000;
+        size_t threads = 0;         // 0: one per hardware thread
+        uint32_t maxTurns = 1000;   // playthroughs still going after this many turns are cut off
+        uint64_t seed = 1;
+    };
+
+    struct Report {
+        uint64_t playthroughs = 0;
+        uint64_t finished = 0;          // reached an end node
+        uint64_t turns = 0;             // choices taken, over all playthroughs
+        uint64_t finishedTurns = 0;     // choices taken by the finished ones
+        uint64_t lockedIn = 0;          // stopped at a node where no option's condition held
+        uint64_t useActions = 0;        // USE actions that ran (not skipped by the pickup guard)
+        uint64_t failedUses = 0;        // ...and found the item missing
+        size_t threads = 0;
+        double seconds = 0;
+
+        std::vector<uint64_t> nodeVisits; // by node id, every time a node is entered
+        std::vector<uint64_t> endings;    // by node id, playthroughs that ended there
+        std::vector<uint64_t> failedUsesAt; // by node id, failed USE actions of the node or its options
+
+        double averageTurns() const { return finished ? double(finishedTurns) / double(finished) : 0.0; }
+        double failedUseRate() const { return useActions ? double(failedUses) / double(useActions) : 0.0; }
+    };
+
+    namespace detail {
+        const uint64_t CHUNK = 1024; // playthroughs a thread takes at a time
+
+        // splitmix64, one per playthrough
+        struct Random {
+            uint64_t state;
+
+            explicit Random(uint64_t seed) : state(seed) {}
+
+            uint64_t next() {
+                uint64_t z = (state += 0x9E3779B97F4A7C15ull);
+                z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+                z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+                return z ^ (z >> 31);
+            }
+
+            // uniform in [0, count)
+            uint32_t below(uint32_t count) {
+                return static_cast<uint32_t>(((next() >> 32) * count) >> 32);
+            }
+        };
+
+        struct alignas(64) Worker {
+            explicit Worker(const STORY::Story& story)
+                : inv(story), vars(story.variables.size, 0), nodeVisits(story.nodeCount(), 0), endings(story.nodeCount(), 0),
+                  failedUsesAt(story.nodeCount(), 0) {}
+
+            CountInventory inv;
+            std::vector<int32_t> vars;
+            std::vector<uint32_t> open; // options of the current node that are allowed
+            std::vector<uint64_t> nodeVisits;
+            std::vector<uint64_t> endings;
+            std::vector<uint64_t> failedUsesAt;
+            uint64_t finished = 0;
+            uint64_t turns = 0;
+            uint64_t finishedTurns = 0;
+            uint64_t lockedIn = 0;
+            uint64_t useActions = 0;
+            uint64_t failedUses = 0;
+        };
+
+        inline void note(Worker& worker, STORY::NodeId node, const SESSION::ActionReport& action) {
+            if (action.type != ACTION::TYPE::USE || action.result == ACTION::RESULT::ALREADY_HAVE) return;
+            ++worker.useActions;
+            if (action.result == ACTION::RESULT::MISSING_ITEM) {
+                ++worker.failedUses;
+                ++worker.failedUsesAt[node];
+            }
+        }
+
+        inline void enter(const STORY::Story& story, Worker& worker, STORY::NodeId node) {
+            const STORY::NodeRecord& record = story.node(node);
+            SESSION::runActions(story, worker.inv, record.actions, [&](const SESSION::ActionReport& action) { note(worker, node, action); });
+            SESSION::runEffect(story, record.effect, worker.inv, worker.vars.data());
+            ++worker.nodeVisits[node];
+        }
+
+        // Picks one of the options of node whose condition holds, NO_INDEX if none does
+        inline uint32_t choose(const STORY::Story& story, Worker& worker, STORY::NodeId node, Random& random) {
+            const STORY::NodeRecord& record = story.node(node);
+            if (story.code.size == 0) return random.below(record.optionCount);
+            worker.open.clear();
+            for (uint32_t i = 0; i < record.optionCount; ++i) {
+                if (SESSION::allowed(story, story.option(node, i), worker.inv, worker.vars.data())) worker.open.push_back(i);
+            }
+            if (worker.open.empty()) return NO_INDEX;
+            return worker.open[random.below(static_cast<uint32_t>(worker.open.size()))];
+        }
+
+        inline void play(const STORY::Story& story, const Options& options, Worker& worker, uint64_t playthrough) {
+            Random random(options.seed * 0xD1B54A32D192ED03ull + playthrough);
+            worker.inv.clear();
+            std::fill(worker.vars.begin(), worker.vars.end(), 0);
+
+            STORY::NodeId node = story.root;
+            enter(story, worker, node);
+            uint32_t turns = 0;
+            while (!story.isEndNode(node) && turns < options.maxTurns) {
+                uint32_t choice = choose(story, worker, node, random);
+                if (choice == NO_INDEX) {
+                    ++worker.lockedIn;
+                    break;
+                }
+                const STORY::OptionRecord& option = story.option(node, choice);
+                SESSION::runActions(story, worker.inv, option.actions, [&](const SESSION::ActionReport& action) { note(worker, node, action); });
+                SESSION::runEffect(story, option.effect, worker.inv, worker.vars.data());
+                node = option.next;
+                enter(story, worker, node);
+                ++turns;
+            }
+
+            worker.turns += turns;
+            if (story.isEndNode(node)) {
+                ++worker.finished;
+                worker.finishedTurns += turns;
+                ++worker.endings[node];
+            }
+        }
+    }
+
+    // Plays options.playthroughs random playthroughs. False (with error set) if the story is empty.
+    inline bool run(const STORY::Story& story, Report& report, const Options& options = Options(), std::string* error = nullptr) {
+        auto begin = std::chrono::steady_clock::now();
+        report = Report();
+        if (story.nodeCount() == 0) {
+            if (error) *error = "the story has no nodes";
+            return false;
+        }
+
+        size_t threads = options.threads ? options.threads : std::thread::hardware_concurrency();
+        if (threads == 0) threads = 1;
+        threads = static_cast<size_t>(std::min<uint64_t>(threads, std::max<uint64_t>(1, (options.playthroughs + detail::CHUNK - 1) / detail::CHUNK)));
+
+        std::vector<detail::Worker> workers(threads, detail::Worker(story));
+        std::atomic<uint64_t> cursor{ 0 };
+        auto work = [&](detail::Worker& worker) {
+            while (true) {
+                uint64_t from = cursor.fetch_add(detail::CHUNK, std::memory_order_relaxed);
+                if (from >= options.playthroughs) return;
+                uint64_t to = std::min(options.playthroughs, from + detail::CHUNK);
+                for (uint64_t n = from; n < to; ++n) detail::play(story, options, worker, n);
+            }
+        };
+
+        std::vector<std::thread> pool;
+        for (size_t t = 1; t < threads; ++t) {
+            pool.emplace_back([&work, &workers, t] { work(workers[t]); });
+        }
+        work(workers[0]);
+        for (auto& thread : pool) thread.join();
+
+        report.playthroughs = options.playthroughs;
+        report.threads = threads;
+        report.nodeVisits.assign(story.nodeCount(), 0);
+        report.endings.assign(story.nodeCount(), 0);
+        report.failedUsesAt.assign(story.nodeCount(), 0);
+        for (const detail::Worker& worker : workers) {
+            report.finished += worker.finished;
+            report.turns += worker.turns;
+            report.finishedTurns += worker.finishedTurns;
+            report.lockedIn += worker.lockedIn;
+            report.useActions += worker.useActions;
+            report.failedUses += worker.failedUses;
+            for (size_t i = 0; i < story.nodeCount(); ++i) {
+                report.nodeVisits[i] += worker.nodeVisits[i];
+                report.endings[i] += worker.endings[i];
+                report.failedUsesAt[i] += worker.failedUsesAt[i];
+            }
+        }
+
+        report.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+        return true;
+    }
+}
+
+#endif
@@ -0,0 +1,80 @@
+#ifndef HISTORY_HPP
+#define HISTORY_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <unordered_set>
+#include <vector>
+
+#include "inventory.hpp"
+#include "session.hpp"
+
+namespace HISTORY {
+    // The last turns of one session, for undo. Every recorded turn is a SESSION::Snapshot,
+    // so recording costs a reference count and turns that changed nothing but the node
+    // share the state of the turn before. The ring keeps at most depth turns, recording
+    // past that forgets the oldest.
+
+    // Heap bytes of one state: the block make_shared allocates and the vectors it owns
+    inline size_t bytes(const SESSION::State& state) {
+        const INVENTORY::Inventory& inv = state.inv;
+        return sizeof(SESSION::State) + 2 * sizeof(void*) // control block of make_shared
+               + inv.stacks.capacity() * sizeof(INVENTORY::Stack) + inv.slot.capacity() * sizeof(uint32_t)
+               + inv.held.words.capacity() * sizeof(uint64_t) + state.vars.capacity() * sizeof(int32_t);
+    }
+
+    // Heap bytes the snapshots in [first, last) keep alive, every shared state counted once
+    template<typename It>
+    size_t retained(It first, It last) {
+        std::unordered_set<const SESSION::State*> seen;
+        size_t total = 0;
+        for (; first != last; ++first) {
+            const SESSION::State* state = first->state.get();
+            if (state && seen.insert(state).second) total += bytes(*state);
+        }
+        return total;
+    }
+
+    class History {
+    public:
+        explicit History(size_t depth) : ring(depth ? depth : 1) {}
+
+        // Call after the session starts (or is loaded) and after every turn that went through
+        void record(const SESSION::Session& session) {
+            ring[(first + count) % ring.size()] = session.snapshot();
+            if (count < ring.size()) ++count;
+            else first = (first + 1) % ring.size();
+        }
+
+        // Takes back the last turns turns: the session goes back to the turn before them.
+        // False (and nothing changes) when fewer are recorded.
+        bool undo(SESSION::Session& session, size_t turns = 1) {
+            if (turns >= count) return false;
+            for (size_t i = 0; i < turns; ++i) ring[(first + --count) % ring.size()] = SESSION::Snapshot();
+            session.rewind(ring[(first + count - 1) % ring.size()]);
+            return true;
+        }
+
+        // Recorded turns, the current one included
+        size_t size() const { return count; }
+        size_t depth() const { return ring.size(); }
+
+        // Turn i back from the current one (0: current)
+        const SESSION::Snapshot& back(size_t i = 0) const { return ring[(first + count - 1 - i) % ring.size()]; }
+
+        void clear() {
+            for (auto& snap : ring) snap = SESSION::Snapshot();
+            first = count = 0;
+        }
+
+        // Bytes the ring holds: its slots and every state they keep alive
+        size_t memory() const { return ring.capacity() * sizeof(SESSION::Snapshot) + retained(ring.begin(), ring.end()); }
+
+    private:
+        std::vector<SESSION::Snapshot> ring;
+        size_t first = 0;
+        size_t count = 0;
+    };
+}
+
+#endif
@@ -2,53 +2,214 @@
 #define INVENTORY_HPP
 
 #include <vector>
+#include <memory_resource>
 #include <string>
+#include <string_view>
+#include <unordered_map>
+#include <mutex>
+#include <atomic>
+#include <cstdint>
 #include <algorithm>
 #include <iostream> // Added for potential future debug printing
 
+#include "output.hpp"
+#include "text.hpp"
+
 namespace INVENTORY {
+    // Item ids
+
+    typedef uint32_t ItemId;
+    static const ItemId NO_ITEM = 0xFFFFFFFFu; // id of the empty Item() (no item)
+
+    // Interns every item name into a dense integer id. Names are interned once when the
+    // story is built (Item's constructor), after that the turn path only compares ids.
+    //
+    // Names are kept in chunks that never move once allocated, so name() reads them without
+    // the lock: every session thread prints item names, only building a story interns them.
+    class ItemTable {
+    public:
+        static const size_t CHUNK = 4096;      // names per chunk
+        static const size_t MAX_CHUNKS = 4096; // 16M items
+
+        ItemTable() = default;
+        ItemTable(const ItemTable&) = delete;
+        ItemTable& operator=(const ItemTable&) = delete;
+        ~ItemTable() {
+            for (std::string_view* chunk : chunks) delete[] chunk;
+        }
+
+        ItemId intern(std::string_view name) {
+            if (name.empty()) return NO_ITEM;
+
+            std::lock_guard<std::mutex> lock(mutex);
+            auto it = ids.find(name);
+            if (it != ids.end()) return it->second;
+
+            size_t count = used.load(std::memory_order_relaxed);
+            if (count == CHUNK * MAX_CHUNKS) return NO_ITEM; // full, the name cannot be held
+            std::string_view*& chunk = chunks[count / CHUNK];
+            if (!chunk) chunk = new std::string_view[CHUNK];
+            std::string_view stored = TEXT::intern(name); // the one copy of the name
+            chunk[count % CHUNK] = stored;
+            ItemId id = static_cast<ItemId>(count);
+            ids.emplace(stored, id);
+            used.store(count + 1, std::memory_order_release); // publishes the name to name()
+            return id;
+        }
+
+        // Returns NO_ITEM for names that were never interned (nobody can be holding those)
+        ItemId find(std::string_view name) const {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto it = ids.find(name);
+            return it != ids.end() ? it->second : NO_ITEM;
+        }
+
+        // id must have come from intern() or find()
+        std::string_view name(ItemId id) const {
+            if (id >= used.load(std::memory_order_acquire)) return std::string_view();
+            return chunks[id / CHUNK][id % CHUNK];
+        }
+
+        size_t size() const { return used.load(std::memory_order_acquire); }
+
+    private:
+        mutable std::mutex mutex; // intern and find
+        std::unordered_map<std::string_view, ItemId> ids; // keys point into TEXT::pool()
+        std::string_view* chunks[MAX_CHUNKS] = {};
+        std::atomic<size_t> used{ 0 };
+    };
+
+    // The process wide item symbol table
+    inline ItemTable& itemTable() {
+        static ItemTable table;
+        return table;
+    }
+
     // Items
 
     class Item {
     public:
-        std::string name;
+        std::string_view name; // points into TEXT::pool(), copies of an Item share it
+        ItemId id = NO_ITEM;
         Item() = default;
-        Item(std::string name) : name(name) {} // Use member initializer list
+        Item(std::string_view name) : Item(itemTable().intern(name)) {}
+        explicit Item(ItemId id) : name(id != NO_ITEM ? itemTable().name(id) : std::string_view()), id(id) {}
         ~Item() = default;
 
         // Added for easier comparison
         bool operator==(const Item& other) const {
-            return name == other.name;
+            return id == other.id;
         }
     };
 
     // typedefs
-    typedef std::vector<Item> ItemVec;
+    typedef std::pmr::vector<Item> ItemVec;
+
+    // Everything that keeps per-player storage takes one, see MEMORY::Arena
+    typedef std::pmr::polymorphic_allocator<char> Allocator;
+
+    // Fixed-width bitset over item ids, one bit per interned item
+    class ItemSet {
+    public:
+        typedef Allocator allocator_type;
+
+        ItemSet() = default;
+        explicit ItemSet(const allocator_type& alloc) : words(alloc) {}
+        ItemSet(const ItemSet& other, const allocator_type& alloc) : words(other.words, alloc) {}
+        ItemSet(const ItemSet&) = default;
+        ItemSet(ItemSet&&) = default;
+        ItemSet& operator=(const ItemSet&) = default;
+        ItemSet& operator=(ItemSet&&) = default;
+
+        bool test(ItemId id) const {
+            size_t word = id >> 6;
+            return word < words.size() && ((words[word] >> (id & 63)) & 1u);
+        }
+
+        void set(ItemId id) {
+            size_t word = id >> 6;
+            if (word >= words.size()) words.resize(word + 1, 0);
+            words[word] |= uint64_t(1) << (id & 63);
+        }
+
+        void reset(ItemId id) {
+            size_t word = id >> 6;
+            if (word < words.size()) words[word] &= ~(uint64_t(1) << (id & 63));
+        }
+
+        void clear() { std::fill(words.begin(), words.end(), 0); }
+
+        std::pmr::vector<uint64_t> words;
+    };
 
     // inventory
 
+    // One kind of item and how many of it the player holds
+    struct Stack {
+        ItemId id = NO_ITEM;
+        uint32_t count = 0;
+    };
+
+    // Stacks of items: adding, removing and counting are O(1) through an id -> stack index,
+    // 500 rounds of ammo are one Stack. A stack that drops to 0 keeps its place, so the
+    // display order is the order items were first picked up.
+    //
+    // The storage comes from the allocator it was made with (the default heap if none);
+    // copies made with an allocator, like a session's copy-on-write state, use that one.
     struct Inventory {
-        ItemVec items;
+        typedef Allocator allocator_type;
+
+        std::pmr::vector<Stack> stacks;  // in first pickup order, empty stacks included
+        std::pmr::vector<uint32_t> slot; // item id -> index in stacks + 1, 0 if never held
+        ItemSet held;                    // bit set while the count is above 0, this is what masks look at
+
+        Inventory() = default;
+        explicit Inventory(const allocator_type& alloc) : stacks(alloc), slot(alloc), held(alloc) {}
+        Inventory(const Inventory& other, const allocator_type& alloc)
+            : stacks(other.stacks, alloc), slot(other.slot, alloc), held(other.held, alloc) {}
+        Inventory(const Inventory&) = default;
+        Inventory(Inventory&&) = default;
+        Inventory& operator=(const Inventory&) = default;
+        Inventory& operator=(Inventory&&) = default;
+
+        uint32_t count(ItemId id) const {
+            if (id >= slot.size() || slot[id] == 0) return 0;
+            return stacks[slot[id] - 1].count;
+        }
+
+        bool hasItem(ItemId id) const {
+            return id != NO_ITEM && held.test(id);
+        }
+
+        bool hasItem(ItemId id, uint32_t amount) const {
+            return id != NO_ITEM && count(id) >= amount;
+        }
 
         bool hasItem(const std::string& itemName) const { // Made const
-            for (const auto& item : items) { // Use range-based for loop
-                if (item.name == itemName) return true;
-            }
-            return false;
+            return hasItem(itemTable().find(itemName));
         }
 
         bool hasItems(const ItemVec& itemsToCheck) const { // Made const, renamed parameter
             // This checks if *any* item from itemsToCheck is in the inventory.
             // If you need to check if *all* items are present, the logic needs to change.
             for (const auto& itemToCheck : itemsToCheck) {
-                if (hasItem(itemToCheck.name)) { // Reuse hasItem logic
+                if (hasItem(itemToCheck.id)) { // Reuse hasItem logic
                     return true;
                 }
             }
             return false;
         }
 
-        void addItem(const Item& item) { this->items.push_back(item); } // Made const reference
+        bool hasItems(const ItemId* ids, size_t count) const {
+            for (size_t i = 0; i < count; ++i) {
+                if (hasItem(ids[i])) return true;
+            }
+            return false;
+        }
+
+        void addItem(const Item& item) { // Made const reference
+            addItem(item.id);
+        }
 
         void addItems(const ItemVec& items) { // Made const reference
             for (const auto& item : items) { // Use range-based for loop
@@ -56,29 +217,56 @@ namespace INVENTORY {
             }
         }
 
-        void removeItem(const std::string& itemName) { // Made const reference
-            // find the item by its name
-            auto it = std::find_if(items.begin(), items.end(), [&](const Item& item){
-                return item.name == itemName;
-            });
-
-            // if the item is found, erase it
-            if (it != items.end()) {
-                items.erase(it);
+        void addItem(ItemId id, uint32_t amount = 1) {
+            if (id == NO_ITEM || amount == 0) return;
+            if (id >= slot.size()) slot.resize(id + 1, 0);
+            if (slot[id] == 0) {
+                stacks.push_back(Stack{ id, 0 });
+                slot[id] = static_cast<uint32_t>(stacks.size());
             }
+            Stack& stack = stacks[slot[id] - 1];
+            stack.count = amount > UINT32_MAX - stack.count ? UINT32_MAX : stack.count + amount;
+            held.set(id);
+        }
+
+        // Removes up to amount, the stack keeps its place at 0
+        void removeItem(ItemId id, uint32_t amount = 1) {
+            if (!hasItem(id)) return;
+            Stack& stack = stacks[slot[id] - 1];
+            stack.count -= std::min(amount, stack.count);
+            if (stack.count == 0) held.reset(id);
+        }
+
+        void removeItem(const std::string& itemName) { // Made const reference
+            removeItem(itemTable().find(itemName));
+        }
+
+        void clear() {
+            stacks.clear();
+            std::fill(slot.begin(), slot.end(), 0);
+            held.clear();
         }
 
         // Optional: Print inventory contents
-        void print() const {
-            std::cout << "--- INVENTORY ---\n";
-            if (items.empty()) {
-                std::cout << "Inventory is empty.\n";
-            } else {
-                for (size_t i = 0; i < items.size(); ++i) {
-                    std::cout << i + 1 << ". " << items[i].name << "\n";
-                }
+        void print(OUTPUT::Buffer& out) const {
+            out << "--- INVENTORY ---\n";
+            size_t shown = 0;
+            for (const Stack& stack : stacks) {
+                if (stack.count == 0) continue;
+                out << ++shown << ". " << itemTable().name(stack.id);
+                if (stack.count > 1) out << " x" << stack.count;
+                out << "\n";
             }
-            std::cout << "-----------------\n";
+            if (shown == 0) {
+                out << "Inventory is empty.\n";
+            }
+            out << "-----------------\n";
+        }
+
+        void print() const {
+            OUTPUT::Buffer out;
+            print(out);
+            OUTPUT::StreamSink(std::cout).write(out);
         }
     };
 }
@@ -0,0 +1,168 @@
+#ifndef MASKS_HPP
+#define MASKS_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define MASKS_AVX2 1
+#endif
+
+#include "action.hpp"
+#include "inventory.hpp"
+#include "story.hpp"
+
+namespace MASKS {
+    // Every option's actions compiled into two item bitmasks:
+    //   need:  items the actions need (the USE items)
+    //   block: items that make the pickup guard skip one (the pickup items)
+    // The actions take effect exactly when (inv & need) == need and (inv & block) == 0, so
+    // "which options of this node would work right now" is a few ANDs and compares per
+    // option, done for 4 options per instruction when AVX2 is enabled (-mavx2).
+    //
+    // Masks of a node are stored word major (word 0 of every option, then word 1, ...) so
+    // the options are the SIMD lanes. The bits say whether an item is held at all; the few
+    // options that use up more than one of an item get their count checked afterwards.
+    // A list of several actions is judged on the inventory before the option runs, and
+    // kinds other than PICKUP and USE (see ACTION::Registry) count as always working.
+
+    class OptionMasks {
+    public:
+        // Bits are item ids, the same bits as INVENTORY::Inventory::held
+        explicit OptionMasks(const STORY::Story& story) : story(&story) {
+            INVENTORY::ItemId maxId = 0;
+            for (INVENTORY::ItemId id : story.items) maxId = std::max(maxId, id + 1);
+            build(maxId);
+        }
+
+        // Inventory words the masks cover
+        size_t words() const { return wordCount; }
+
+        // Sets bit i of out for every option i of node whose action would take effect with
+        // inventory inv (words() words), as far as held bits tell: options that use more
+        // than one of an item only need it held here. out needs (optionCount + 63) / 64 words.
+        void available(STORY::NodeId node, const uint64_t* inv, uint64_t* out) const {
+            available(node, inv, wordCount, out);
+        }
+
+        void available(STORY::NodeId node, const INVENTORY::Inventory& inv, uint64_t* out) const {
+            // items the set never grew to are not held
+            const auto& held = inv.held.words;
+            available(node, held.data(), std::min(held.size(), wordCount), out);
+            dropShort(node, inv, out);
+        }
+
+    private:
+        // A USE option that takes more than one of its item
+        struct Counted {
+            uint32_t option;
+            INVENTORY::ItemId item;
+            uint32_t count;
+
+            bool operator<(uint32_t other) const { return option < other; }
+        };
+
+        // available() for an inventory of only held words, the words after those count as 0
+        void available(STORY::NodeId node, const uint64_t* inv, size_t held, uint64_t* out) const {
+            const STORY::NodeRecord& record = story->node(node);
+            size_t count = record.optionCount;
+            std::fill(out, out + (count + 63) / 64, 0);
+            const uint64_t* needs = need.data() + size_t(record.firstOption) * wordCount;
+            const uint64_t* blocks = block.data() + size_t(record.firstOption) * wordCount;
+
+            size_t i = 0;
+#ifdef MASKS_AVX2
+            const __m256i zero = _mm256_setzero_si256();
+            for (; i + 4 <= count; i += 4) {
+                __m256i ok = _mm256_set1_epi64x(-1);
+                for (size_t w = 0; w < wordCount; ++w) {
+                    __m256i have = w < held ? _mm256_set1_epi64x(static_cast<long long>(inv[w])) : zero;
+                    __m256i n = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(needs + w * count + i));
+                    __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(blocks + w * count + i));
+                    ok = _mm256_and_si256(ok, _mm256_cmpeq_epi64(_mm256_and_si256(have, n), n));
+                    ok = _mm256_and_si256(ok, _mm256_cmpeq_epi64(_mm256_and_si256(have, b), zero));
+                }
+                uint64_t bits = static_cast<uint64_t>(_mm256_movemask_pd(_mm256_castsi256_pd(ok)));
+                out[i >> 6] |= bits << (i & 63); // i is a multiple of 4, the 4 bits never straddle words
+            }
+#endif
+            for (; i < count; ++i) {
+                bool ok = true;
+                for (size_t w = 0; w < wordCount && ok; ++w) {
+                    uint64_t have = w < held ? inv[w] : 0;
+                    uint64_t n = needs[w * count + i];
+                    ok = (have & n) == n && (have & blocks[w * count + i]) == 0;
+                }
+                if (ok) out[i >> 6] |= uint64_t(1) << (i & 63);
+            }
+
+            if (impossible.empty()) return;
+            auto first = std::lower_bound(impossible.begin(), impossible.end(), record.firstOption);
+            for (auto it = first; it != impossible.end() && *it < record.firstOption + count; ++it) {
+                size_t option = *it - record.firstOption;
+                out[option >> 6] &= ~(uint64_t(1) << (option & 63));
+            }
+        }
+
+        // Clears the options of node that need more of an item than inv holds
+        void dropShort(STORY::NodeId node, const INVENTORY::Inventory& inv, uint64_t* out) const {
+            if (counted.empty()) return;
+            const STORY::NodeRecord& record = story->node(node);
+            auto first = std::lower_bound(counted.begin(), counted.end(), record.firstOption);
+            for (auto it = first; it != counted.end() && it->option < record.firstOption + record.optionCount; ++it) {
+                if (inv.hasItem(it->item, it->count)) continue;
+                size_t option = it->option - record.firstOption;
+                out[option >> 6] &= ~(uint64_t(1) << (option & 63));
+            }
+        }
+
+        // Items with an id from maxId on are in none of the story's actions
+        void build(INVENTORY::ItemId maxId) {
+            wordCount = (size_t(maxId) + 63) / 64;
+            need.assign(size_t(story->options.size) * wordCount, 0);
+            block.assign(size_t(story->options.size) * wordCount, 0);
+
+            auto setBit = [&](std::vector<uint64_t>& masks, const STORY::NodeRecord& record, size_t option, INVENTORY::ItemId id) {
+                if (id >= maxId) return;
+                size_t index = size_t(record.firstOption) * wordCount + (id >> 6) * record.optionCount + option;
+                masks[index] |= uint64_t(1) << (id & 63);
+            };
+
+            for (STORY::NodeId node = 0; node < story->nodeCount(); ++node) {
+                const STORY::NodeRecord& record = story->node(node);
+                for (size_t i = 0; i < record.optionCount; ++i) {
+                    const STORY::OptionRecord& option = story->option(node, i);
+                    uint32_t index = record.firstOption + static_cast<uint32_t>(i);
+                    const ACTION::Operands* actions = story->actionList(option.actions);
+                    bool never = false;
+                    for (uint32_t a = 0; a < option.actions.count; ++a) {
+                        const ACTION::Operands& action = actions[a];
+                        if (action.opcode == ACTION::TYPE::NONE) continue; // always works
+                        const INVENTORY::ItemId* pickups = story->pickupItems(action);
+                        for (uint32_t p = 0; p < action.itemCount; ++p) setBit(block, record, i, pickups[p]);
+                        if (action.opcode != ACTION::TYPE::USE) continue;
+                        if (action.item >= maxId) {
+                            never = true; // USE of nothing always fails
+                        } else {
+                            setBit(need, record, i, action.item);
+                            if (action.count > 1) counted.push_back(Counted{ index, action.item, action.count });
+                        }
+                    }
+                    if (never) impossible.push_back(index);
+                }
+            }
+            std::sort(impossible.begin(), impossible.end());
+        }
+
+        const STORY::Story* story;
+        size_t wordCount = 0;
+        std::vector<uint64_t> need;
+        std::vector<uint64_t> block;
+        std::vector<uint32_t> impossible; // option indices, sorted
+        std::vector<Counted> counted;     // by option index, built in order so already sorted
+    };
+}
+
+#endif
@@ -0,0 +1,166 @@
+#ifndef MEMORY_HPP
+#define MEMORY_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <memory_resource>
+
+namespace MEMORY {
+    // Heap accounting and per-session arenas for the engine's containers. Inventories,
+    // session states and turn buffers take a std::pmr::memory_resource; an Arena gives one
+    // session its own blocks, counts what it uses and hands everything back in one go when
+    // it goes away.
+
+    // Passes allocations through to upstream and counts them. A limit is not enforced here
+    // (an allocation never fails on account of it), over() tells whoever owns the account
+    // that it was passed so they can drop the player at a turn boundary.
+    class Account : public std::pmr::memory_resource {
+    public:
+        explicit Account(std::pmr::memory_resource* upstream = std::pmr::new_delete_resource(), size_t limit = 0)
+            : upstream(upstream), limit(limit) {}
+
+        Account(const Account&) = delete;
+        Account& operator=(const Account&) = delete;
+
+        size_t live() const { return liveBytes; }
+        size_t peak() const { return peakBytes; }
+        uint64_t allocations() const { return count; }
+        size_t quota() const { return limit; }
+        void setQuota(size_t bytes) { limit = bytes; }
+        bool over() const { return limit != 0 && peakBytes > limit; }
+
+    private:
+        void* do_allocate(size_t bytes, size_t alignment) override {
+            void* memory = upstream->allocate(bytes, alignment);
+            liveBytes += bytes;
+            peakBytes = std::max(peakBytes, liveBytes);
+            ++count;
+            return memory;
+        }
+
+        void do_deallocate(void* memory, size_t bytes, size_t alignment) override {
+            upstream->deallocate(memory, bytes, alignment);
+            liveBytes -= bytes;
+        }
+
+        bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override { return this == &other; }
+
+        std::pmr::memory_resource* upstream;
+        size_t limit;
+        size_t liveBytes = 0;
+        size_t peakBytes = 0;
+        uint64_t count = 0;
+    };
+
+    // One session's memory. Blocks up to MAX_BLOCK bytes are rounded up to a power of two
+    // and carved out of chunks the arena takes from the heap (512 bytes at first, twice as
+    // much every time up to 16 KB). A freed block goes on its size's free list and is the
+    // next one handed out, so a session that stops growing stops touching the heap. Bigger
+    // blocks go to the heap directly. The chunks go back to the heap together when the
+    // arena is destroyed (or release()d).
+    //
+    // Not thread safe, like the session that uses it. Everything allocated from it must be
+    // gone before it is: declare the arena before the session and buffers that use it.
+    class Arena : public std::pmr::memory_resource {
+    public:
+        static const size_t MIN_BLOCK = 16;
+        static const size_t MAX_BLOCK = 2048;
+        static const size_t FIRST_CHUNK = 512;
+        static const size_t MAX_CHUNK = 16384;
+
+        explicit Arena(size_t quota = 0) : used(this, quota) {}
+        ~Arena() override { release(); }
+
+        Arena(const Arena&) = delete;
+        Arena& operator=(const Arena&) = delete;
+
+        // What the session's containers allocate from: the arena, counted
+        std::pmr::memory_resource* resource() { return &used; }
+
+        // Bytes the session's containers hold now and at most, and the quota they are held to
+        size_t live() const { return used.live(); }
+        size_t peak() const { return used.peak(); }
+        bool over() const { return used.over(); }
+        void setQuota(size_t bytes) { used.setQuota(bytes); }
+
+        // Bytes the arena took from the heap, rounding and unused chunk space included
+        size_t footprint() const { return heap.live(); }
+
+        // Frees everything at once. Only when nothing allocated from the arena is alive.
+        void release() {
+            while (chunks) {
+                Chunk* next = chunks->next;
+                heap.deallocate(chunks, chunks->size, alignof(std::max_align_t));
+                chunks = next;
+            }
+            std::fill(std::begin(freeBlocks), std::end(freeBlocks), nullptr);
+            cursor = limit = nullptr;
+            nextChunk = FIRST_CHUNK;
+        }
+
+    private:
+        struct Chunk {
+            Chunk* next;
+            size_t size;
+        };
+        struct Block {
+            Block* next;
+        };
+        static const size_t CLASSES = 8; // 16, 32 ... 2048
+
+        static size_t sizeClass(size_t bytes) {
+            size_t index = 0;
+            for (size_t block = MIN_BLOCK; block < bytes; block <<= 1) ++index;
+            return index;
+        }
+
+        void* do_allocate(size_t bytes, size_t alignment) override {
+            if (bytes > MAX_BLOCK || alignment > alignof(std::max_align_t)) return heap.allocate(bytes, alignment);
+            size_t index = sizeClass(bytes);
+            if (Block* block = freeBlocks[index]) {
+                freeBlocks[index] = block->next;
+                return block;
+            }
+            size_t size = MIN_BLOCK << index;
+            if (static_cast<size_t>(limit - cursor) < size) grow(size);
+            char* block = cursor;
+            cursor += size;
+            return block;
+        }
+
+        void do_deallocate(void* memory, size_t bytes, size_t alignment) override {
+            if (bytes > MAX_BLOCK || alignment > alignof(std::max_align_t)) return heap.deallocate(memory, bytes, alignment);
+            size_t index = sizeClass(bytes);
+            Block* block = static_cast<Block*>(memory);
+            block->next = freeBlocks[index];
+            freeBlocks[index] = block;
+        }
+
+        bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override { return this == &other; }
+
+        // A new chunk for at least size bytes, the rest of the current one is left unused
+        void grow(size_t size) {
+            const size_t header = (sizeof(Chunk) + alignof(std::max_align_t) - 1) / alignof(std::max_align_t) * alignof(std::max_align_t);
+            size_t bytes = std::max(nextChunk, header + size);
+            Chunk* chunk = static_cast<Chunk*>(heap.allocate(bytes, alignof(std::max_align_t)));
+            chunk->next = chunks;
+            chunk->size = bytes;
+            chunks = chunk;
+            cursor = reinterpret_cast<char*>(chunk) + header;
+            limit = reinterpret_cast<char*>(chunk) + bytes;
+            nextChunk = nextChunk * 2 < MAX_CHUNK ? nextChunk * 2 : MAX_CHUNK;
+        }
+
+        Account heap;  // the arena's own use of the heap
+        Account used;  // what the session holds, allocates from the arena
+        Block* freeBlocks[CLASSES] = {};
+        Chunk* chunks = nullptr;
+        char* cursor = nullptr;
+        char* limit = nullptr;
+        size_t nextChunk = FIRST_CHUNK;
+    };
+}
+
+#endif
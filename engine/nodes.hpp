@@ -3,12 +3,15 @@
 
 #include <iostream>
 #include <string>
+#include <string_view>
+#include <utility>
 #include <vector>
 #include <memory>
 
 // Include the full definition of Action and Inventory here
 #include "action.hpp"
 #include "inventory.hpp"
+#include "text.hpp"
 
 namespace NODE {
     // some stuff to make code easier to read
@@ -21,38 +24,53 @@ namespace NODE {
     }
 
     // Nodes/progression
+    // Node and option text is interned in TEXT::pool(), repeated labels ("Go back") are stored once
 
     class Option {
     public:
-        std::string text;
+        std::string_view text;
         ACTION::Action useAction = ACTION::Action(ACTION::TYPE::NONE);
         INVENTORY::ItemVec pickupItems;
         INVENTORY::Item useItem; // Represents the item to be used for the USE action
+        std::string_view condition; // SCRIPT expression, the option can only be taken while it holds
+        std::string_view effect;    // SCRIPT statements, run after the action
 
         // Use member initializer list
-        Option(std::string optionText, ACTION::Action useAction, INVENTORY::ItemVec pickupItems, INVENTORY::Item useItem)
-            : text(optionText), useAction(useAction), pickupItems(pickupItems), useItem(useItem) {}
+        Option(std::string_view optionText, ACTION::Action useAction, INVENTORY::ItemVec pickupItems, INVENTORY::Item useItem,
+               std::string_view condition = {}, std::string_view effect = {})
+            : text(TEXT::intern(optionText)), useAction(useAction), pickupItems(std::move(pickupItems)), useItem(useItem),
+              condition(TEXT::intern(condition)), effect(TEXT::intern(effect)) {}
         ~Option() = default;
     };
 
     class Node {
     public:
-        std::string text;
+        std::string_view text;
         std::vector<Option> options;
         std::vector<NodePtr> nextNodes;
 
         ACTION::Action onEnterAction = ACTION::Action(ACTION::TYPE::NONE);
         INVENTORY::Item onEnterUseItem; // Item to be used for the ON_ENTER_USE action
         INVENTORY::ItemVec onEnterPickupItems; // Items to be picked up for the ON_ENTER_PICKUP action
+        std::string_view onEnterEffect; // SCRIPT statements, run after the on enter action
+        std::string_view key; // optional stable name, keeps the node's identity across story reloads
 
         // Use member initializer list
-        Node(std::string text, ACTION::Action onEnterAction, INVENTORY::Item onEnterUseItem, INVENTORY::ItemVec onEnterPickupItems)
-            : text(text), onEnterAction(onEnterAction), onEnterUseItem(onEnterUseItem), onEnterPickupItems(onEnterPickupItems) {}
+        Node(std::string_view text, ACTION::Action onEnterAction, INVENTORY::Item onEnterUseItem, INVENTORY::ItemVec onEnterPickupItems,
+             std::string_view onEnterEffect = {})
+            : text(TEXT::intern(text)), onEnterAction(onEnterAction), onEnterUseItem(onEnterUseItem), onEnterPickupItems(std::move(onEnterPickupItems)),
+              onEnterEffect(TEXT::intern(onEnterEffect)) {}
         ~Node() = default;
 
+        // Names the node for STORY::nodeKey, worth doing for nodes whose text changes between versions
+        Node& setKey(std::string_view name) {
+            key = TEXT::intern(name);
+            return *this;
+        }
+
         void addNextNode(NodePtr nextNode, Option option) {
-            this->nextNodes.push_back(nextNode);
-            this->options.push_back(option);
+            this->nextNodes.push_back(std::move(nextNode));
+            this->options.push_back(std::move(option));
         }
 
         bool isEndNode() const { // Made const
@@ -0,0 +1,483 @@
+#ifndef NPC_HPP
+#define NPC_HPP
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "action.hpp"
+#include "inventory.hpp"
+#include "output.hpp"
+#include "session.hpp"
+#include "story.hpp"
+
+namespace NPC {
+    // Characters that live in the story's nodes and move between them once per turn. The
+    // world is a structure of arrays: where every NPC is, what kind it is, its mood, its
+    // turns until it next acts, its random state and its items (a bitset over the story's
+    // item catalog) are separate arrays indexed by NPC id, so a tick streams through only
+    // the arrays it needs.
+    //
+    // A tick is split into chunks of NPCs on a pool of threads. Every NPC only writes its
+    // own slots and draws from its own generator, so the result does not depend on the
+    // number of threads. After the moves the NPCs are bucketed by node and kind (a counting
+    // sort), which makes "who is in node n" and "how many of kind k are in n" slice lookups.
+    // The sort counts per run of NPCs at least as long as there are buckets, so a tick costs
+    // O(NPCs + nodes * kinds) however big the story is.
+
+    typedef uint32_t NpcId;
+    typedef uint16_t KindId;
+
+    enum BEHAVIOR : uint8_t {
+        IDLE,   // stays where it is
+        WANDER, // takes a random option of its node every period turns
+        FOLLOW, // moves to the player's node when one of its node's options leads there
+        SHY,    // leaves when the player comes in
+        GUARD   // stays, gets alert for a while when the player picks up or uses something in its node
+    };
+
+    enum MOOD : uint8_t {
+        CALM,
+        ALERT
+    };
+
+    // What the player did in a node this turn, bits
+    enum EVENT : uint8_t {
+        ENTERED = 1,
+        PICKED_UP = 2,
+        USED = 4
+    };
+
+    struct Kind {
+        std::string name;
+        BEHAVIOR behavior = IDLE;
+        uint16_t period = 1; // turns between acts (WANDER moves, GUARD calming down)
+    };
+
+    // Option `option` (index into the story's option table) is only available while an NPC
+    // of `kind` is (present = true) or is not (present = false) in the option's node
+    struct Rule {
+        uint32_t option = 0;
+        KindId kind = 0;
+        bool present = true;
+    };
+
+    // A run of NPC ids, in id order within a kind
+    struct Span {
+        const NpcId* data = nullptr;
+        uint32_t size = 0;
+
+        const NpcId* begin() const { return data; }
+        const NpcId* end() const { return data + size; }
+    };
+
+    namespace detail {
+        // Runs job(chunk) for chunks 0 .. count-1 on persistent threads, the caller takes part
+        class Pool {
+        public:
+            explicit Pool(size_t threads) {
+                for (size_t i = 1; i < threads; ++i) workers.emplace_back([this] { work(); });
+            }
+
+            ~Pool() {
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    stopping = true;
+                }
+                wake.notify_all();
+                for (auto& worker : workers) worker.join();
+            }
+
+            size_t threads() const { return workers.size() + 1; }
+
+            void run(size_t count, const std::function<void(size_t)>& job) {
+                if (workers.empty() || count <= 1) {
+                    for (size_t i = 0; i < count; ++i) job(i);
+                    return;
+                }
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    current = &job;
+                    chunks = count;
+                    next = 0;
+                    done = 0;
+                    ++round;
+                }
+                wake.notify_all();
+                take();
+                std::unique_lock<std::mutex> lock(mutex);
+                finished.wait(lock, [this] { return done == chunks; });
+                current = nullptr;
+            }
+
+        private:
+            void take() {
+                while (true) {
+                    size_t chunk;
+                    const std::function<void(size_t)>* job;
+                    {
+                        std::lock_guard<std::mutex> lock(mutex);
+                        if (!current || next >= chunks) return;
+                        chunk = next++;
+                        job = current;
+                    }
+                    (*job)(chunk);
+                    std::lock_guard<std::mutex> lock(mutex);
+                    if (++done == chunks) finished.notify_all();
+                }
+            }
+
+            void work() {
+                uint64_t seen = 0;
+                while (true) {
+                    {
+                        std::unique_lock<std::mutex> lock(mutex);
+                        wake.wait(lock, [&] { return stopping || round != seen; });
+                        if (stopping) return;
+                        seen = round;
+                    }
+                    take();
+                }
+            }
+
+            std::vector<std::thread> workers;
+            std::mutex mutex;
+            std::condition_variable wake;
+            std::condition_variable finished;
+            const std::function<void(size_t)>* current = nullptr;
+            size_t chunks = 0;
+            size_t next = 0;
+            size_t done = 0;
+            uint64_t round = 0;
+            bool stopping = false;
+        };
+    }
+
+    class World {
+    public:
+        // NPCs per chunk of a tick, a thread takes one chunk at a time
+        static const uint32_t CHUNK = 16384;
+
+        // threads = 0: one per hardware thread
+        explicit World(const STORY::Story& story, size_t threads = 0)
+            : story(&story), events(story.nodes.size, 0),
+              pool(threads ? threads : std::max(1u, std::thread::hardware_concurrency())) {
+            INVENTORY::ItemId maxId = 0;
+            for (INVENTORY::ItemId id : story.items) maxId = std::max(maxId, id + 1);
+            bitOf.assign(maxId, uint32_t(NO_BIT));
+            for (uint32_t i = 0; i < story.items.size; ++i) bitOf[story.items[i]] = i;
+            words = (story.items.size + 63) / 64;
+        }
+
+        World(const World&) = delete;
+        World& operator=(const World&) = delete;
+
+        KindId addKind(const Kind& kind) {
+            kinds.push_back(kind);
+            if (kinds.back().period == 0) kinds.back().period = 1;
+            return static_cast<KindId>(kinds.size() - 1);
+        }
+
+        const Kind& kind(KindId id) const { return kinds[id]; }
+        size_t kindCount() const { return kinds.size(); }
+
+        void reserve(size_t count) {
+            position.reserve(count);
+            kindIds.reserve(count);
+            mood.reserve(count);
+            timer.reserve(count);
+            random.reserve(count);
+            items.reserve(count * words);
+        }
+
+        // A new NPC at node, seed picks its random choices. Presence queries see it after
+        // the next tick.
+        NpcId spawn(KindId kind, STORY::NodeId node, uint32_t seed) {
+            NpcId id = static_cast<NpcId>(position.size());
+            position.push_back(node);
+            kindIds.push_back(kind);
+            mood.push_back(CALM);
+            timer.push_back(static_cast<uint16_t>(1 + seed % kinds[kind].period)); // not all in step
+            random.push_back(seed * 2654435761u | 1u);
+            items.resize(items.size() + words, 0);
+            return id;
+        }
+
+        size_t size() const { return position.size(); }
+        STORY::NodeId node(NpcId id) const { return position[id]; }
+        KindId kindOf(NpcId id) const { return kindIds[id]; }
+        MOOD moodOf(NpcId id) const { return static_cast<MOOD>(mood[id]); }
+
+        // Items outside the story's catalog cannot be held
+        bool give(NpcId id, INVENTORY::ItemId item) {
+            uint32_t bit = bitFor(item);
+            if (bit == NO_BIT) return false;
+            items[size_t(id) * words + bit / 64] |= uint64_t(1) << (bit % 64);
+            return true;
+        }
+
+        void take(NpcId id, INVENTORY::ItemId item) {
+            uint32_t bit = bitFor(item);
+            if (bit != NO_BIT) items[size_t(id) * words + bit / 64] &= ~(uint64_t(1) << (bit % 64));
+        }
+
+        bool has(NpcId id, INVENTORY::ItemId item) const {
+            uint32_t bit = bitFor(item);
+            return bit != NO_BIT && (items[size_t(id) * words + bit / 64] >> (bit % 64)) & 1u;
+        }
+
+        void addRule(const Rule& rule) { rules.push_back(rule); }
+        bool hasRules() const { return !rules.empty(); }
+
+        // What the player did, NPCs react on the next tick
+        void notify(STORY::NodeId node, uint8_t what) {
+            if (node >= events.size()) return;
+            events[node] |= what;
+            if (what & ENTERED) player = node;
+        }
+
+        // The events of a turn the player's session played. from is the node the option was
+        // taken in (NO_NODE for start()): its actions happened there, the on enter actions in
+        // the node the turn arrived in.
+        void notify(STORY::NodeId from, const SESSION::TurnResult& turn) {
+            if (turn.status != SESSION::OK || turn.node == STORY::NO_NODE) return;
+            if (from != STORY::NO_NODE) notify(from, happened(turn.optionActions));
+            notify(turn.node, ENTERED | happened(turn.enterActions));
+        }
+
+        // One turn: every NPC acts, then presence is rebuilt
+        void tick() {
+            size_t count = position.size();
+            size_t chunks = (count + CHUNK - 1) / CHUNK;
+            behaviorOf.resize(kinds.size());
+            periodOf.resize(kinds.size());
+            for (size_t k = 0; k < kinds.size(); ++k) {
+                behaviorOf[k] = kinds[k].behavior;
+                periodOf[k] = kinds[k].period;
+            }
+            // NPCs are bucketed by node and kind within the node, so a node's NPCs and the
+            // ones of a kind in it are both one slice
+            size_t kindCount = kinds.size();
+            size_t buckets = story->nodes.size * kindCount;
+
+            pool.run(chunks, [&](size_t chunk) {
+                NpcId first = static_cast<NpcId>(chunk * CHUNK);
+                NpcId last = static_cast<NpcId>(std::min(count, (chunk + 1) * CHUNK));
+                for (NpcId id = first; id < last; ++id) act(id);
+            });
+
+            // Counted in runs of at least `buckets` NPCs, so the counters of all runs together
+            // are never more than NPCs + buckets
+            size_t run = std::max<size_t>(CHUNK, buckets);
+            size_t runs = (count + run - 1) / run;
+            runCounts.assign(runs * buckets, 0);
+            pool.run(runs, [&](size_t r) {
+                NpcId first = static_cast<NpcId>(r * run);
+                NpcId last = static_cast<NpcId>(std::min(count, (r + 1) * run));
+                uint32_t* counts = runCounts.data() + r * buckets;
+                for (NpcId id = first; id < last; ++id) ++counts[position[id] * kindCount + kindIds[id]];
+            });
+
+            // bucket b's NPCs start after every earlier bucket's, run r's after earlier runs'
+            bucketStart.resize(buckets + 1);
+            uint32_t offset = 0;
+            for (size_t b = 0; b < buckets; ++b) {
+                bucketStart[b] = offset;
+                for (size_t r = 0; r < runs; ++r) {
+                    uint32_t here = runCounts[r * buckets + b];
+                    runCounts[r * buckets + b] = offset;
+                    offset += here;
+                }
+            }
+            bucketStart[buckets] = offset;
+            byNode.resize(count);
+
+            pool.run(runs, [&](size_t r) {
+                NpcId first = static_cast<NpcId>(r * run);
+                NpcId last = static_cast<NpcId>(std::min(count, (r + 1) * run));
+                uint32_t* cursor = runCounts.data() + r * buckets;
+                for (NpcId id = first; id < last; ++id) byNode[cursor[position[id] * kindCount + kindIds[id]]++] = id;
+            });
+            tickedKinds = kindCount;
+
+            std::fill(events.begin(), events.end(), 0);
+            ++turns;
+        }
+
+        // The NPCs in node as of the last tick, grouped by kind, in id order within a kind
+        Span present(STORY::NodeId node) const {
+            if (node >= story->nodes.size || byNode.empty()) return Span();
+            return slice(node * tickedKinds, (node + 1) * tickedKinds);
+        }
+
+        // The NPCs of kind in node as of the last tick
+        Span present(STORY::NodeId node, KindId kind) const {
+            if (node >= story->nodes.size || kind >= tickedKinds || byNode.empty()) return Span();
+            size_t bucket = node * tickedKinds + kind;
+            return slice(bucket, bucket + 1);
+        }
+
+        uint32_t count(STORY::NodeId node) const { return present(node).size; }
+        uint32_t count(STORY::NodeId node, KindId kind) const { return present(node, kind).size; }
+
+        // Clears bit i of out (the node's option availability words) for every option i a
+        // rule turns off right now
+        void available(STORY::NodeId node, uint64_t* out) const {
+            const STORY::NodeRecord& record = story->node(node);
+            for (const Rule& rule : rules) {
+                if (rule.option < record.firstOption || rule.option >= record.firstOption + record.optionCount) continue;
+                if ((count(node, rule.kind) != 0) == rule.present) continue;
+                uint32_t i = rule.option - record.firstOption;
+                out[i >> 6] &= ~(uint64_t(1) << (i & 63));
+            }
+        }
+
+        // Whether the rules let the player take option index of node right now
+        bool allows(STORY::NodeId node, uint32_t index) const {
+            uint32_t option = story->node(node).firstOption + index;
+            for (const Rule& rule : rules) {
+                if (rule.option == option && (count(node, rule.kind) != 0) != rule.present) return false;
+            }
+            return true;
+        }
+
+        uint64_t turnCount() const { return turns; }
+        size_t threads() const { return pool.threads(); }
+
+    private:
+        static const uint32_t NO_BIT = 0xFFFFFFFF;
+
+        static uint8_t happened(const SESSION::ActionReports& reports) {
+            uint8_t what = 0;
+            for (const SESSION::ActionReport& report : reports) {
+                if (report.result == ACTION::PICKED_UP) what |= PICKED_UP;
+                if (report.result == ACTION::USED) what |= USED;
+            }
+            return what;
+        }
+
+        Span slice(size_t firstBucket, size_t lastBucket) const {
+            Span span;
+            span.data = byNode.data() + bucketStart[firstBucket];
+            span.size = bucketStart[lastBucket] - bucketStart[firstBucket];
+            return span;
+        }
+
+        uint32_t bitFor(INVENTORY::ItemId item) const {
+            return item < bitOf.size() ? bitOf[item] : NO_BIT;
+        }
+
+        // xorshift32
+        uint32_t draw(NpcId id) {
+            uint32_t x = random[id];
+            x ^= x << 13;
+            x ^= x >> 17;
+            x ^= x << 5;
+            random[id] = x;
+            return x;
+        }
+
+        void moveRandomly(NpcId id) {
+            const STORY::NodeRecord& record = story->node(position[id]);
+            if (record.optionCount == 0) return;
+            position[id] = story->options[record.firstOption + draw(id) % record.optionCount].next;
+        }
+
+        void act(NpcId id) {
+            STORY::NodeId here = position[id];
+            uint8_t happened = events[here];
+            KindId kind = kindIds[id];
+            bool due = --timer[id] == 0;
+            if (due) timer[id] = periodOf[kind];
+
+            switch (behaviorOf[kind]) {
+                case IDLE:
+                    break;
+                case WANDER:
+                    if (due) moveRandomly(id);
+                    break;
+                case FOLLOW: {
+                    if (player == STORY::NO_NODE || player == here) break;
+                    const STORY::NodeRecord& record = story->node(here);
+                    for (uint32_t i = 0; i < record.optionCount; ++i) {
+                        if (story->options[record.firstOption + i].next == player) {
+                            position[id] = player;
+                            break;
+                        }
+                    }
+                    break;
+                }
+                case SHY:
+                    if (happened & ENTERED) moveRandomly(id);
+                    break;
+                case GUARD:
+                    if (happened & (PICKED_UP | USED)) {
+                        mood[id] = ALERT;
+                        timer[id] = periodOf[kind];
+                    } else if (due) {
+                        mood[id] = CALM;
+                    }
+                    break;
+            }
+        }
+
+        const STORY::Story* story;
+        std::vector<Kind> kinds;
+        std::vector<Rule> rules;
+
+        // per NPC
+        std::vector<STORY::NodeId> position;
+        std::vector<KindId> kindIds;
+        std::vector<uint8_t> mood;
+        std::vector<uint16_t> timer;
+        std::vector<uint32_t> random;
+        std::vector<uint64_t> items; // words per NPC
+        size_t words = 0;
+        std::vector<uint32_t> bitOf; // item id -> catalog bit
+
+        // per node
+        std::vector<uint8_t> events; // since the last tick
+        std::vector<uint32_t> bucketStart; // by node * kinds + kind
+        size_t tickedKinds = 0;            // kinds at the last tick
+        std::vector<NpcId> byNode;
+        STORY::NodeId player = STORY::NO_NODE;
+
+        // tick scratch
+        std::vector<BEHAVIOR> behaviorOf; // by kind
+        std::vector<uint16_t> periodOf;
+        std::vector<uint32_t> runCounts; // run major, bucket counts then write cursors
+        uint64_t turns = 0;
+        detail::Pool pool;
+    };
+
+    // "You see: Drone x2, Guard (alert)." for the NPCs in node, nothing if there are none
+    inline void describe(OUTPUT::Buffer& out, const World& world, STORY::NodeId node) {
+        Span here = world.present(node);
+        if (here.size == 0) return;
+        std::vector<uint32_t> calm(world.kindCount(), 0);
+        std::vector<uint32_t> alert(world.kindCount(), 0);
+        for (NpcId id : here) {
+            (world.moodOf(id) == ALERT ? alert : calm)[world.kindOf(id)]++;
+        }
+        out << "\nYou see: ";
+        const char* separator = "";
+        for (size_t k = 0; k < world.kindCount(); ++k) {
+            for (int alerted = 0; alerted < 2; ++alerted) {
+                uint32_t n = alerted ? alert[k] : calm[k];
+                if (n == 0) continue;
+                out << separator << world.kind(static_cast<KindId>(k)).name;
+                if (n > 1) out << " x" << n;
+                if (alerted) out << " (alert)";
+                separator = ", ";
+            }
+        }
+        out << ".\n";
+    }
+}
+
+#endif
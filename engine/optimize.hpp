@@ -0,0 +1,294 @@
+#ifndef OPTIMIZE_HPP
+#define OPTIMIZE_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "action.hpp"
+#include "inventory.hpp"
+#include "nodes.hpp"
+#include "story.hpp"
+#include "text.hpp"
+
+namespace OPTIMIZE {
+    // A pass over an authored NODE graph that gives back a smaller graph players cannot tell
+    // apart from it, except for the prompts it saves. The source graph is not changed.
+    //
+    //  - Duplicates: nodes with the same text, key, on enter action and effect and the same
+    //    options leading to nodes that are duplicates of each other (cycles included) become
+    //    one node. Found by partition refinement: nodes start out grouped by what they show
+    //    and do, and groups are split by where their options lead until nothing splits.
+    //  - Chains: a node that does nothing on enter and has one plain option (no action,
+    //    condition or effect) is folded into the node that option leads to, when nothing
+    //    else leads there. The merged node shows both texts and does what the second did,
+    //    the player no longer has to pick the one way on.
+    //
+    // The new graph is built in BFS order from the root, the order STORY::compile numbers
+    // nodes in. Node ids change, so place NPCs and take saves on the optimized story. Named
+    // nodes (NODE::Node::setKey) keep their names, a chain takes the name of its first named
+    // node, so RELOAD finds them in the optimized version.
+
+    struct Options {
+        bool mergeDuplicates = true;
+        bool collapseChains = true;
+    };
+
+    struct Report {
+        size_t nodesBefore = 0;  // reachable from the root
+        size_t nodesAfter = 0;
+        size_t edgesBefore = 0;  // options
+        size_t edgesAfter = 0;
+        size_t bytesBefore = 0;  // of the compiled story, see storyBytes
+        size_t bytesAfter = 0;
+        size_t duplicates = 0;   // nodes merged into an identical one
+        size_t chained = 0;      // nodes folded into the node before them
+        size_t rounds = 0;       // refinement rounds of the duplicate search
+    };
+
+    // Bytes of a compiled story's arrays and text
+    inline size_t storyBytes(const STORY::Story& story) {
+        return story.nodes.size * sizeof(STORY::NodeRecord) + story.options.size * sizeof(STORY::OptionRecord)
+               + story.actions.size * sizeof(ACTION::Operands) + story.pickups.size * sizeof(INVENTORY::ItemId)
+               + story.items.size * sizeof(INVENTORY::ItemId) + story.code.size * sizeof(SCRIPT::Instr)
+               + story.variables.size * sizeof(STORY::TextRef) + story.chapters.size * sizeof(STORY::ChapterRecord)
+               + story.keys.size * sizeof(uint64_t) + story.textPool.size();
+    }
+
+    namespace detail {
+        static const uint32_t NO_INDEX = 0xFFFFFFFFu;
+
+        // One node of the graph being optimized. body is the source node whose on enter and
+        // options it has (the last one of a chain), next the node each option leads to.
+        // Text is interned like all node text.
+        struct Work {
+            const NODE::Node* body = nullptr;
+            std::string_view text;
+            std::string_view key;
+            std::vector<uint32_t> next;
+            bool alive = true;
+        };
+
+        inline void putWord(std::string& out, uint32_t word) { out.append(reinterpret_cast<const char*>(&word), sizeof(word)); }
+
+        // Node and option text is interned (TEXT::pool), the same text is the same pointer
+        inline void putText(std::string& out, std::string_view text) {
+            const char* data = text.data();
+            out.append(reinterpret_cast<const char*>(&data), sizeof(data));
+            putWord(out, static_cast<uint32_t>(text.size()));
+        }
+
+        inline void putAction(std::string& out, const ACTION::Action& action, const INVENTORY::ItemVec& items, const INVENTORY::Item& useItem) {
+            putWord(out, action.type);
+            if (action.type == ACTION::NONE) return;
+            putWord(out, action.count);
+            putWord(out, useItem.id);
+            putWord(out, static_cast<uint32_t>(items.size()));
+            for (const auto& item : items) putWord(out, item.id);
+        }
+
+        // Everything about a node but where its options lead
+        inline void signature(std::string& out, const Work& work) {
+            const NODE::Node& body = *work.body;
+            out.clear();
+            putText(out, work.text);
+            putText(out, work.key);
+            putAction(out, body.onEnterAction, body.onEnterPickupItems, body.onEnterUseItem);
+            putText(out, body.onEnterEffect);
+            putWord(out, static_cast<uint32_t>(body.options.size()));
+            for (const NODE::Option& option : body.options) {
+                putText(out, option.text);
+                putAction(out, option.useAction, option.pickupItems, option.useItem);
+                putText(out, option.condition);
+                putText(out, option.effect);
+            }
+        }
+
+        // Nothing on enter, one way on that cannot fail or do anything
+        inline bool passThrough(const Work& work) {
+            const NODE::Node& body = *work.body;
+            if (body.onEnterAction.type != ACTION::NONE || !body.onEnterEffect.empty() || body.options.size() != 1) return false;
+            const NODE::Option& option = body.options[0];
+            return option.useAction.type == ACTION::NONE && option.condition.empty() && option.effect.empty();
+        }
+
+        // Nodes reachable from root in BFS order, every node's options as indices into it
+        inline std::vector<Work> load(const NODE::NodePtr& root, size_t& edges) {
+            std::unordered_map<const NODE::Node*, uint32_t> ids;
+            std::vector<const NODE::Node*> order;
+            ids.emplace(root.get(), 0);
+            order.push_back(root.get());
+            for (size_t i = 0; i < order.size(); ++i) {
+                for (const auto& next : order[i]->nextNodes) {
+                    if (ids.emplace(next.get(), static_cast<uint32_t>(order.size())).second) order.push_back(next.get());
+                }
+            }
+            std::vector<Work> graph(order.size());
+            edges = 0;
+            for (size_t i = 0; i < order.size(); ++i) {
+                graph[i].body = order[i];
+                graph[i].text = order[i]->text;
+                graph[i].key = order[i]->key;
+                for (const auto& next : order[i]->nextNodes) graph[i].next.push_back(ids[next.get()]);
+                edges += graph[i].next.size();
+            }
+            return graph;
+        }
+
+        // Points every option at the first node of its duplicate class, returns how many
+        // nodes that leaves unused
+        inline size_t mergeDuplicates(std::vector<Work>& graph, size_t& rounds) {
+            std::vector<uint32_t> live;
+            for (uint32_t i = 0; i < graph.size(); ++i) {
+                if (graph[i].alive) live.push_back(i);
+            }
+            std::vector<uint32_t> cls(graph.size(), NO_INDEX);
+            std::unordered_map<std::string, uint32_t> classes;
+            std::string key;
+            for (uint32_t i : live) {
+                signature(key, graph[i]);
+                cls[i] = classes.emplace(key, static_cast<uint32_t>(classes.size())).first->second;
+            }
+            size_t count = classes.size();
+
+            // Every round splits the groups whose nodes lead to different groups. A node
+            // alone in its group stays alone, so only the others are sorted by (group, groups
+            // their options lead to) and every run after a group's first becomes a new group.
+            auto leadsBefore = [&](uint32_t a, uint32_t b) {
+                if (cls[a] != cls[b]) return cls[a] < cls[b];
+                const std::vector<uint32_t>& x = graph[a].next;
+                const std::vector<uint32_t>& y = graph[b].next;
+                if (x.size() != y.size()) return x.size() < y.size();
+                for (size_t o = 0; o < x.size(); ++o) {
+                    if (cls[x[o]] != cls[y[o]]) return cls[x[o]] < cls[y[o]];
+                }
+                return false;
+            };
+            std::vector<uint32_t> members(count);
+            std::vector<uint32_t> shared;
+            std::vector<uint32_t> refined;
+            while (true) {
+                ++rounds;
+                std::fill(members.begin(), members.end(), 0);
+                for (uint32_t i : live) ++members[cls[i]];
+                shared.clear();
+                for (uint32_t i : live) {
+                    if (members[cls[i]] > 1) shared.push_back(i);
+                }
+                std::sort(shared.begin(), shared.end(), leadsBefore);
+                refined.resize(shared.size());
+                size_t split = count;
+                for (size_t k = 0; k < shared.size(); ++k) {
+                    if (k == 0 || !leadsBefore(shared[k - 1], shared[k])) refined[k] = k ? refined[k - 1] : cls[shared[k]];
+                    else if (cls[shared[k - 1]] != cls[shared[k]]) refined[k] = cls[shared[k]];
+                    else refined[k] = static_cast<uint32_t>(count++);
+                }
+                if (count == split) break;
+                for (size_t k = 0; k < shared.size(); ++k) cls[shared[k]] = refined[k];
+                members.resize(count);
+            }
+
+            std::vector<uint32_t> first(count, NO_INDEX);
+            for (uint32_t i : live) {
+                if (first[cls[i]] == NO_INDEX) first[cls[i]] = i; // the root comes first
+            }
+            size_t merged = 0;
+            for (uint32_t i : live) {
+                for (uint32_t& next : graph[i].next) next = first[cls[next]];
+                if (first[cls[i]] != i) {
+                    graph[i].alive = false;
+                    ++merged;
+                }
+            }
+            return merged;
+        }
+
+        // Folds pass-through nodes into the only node they lead to, returns how many went
+        inline size_t collapseChains(std::vector<Work>& graph) {
+            std::vector<uint32_t> incoming(graph.size(), 0);
+            for (const Work& work : graph) {
+                if (!work.alive) continue;
+                for (uint32_t next : work.next) ++incoming[next];
+            }
+            size_t folded = 0;
+            std::string text;
+            for (uint32_t i = 0; i < graph.size(); ++i) {
+                Work& work = graph[i];
+                while (work.alive && passThrough(work)) {
+                    uint32_t next = work.next[0];
+                    if (next == i || next == 0 || incoming[next] != 1) break;
+                    Work& after = graph[next];
+                    text.assign(work.text.data(), work.text.size());
+                    text += "\n\n";
+                    text.append(after.text.data(), after.text.size());
+                    work.text = TEXT::intern(text);
+                    if (work.key.empty()) work.key = after.key;
+                    work.body = after.body;
+                    work.next.swap(after.next);
+                    after.alive = false;
+                    ++folded;
+                }
+            }
+            return folded;
+        }
+
+        // The NODE graph of what is left, built breadth first from the root
+        inline NODE::NodePtr rebuild(const std::vector<Work>& graph, size_t& nodes, size_t& edges) {
+            std::vector<NODE::NodePtr> built(graph.size());
+            std::vector<uint32_t> order;
+            auto create = [&](uint32_t i) {
+                const Work& work = graph[i];
+                const NODE::Node& body = *work.body;
+                built[i] = NODE::createNode(work.text, body.onEnterAction, body.onEnterUseItem, body.onEnterPickupItems, body.onEnterEffect);
+                if (!work.key.empty()) built[i]->setKey(work.key);
+                order.push_back(i);
+            };
+            create(0);
+            edges = 0;
+            for (size_t at = 0; at < order.size(); ++at) {
+                const Work& work = graph[order[at]];
+                for (size_t o = 0; o < work.next.size(); ++o) {
+                    uint32_t next = work.next[o];
+                    if (!built[next]) create(next);
+                    built[order[at]]->addNextNode(built[next], work.body->options[o]);
+                    ++edges;
+                }
+            }
+            nodes = order.size();
+            return built[0];
+        }
+    }
+
+    // The optimized copy of the graph under root. report (if given) gets what it saved; its
+    // byte counts compile both graphs, a story whose scripts do not compile counts 0.
+    inline NODE::NodePtr optimize(const NODE::NodePtr& root, Report* report = nullptr, Options options = Options()) {
+        Report local;
+        Report& result = report ? *report : local;
+        result = Report();
+        if (!root) return root;
+
+        std::vector<detail::Work> graph = detail::load(root, result.edgesBefore);
+        result.nodesBefore = graph.size();
+        // merging first can leave a chain's next node with one way in, collapsing can make
+        // new duplicates
+        if (options.mergeDuplicates) result.duplicates += detail::mergeDuplicates(graph, result.rounds);
+        if (options.collapseChains) {
+            size_t folded = detail::collapseChains(graph);
+            result.chained += folded;
+            if (folded && options.mergeDuplicates) result.duplicates += detail::mergeDuplicates(graph, result.rounds);
+        }
+        NODE::NodePtr optimized = detail::rebuild(graph, result.nodesAfter, result.edgesAfter);
+
+        if (report) {
+            std::string error;
+            result.bytesBefore = storyBytes(STORY::compile(root, nullptr, &error));
+            result.bytesAfter = storyBytes(STORY::compile(optimized, nullptr, &error));
+        }
+        return optimized;
+    }
+}
+
+#endif
@@ -0,0 +1,216 @@
+#ifndef OUTPUT_HPP
+#define OUTPUT_HPP
+
+#include <memory_resource>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <ostream>
+#include <charconv>
+#include <algorithm>
+#include <cstdint>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/uio.h>
+#include <unistd.h>
+#include <cerrno>
+#include <climits>
+#define OUTPUT_WRITEV 1
+#endif
+
+namespace OUTPUT {
+    // A whole turn is rendered into a Buffer and handed to a Sink in one flush. The buffer
+    // keeps its capacity between turns, so after the first few turns rendering does not
+    // allocate. Long story text is not copied: it is referenced in place (the story outlives
+    // the flush) and the pieces go out together, as one writev for file descriptors.
+
+    class Buffer {
+    public:
+        struct Piece {
+            const char* data; // nullptr: the piece lives in the buffer's own bytes at offset
+            size_t offset;
+            size_t length;
+        };
+
+        // Text at least this long is referenced instead of copied
+        static const size_t REFERENCE_THRESHOLD = 64;
+
+        Buffer() = default;
+        // A buffer whose bytes live in memory (a session's MEMORY::Arena, say)
+        explicit Buffer(std::pmr::memory_resource* memory) : bytes(memory), pieces(memory) {}
+
+        void append(std::string_view text) {
+            if (text.empty()) return;
+            size_t offset = bytes.size();
+            bytes.append(text.data(), text.size());
+            addOwned(offset, text.size());
+        }
+
+        void append(char c, size_t count = 1) {
+            if (count == 0) return;
+            size_t offset = bytes.size();
+            bytes.append(count, c);
+            addOwned(offset, count);
+        }
+
+        template<typename T>
+        void appendNumber(T value) {
+            char digits[24];
+            auto end = std::to_chars(digits, digits + sizeof(digits), value).ptr;
+            append(std::string_view(digits, static_cast<size_t>(end - digits)));
+        }
+
+        // For text that stays alive until the next flush (story text), long text is not copied
+        void appendRef(std::string_view text) {
+            if (text.size() < REFERENCE_THRESHOLD) {
+                append(text);
+                return;
+            }
+            pieces.push_back(Piece{ text.data(), 0, text.size() });
+            total += text.size();
+        }
+
+        Buffer& operator<<(std::string_view text) { append(text); return *this; }
+        Buffer& operator<<(const char* text) { append(std::string_view(text)); return *this; }
+        Buffer& operator<<(const std::string& text) { append(std::string_view(text)); return *this; }
+        Buffer& operator<<(char c) { append(c); return *this; }
+        Buffer& operator<<(int value) { appendNumber(value); return *this; }
+        Buffer& operator<<(long value) { appendNumber(value); return *this; }
+        Buffer& operator<<(long long value) { appendNumber(value); return *this; }
+        Buffer& operator<<(unsigned value) { appendNumber(value); return *this; }
+        Buffer& operator<<(unsigned long value) { appendNumber(value); return *this; }
+        Buffer& operator<<(unsigned long long value) { appendNumber(value); return *this; }
+
+        // Drops the content, keeps the capacity
+        void clear() {
+            bytes.clear();
+            pieces.clear();
+            total = 0;
+        }
+
+        bool empty() const { return total == 0; }
+        size_t size() const { return total; }
+        size_t pieceCount() const { return pieces.size(); }
+
+        std::string_view piece(size_t index) const {
+            const Piece& p = pieces[index];
+            return std::string_view(p.data ? p.data : bytes.data() + p.offset, p.length);
+        }
+
+        // Copies everything into one string (tests, captures)
+        template<typename String>
+        void appendTo(String& out) const {
+            for (size_t i = 0; i < pieces.size(); ++i) {
+                std::string_view text = piece(i);
+                out.append(text.data(), text.size());
+            }
+        }
+
+    private:
+        void addOwned(size_t offset, size_t length) {
+            total += length;
+            // contiguous with the last owned piece: grow it instead of adding one
+            if (!pieces.empty() && pieces.back().data == nullptr && pieces.back().offset + pieces.back().length == offset) {
+                pieces.back().length += length;
+                return;
+            }
+            pieces.push_back(Piece{ nullptr, offset, length });
+        }
+
+        std::pmr::string bytes;
+        std::pmr::vector<Piece> pieces;
+        size_t total = 0;
+    };
+
+    // Where rendered turns go
+    class Sink {
+    public:
+        virtual ~Sink() = default;
+        virtual bool write(const Buffer& buffer) = 0;
+    };
+
+    // Discards everything (benchmarks)
+    class NullSink : public Sink {
+    public:
+        bool write(const Buffer& buffer) override {
+            bytes += buffer.size();
+            return true;
+        }
+
+        uint64_t bytes = 0; // total that would have been written
+    };
+
+    // Keeps everything in memory (tests)
+    class MemorySink : public Sink {
+    public:
+        bool write(const Buffer& buffer) override {
+            buffer.appendTo(text);
+            return true;
+        }
+
+        std::string text;
+    };
+
+    // Any std::ostream (std::cout by default), flushed once per write
+    class StreamSink : public Sink {
+    public:
+        explicit StreamSink(std::ostream& stream) : stream(stream) {}
+
+        bool write(const Buffer& buffer) override {
+            for (size_t i = 0; i < buffer.pieceCount(); ++i) {
+                std::string_view text = buffer.piece(i);
+                stream.write(text.data(), static_cast<std::streamsize>(text.size()));
+            }
+            stream.flush();
+            return static_cast<bool>(stream);
+        }
+
+    private:
+        std::ostream& stream;
+    };
+
+#ifdef OUTPUT_WRITEV
+    // A file descriptor (stdout, a file, a blocking socket): every flush is one writev
+    // unless the kernel takes it partially.
+    class FdSink : public Sink {
+    public:
+        explicit FdSink(int fd) : fd(fd) {}
+
+        bool write(const Buffer& buffer) override {
+            iov.resize(buffer.pieceCount());
+            for (size_t i = 0; i < buffer.pieceCount(); ++i) {
+                std::string_view text = buffer.piece(i);
+                iov[i].iov_base = const_cast<char*>(text.data());
+                iov[i].iov_len = text.size();
+            }
+
+            size_t first = 0;
+            while (first < iov.size()) {
+                int count = static_cast<int>(std::min<size_t>(iov.size() - first, IOV_MAX));
+                ssize_t written = ::writev(fd, iov.data() + first, count);
+                if (written < 0) {
+                    if (errno == EINTR) continue;
+                    return false;
+                }
+                // skip what went out, partial writes resume mid piece
+                size_t left = static_cast<size_t>(written);
+                while (first < iov.size() && left >= iov[first].iov_len) {
+                    left -= iov[first].iov_len;
+                    ++first;
+                }
+                if (left > 0) {
+                    iov[first].iov_base = static_cast<char*>(iov[first].iov_base) + left;
+                    iov[first].iov_len -= left;
+                }
+            }
+            return true;
+        }
+
+    private:
+        int fd;
+        std::vector<iovec> iov; // reused between flushes
+    };
+#endif
+}
+
+#endif
@@ -0,0 +1,489 @@
+#ifndef PARSER_HPP
+#define PARSER_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "action.hpp"
+#include "inventory.hpp"
+#include "output.hpp"
+#include "story.hpp"
+
+namespace PARSER {
+    // Typed commands ("take prybar", "use power cell", "examine the panel") resolved against
+    // the options of the current node. A Lexicon is built once per story: every word of
+    // the option texts, the item names, the verbs and their synonyms go into one trie, and
+    // every option gets the sorted set of words it answers to (its text, the items its
+    // actions and its target's on enter actions move, its verbs). match() then only walks
+    // the trie once per word and scores the node's few options; it does not allocate.
+
+    static const uint32_t NO_WORD = 0xFFFFFFFFu; // Lexicon::find found nothing
+
+    enum VERB : uint8_t {
+        NO_VERB,
+        TAKE,
+        USE,
+        GO,
+        LOOK,
+        // commands, not options
+        INVENTORY,
+        QUIT,
+        SAVE,
+        UNDO
+    };
+
+    enum STATUS {
+        MATCHED,      // option is the one
+        COMMAND,      // command is INVENTORY, QUIT, SAVE or UNDO
+        AMBIGUOUS,    // more than one option fits as well, see tied
+        NO_MATCH,     // known words, no option fits
+        UNKNOWN_WORD, // no option fits and word is not in the lexicon
+        EMPTY         // nothing but spaces and little words
+    };
+
+    struct Result {
+        STATUS status = EMPTY;
+        uint32_t option = 0;     // MATCHED: 0-based index in the node
+        VERB command = NO_VERB;  // COMMAND
+        uint64_t tied = 0;       // AMBIGUOUS: bit i for option i (the first 64)
+        std::string_view word;   // UNKNOWN_WORD: points into the input
+    };
+
+    // The number protocol's value for a result: option + 1, or -1 to -4 for the commands.
+    // 0 when the result is not something to do.
+    inline int choice(const Result& result) {
+        if (result.status == MATCHED) return static_cast<int>(result.option) + 1;
+        if (result.status != COMMAND) return 0;
+        switch (result.command) {
+            case INVENTORY: return -1;
+            case QUIT: return -2;
+            case SAVE: return -3;
+            case UNDO: return -4;
+            default: return 0;
+        }
+    }
+
+    // What to tell the player when a result is not something to do
+    inline void explain(OUTPUT::Buffer& out, const Result& result) {
+        if (result.status == AMBIGUOUS) {
+            out << "Which one do you mean:";
+            const char* separator = " ";
+            for (uint32_t i = 0; i < 64; ++i) {
+                if (!((result.tied >> i) & 1u)) continue;
+                out << separator << (i + 1);
+                separator = ", ";
+            }
+            out << "?";
+        } else if (result.status == UNKNOWN_WORD) {
+            out << "I don't know the word \"" << result.word << "\".";
+        } else {
+            out << "I don't understand that. Please enter a number or a command: ";
+            return;
+        }
+        out << " Please enter a number or a command: ";
+    }
+
+    // A whole line that is a number, like the console reads it (spaces around are fine)
+    inline bool number(std::string_view line, int& value) {
+        while (!line.empty() && (line.back() == '\r' || line.back() == ' ' || line.back() == '\t')) line.remove_suffix(1);
+        while (!line.empty() && (line.front() == ' ' || line.front() == '\t')) line.remove_prefix(1);
+        if (line.empty() || line.size() > 10) return false;
+        bool negative = line.front() == '-';
+        if (negative) line.remove_prefix(1);
+        if (line.empty()) return false;
+        long result = 0;
+        for (char c : line) {
+            if (c < '0' || c > '9') return false;
+            result = result * 10 + (c - '0');
+        }
+        value = static_cast<int>(negative ? -result : result);
+        return true;
+    }
+
+    namespace detail {
+        inline bool wordChar(char c) {
+            return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9');
+        }
+
+        inline char lower(char c) { return c >= 'A' && c <= 'Z' ? static_cast<char>(c | 0x20) : c; }
+
+        struct Synonyms {
+            VERB verb;
+            const char* words[13];
+        };
+
+        // The first word of a list is the one the others stand for
+        inline const Synonyms* verbs(size_t& count) {
+            static const Synonyms table[] = {
+                { TAKE, { "take", "get", "grab", "pick", "collect", "pocket", "acquire", "obtain" } },
+                { USE, { "use", "insert", "put", "combine", "apply", "attach", "install", "place", "fit" } },
+                { GO, { "go", "walk", "move", "head", "enter", "exit", "leave", "return", "climb", "run", "travel", "proceed" } },
+                { LOOK, { "look", "examine", "inspect", "search", "check", "read", "study", "investigate", "x", "l" } },
+                { INVENTORY, { "inventory", "inv", "i", "items" } },
+                { QUIT, { "quit", "q" } },
+                { SAVE, { "save" } },
+                { UNDO, { "undo" } },
+            };
+            count = sizeof(table) / sizeof(table[0]);
+            return table;
+        }
+
+        // In any case, so typed words can be checked before the lexicon is asked about them
+        inline bool stopWord(std::string_view word) {
+            static const char* const words[] = { "a", "an", "the", "to", "at", "on", "in", "into", "with", "up", "of", "my",
+                                                 "your", "and", "then", "some", "around", "near", "from", "for", "it", "this", "that" };
+            char buffer[6]; // the longest of them
+            if (word.size() > sizeof(buffer)) return false;
+            for (size_t i = 0; i < word.size(); ++i) buffer[i] = lower(word[i]);
+            std::string_view key(buffer, word.size());
+            for (const char* stop : words) {
+                if (key == stop) return true;
+            }
+            return false;
+        }
+    }
+
+    class Lexicon {
+    public:
+        static const size_t MAX_WORDS = 16; // of a command, the rest is ignored
+        static const size_t MIN_PREFIX = 3; // shorter words must be spelled out
+
+        // Makes word mean the same as of ("torch" -> "flashlight", "snag" -> "take"). Call
+        // before build.
+        void addSynonym(std::string_view word, std::string_view of) {
+            synonyms.emplace_back(lowered(word), lowered(of));
+        }
+
+        // Reads the option texts and item names of story. False for streamed stories, whose
+        // text is not in memory: build(story, textOf) pages it in node by node.
+        bool build(const STORY::Story& story, std::string* error = nullptr) {
+            if (story.chapters.size != 0) {
+                if (error) *error = "the story's text is streamed, build the lexicon from its pages";
+                return false;
+            }
+            return build(story, [&](STORY::NodeId) { return &story; });
+        }
+
+        // textOf(node) returns a story whose text() reads node's option refs (a STREAM page),
+        // nullptr leaves the node's options without words
+        template<typename TextOf>
+        bool build(const STORY::Story& story, TextOf&& textOf) {
+            words.clear();
+            wordIds.clear();
+            trie.assign(1, Branch());
+            size_t verbCount = 0;
+            const detail::Synonyms* verbs = detail::verbs(verbCount);
+            for (size_t v = 0; v < verbCount; ++v) {
+                uint32_t head = add(verbs[v].words[0]);
+                for (const char* const* word = verbs[v].words; word != std::end(verbs[v].words) && *word; ++word) {
+                    uint32_t id = add(*word);
+                    words[id].canonical = head;
+                    words[id].verb = verbs[v].verb;
+                }
+            }
+
+            // every option's words: its text, the items it and its target move, its verbs
+            options.assign(story.options.size, OptionWords());
+            optionWords.clear();
+            std::vector<uint32_t> set;
+            for (STORY::NodeId node = 0; node < story.nodes.size; ++node) {
+                const STORY::NodeRecord& record = story.node(node);
+                const STORY::Story* text = record.optionCount ? textOf(node) : nullptr;
+                for (uint32_t i = 0; i < record.optionCount && text; ++i) {
+                    const STORY::OptionRecord& option = story.option(node, i);
+                    OptionWords& entry = options[record.firstOption + i];
+                    set.clear();
+                    forEachWord(text->text(option.text), [&](std::string_view word) { set.push_back(add(word)); });
+                    auto addActions = [&](STORY::ActionRange range) {
+                        const ACTION::Operands* list = story.actionList(range);
+                        for (uint32_t a = 0; a < range.count; ++a) {
+                            const INVENTORY::ItemId* items = story.pickupItems(list[a]);
+                            if (list[a].opcode == ACTION::PICKUP) {
+                                entry.verbs |= bit(TAKE);
+                                for (uint32_t k = 0; k < list[a].itemCount; ++k) addItem(items[k], set);
+                            } else if (list[a].opcode == ACTION::USE) {
+                                entry.verbs |= bit(USE);
+                                entry.useItem = list[a].item;
+                                addItem(list[a].item, set);
+                            }
+                        }
+                    };
+                    addActions(option.actions);
+                    if (option.next != STORY::NO_NODE) addActions(story.node(option.next).actions);
+                    entry.first = static_cast<uint32_t>(optionWords.size());
+                    for (uint32_t id : set) {
+                        if (!words[id].stop) optionWords.push_back(id);
+                    }
+                    entry.count = static_cast<uint32_t>(optionWords.size()) - entry.first;
+                }
+            }
+            for (const auto& synonym : synonyms) {
+                uint32_t of = add(synonym.second);
+                uint32_t id = add(synonym.first);
+                words[id].canonical = words[of].canonical;
+                words[id].verb = words[of].verb;
+            }
+            // an option answers to its words as written and to what they stand for
+            size_t written = optionWords.size();
+            std::vector<uint32_t> all;
+            all.reserve(written * 2);
+            for (OptionWords& entry : options) {
+                uint32_t first = static_cast<uint32_t>(all.size());
+                for (uint32_t w = 0; w < entry.count; ++w) {
+                    uint32_t id = optionWords[entry.first + w];
+                    all.push_back(id);
+                    if (words[id].canonical != id) all.push_back(words[id].canonical);
+                }
+                entry.first = first;
+                entry.count = static_cast<uint32_t>(all.size()) - first;
+            }
+            optionWords.swap(all);
+            for (OptionWords& entry : options) {
+                uint32_t* first = optionWords.data() + entry.first;
+                std::sort(first, first + entry.count);
+                entry.count = static_cast<uint32_t>(std::unique(first, first + entry.count) - first);
+                for (uint32_t w = 0; w < entry.count; ++w) entry.verbs |= bit(words[first[w]].verb);
+                entry.verbs &= ~bit(NO_VERB);
+                if (entry.verbs == 0) entry.verbs = bit(GO); // plain options move the player
+            }
+            flatten();
+            wordIds.clear();
+            return true;
+        }
+
+        // Resolves one line of input against node's options. inventory (optional) breaks
+        // ties toward options that use an item the player holds.
+        Result match(const STORY::Story& story, STORY::NodeId node, std::string_view input,
+                     const INVENTORY::Inventory* inventory = nullptr) const {
+            Result result;
+            uint32_t tokens[MAX_WORDS];  // what the words stand for
+            uint32_t written[MAX_WORDS]; // the words as typed
+            size_t count = 0;
+            uint32_t verbs = 0;
+            std::string_view unknown;
+            size_t i = 0;
+            while (i < input.size() && count < MAX_WORDS) {
+                while (i < input.size() && !detail::wordChar(input[i])) ++i;
+                size_t start = i;
+                while (i < input.size() && detail::wordChar(input[i])) ++i;
+                if (start == i) break;
+                std::string_view spelling = input.substr(start, i - start);
+                if (detail::stopWord(spelling)) continue; // whether or not the story uses it, and never as a prefix
+                uint32_t id = find(spelling);
+                if (id == NO_WORD) {
+                    if (unknown.empty()) unknown = spelling;
+                    continue;
+                }
+                const Word& word = words[id];
+                if (word.stop) continue;
+                written[count] = id;
+                tokens[count++] = word.canonical;
+                if (word.verb != NO_VERB) verbs |= bit(word.verb);
+            }
+            if (count == 0) {
+                result.status = unknown.empty() ? EMPTY : UNKNOWN_WORD;
+                result.word = unknown;
+                return result;
+            }
+            if (count == 1 && unknown.empty() && words[tokens[0]].verb >= INVENTORY) {
+                result.status = COMMAND;
+                result.command = words[tokens[0]].verb;
+                return result;
+            }
+
+            const STORY::NodeRecord& record = story.node(node);
+            int best = 0;
+            for (uint32_t o = 0; o < record.optionCount && record.firstOption + o < options.size(); ++o) {
+                const OptionWords& entry = options[record.firstOption + o];
+                const uint32_t* first = optionWords.data() + entry.first;
+                const uint32_t* last = first + entry.count;
+                int score = 0;
+                for (size_t t = 0; t < count; ++t) {
+                    if (std::binary_search(first, last, tokens[t])) score += 2;
+                    if (written[t] != tokens[t] && std::binary_search(first, last, written[t])) ++score; // the option's own word
+                }
+                for (uint32_t common = verbs & entry.verbs; common != 0; common &= common - 1) ++score;
+                if (score > 0 && entry.useItem != INVENTORY::NO_ITEM && inventory && inventory->hasItem(entry.useItem)) ++score;
+                if (score > best) {
+                    best = score;
+                    result.option = o;
+                    result.tied = 0;
+                }
+                if (score == best && o < 64) result.tied |= uint64_t(1) << o;
+            }
+            if (best == 0) {
+                result.status = unknown.empty() ? NO_MATCH : UNKNOWN_WORD;
+                result.word = unknown;
+                result.tied = 0;
+            } else if ((result.tied & (result.tied - 1)) != 0) {
+                // a word the story does not know is likelier what would have told them apart
+                result.status = unknown.empty() ? AMBIGUOUS : UNKNOWN_WORD;
+                result.word = unknown;
+            } else {
+                result.status = MATCHED;
+                result.tied = 0;
+            }
+            return result;
+        }
+
+        // The word a spelling stands for, NO_WORD if none. A prefix of at least MIN_PREFIX
+        // letters stands for the shortest word it leads to when every other word it leads
+        // to starts with that one ("flash": flashlight, not flashlightcasing).
+        uint32_t find(std::string_view spelling) const {
+            if (trie.empty()) return NO_WORD;
+            uint32_t at = 0;
+            for (char c : spelling) {
+                c = detail::lower(c);
+                const Branch& branch = trie[at];
+                const Edge* edge = edges.data() + branch.firstEdge;
+                const Edge* end = edge + branch.edgeCount;
+                while (edge != end && edge->c != c) ++edge;
+                if (edge == end) return NO_WORD;
+                at = edge->to;
+            }
+            if (trie[at].word != NO_WORD) return trie[at].word;
+            return spelling.size() >= MIN_PREFIX ? trie[at].only : NO_WORD;
+        }
+
+        size_t wordCount() const { return words.size(); }
+        size_t trieSize() const { return trie.size(); }
+
+    private:
+        struct Word {
+            uint32_t canonical = 0;
+            VERB verb = NO_VERB;
+            bool stop = false;
+        };
+
+        struct OptionWords {
+            uint32_t first = 0;
+            uint32_t count = 0;
+            uint32_t verbs = 0; // bit per VERB
+            INVENTORY::ItemId useItem = INVENTORY::NO_ITEM;
+        };
+
+        struct Branch {
+            uint32_t firstEdge = 0;
+            uint32_t edgeCount = 0;
+            uint32_t word = NO_WORD; // spelled out to here
+            uint32_t only = NO_WORD; // the one word below here, if just one
+        };
+
+        struct Edge {
+            char c;
+            uint32_t to;
+        };
+
+        static uint32_t bit(VERB verb) { return uint32_t(1) << verb; }
+
+        static std::string lowered(std::string_view text) {
+            std::string result(text);
+            for (char& c : result) c = detail::lower(c);
+            return result;
+        }
+
+        template<typename OnWord>
+        static void forEachWord(std::string_view text, OnWord&& onWord) {
+            size_t i = 0;
+            while (i < text.size()) {
+                while (i < text.size() && !detail::wordChar(text[i])) ++i;
+                size_t start = i;
+                while (i < text.size() && detail::wordChar(text[i])) ++i;
+                if (start != i) onWord(text.substr(start, i - start));
+            }
+        }
+
+        // "DataPad_CryoLog" answers to datapad, data, pad, cryolog, cryo and log
+        void addItem(INVENTORY::ItemId item, std::vector<uint32_t>& set) {
+            if (item == INVENTORY::NO_ITEM) return;
+            std::string_view name = INVENTORY::itemTable().name(item);
+            forEachWord(name, [&](std::string_view segment) {
+                set.push_back(add(segment));
+                size_t start = 0;
+                for (size_t i = 1; i <= segment.size(); ++i) {
+                    bool split = i == segment.size() ||
+                                 (segment[i] >= 'A' && segment[i] <= 'Z' && segment[i - 1] >= 'a' && segment[i - 1] <= 'z');
+                    if (!split) continue;
+                    if (start != 0 || i != segment.size()) set.push_back(add(segment.substr(start, i - start)));
+                    start = i;
+                }
+            });
+        }
+
+        uint32_t add(std::string_view spelling) {
+            std::string key = lowered(spelling);
+            auto it = wordIds.find(key);
+            if (it != wordIds.end()) return it->second;
+            uint32_t id = static_cast<uint32_t>(words.size());
+            Word word;
+            word.canonical = id;
+            word.stop = detail::stopWord(key);
+            words.push_back(word);
+            wordIds.emplace(key, id);
+            return id;
+        }
+
+        // The trie as flat arrays, every branch's edges together and sorted
+        void flatten() {
+            std::vector<std::map<char, uint32_t>> children(1);
+            std::vector<uint32_t> ends(1, NO_WORD);
+            for (const auto& entry : wordIds) {
+                uint32_t at = 0;
+                for (char c : entry.first) {
+                    auto found = children[at].find(c);
+                    if (found == children[at].end()) {
+                        uint32_t next = static_cast<uint32_t>(children.size());
+                        children[at].emplace(c, next);
+                        children.emplace_back();
+                        ends.push_back(NO_WORD);
+                        at = next;
+                    } else {
+                        at = found->second;
+                    }
+                }
+                ends[at] = entry.second;
+            }
+            trie.assign(children.size(), Branch());
+            edges.clear();
+            for (size_t b = 0; b < children.size(); ++b) {
+                trie[b].firstEdge = static_cast<uint32_t>(edges.size());
+                trie[b].edgeCount = static_cast<uint32_t>(children[b].size());
+                trie[b].word = ends[b];
+                for (const auto& child : children[b]) edges.push_back(Edge{ child.first, child.second });
+            }
+            // children are numbered after their parents, so a backwards pass sees them first
+            std::vector<bool> leads(trie.size(), false); // to any word
+            for (size_t b = trie.size(); b-- > 0;) {
+                if (trie[b].word != NO_WORD) {
+                    trie[b].only = trie[b].word;
+                    leads[b] = true;
+                    continue;
+                }
+                uint32_t ways = 0;
+                for (uint32_t e = 0; e < trie[b].edgeCount; ++e) {
+                    uint32_t child = edges[trie[b].firstEdge + e].to;
+                    if (!leads[child]) continue;
+                    ++ways;
+                    trie[b].only = trie[child].only;
+                }
+                leads[b] = ways != 0;
+                if (ways != 1) trie[b].only = NO_WORD;
+            }
+        }
+
+        std::vector<Word> words;
+        std::vector<OptionWords> options;  // by option index in the story
+        std::vector<uint32_t> optionWords; // sorted canonical word ids, a run per option
+        std::vector<Branch> trie;
+        std::vector<Edge> edges;
+        std::vector<std::pair<std::string, std::string>> synonyms;
+        std::unordered_map<std::string, uint32_t> wordIds; // while building
+    };
+}
+
+#endif
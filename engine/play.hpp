@@ -6,35 +6,96 @@
 #include <vector>
 #include <sstream>
 #include <limits> // Required for std::numeric_limits
+#include <memory>
+#include <algorithm>
+#include <chrono>
 
 #include "action.hpp" // Includes Action and Inventory
 #include "nodes.hpp"  // Includes Node, Option, Action, and Inventory
+#include "story.hpp"  // Compiled, index based story graph
+#include "save.hpp"   // Save games
+#include "session.hpp" // Turn logic, Run only does the input and printing
+#include "output.hpp"  // Turn buffer and sinks
+#include "render.hpp"  // Turn text
+#include "masks.hpp"   // Which options would work
+#include "stream.hpp"  // Stories whose text is paged in from disk
+#include "telemetry.hpp" // Turn counters and the metrics file
+#include "npc.hpp"       // Characters moving around the story
+#include "history.hpp"   // Undo
+#include "memory.hpp"    // The session's arena
+#include "parser.hpp"    // Typed commands
 
 namespace GAME {
 
     class Game {
         private:
             std::string menuName;
+            std::string saveFile = "savegame.tbsav";
+            std::vector<char> pendingLoad; // save game picked in Init, applied when Run knows the story
             bool didExit = false;
+            bool showAvailability = false; // mark options whose action would not work
+            std::string metricsFile; // empty: no telemetry
+            std::chrono::milliseconds metricsPeriod = std::chrono::seconds(10);
+            NPC::World* npcs = nullptr; // ticked once per turn, shown in the node text
+            size_t undoDepth = 0; // turns -4 can take back, 0: no undo
+            bool commands = false; // typed commands besides numbers
+            PARSER::Lexicon lexicon; // of the story that is played, built by Run
+
+            // Everything is rendered into out and written to the sink once per prompt
+            OUTPUT::Buffer out;
+            OUTPUT::Sink* sink = nullptr; // nullptr: std::cout
 
             // Helpers
-            int safeInput(); // More robust input handling
-            void printInv(const INVENTORY::Inventory& inv) const; // Made const
-            void printName() const; // Made const
+            int safeInput(); // More robust input handling, flushes the pending output first
+            void flush();
+            void printInv(const INVENTORY::Inventory& inv);
+            void printName();
+            void play(const STORY::Story& story, INVENTORY::Inventory& inventory, STREAM::Book* book);
 
         public:
             Game(std::string menuName) : menuName(menuName) {} // Member initializer list
             ~Game() = default;
 
+            void setSaveFile(const std::string& path) { saveFile = path; }
+            void setSink(OUTPUT::Sink& output) { sink = &output; }
+            void setShowAvailability(bool show) { showAvailability = show; }
+            // NPCs of the story that is played: they react to the player and move every turn,
+            // nodes list who is there and options can depend on it (NPC::Rule)
+            void setNpcs(NPC::World& world) { npcs = &world; }
+            // Lets the player take back up to depth turns with -4 (0 turns it off). NPCs do
+            // not go back, they keep living in the present.
+            void setUndo(size_t depth) { undoDepth = depth; }
+            // Lets the player type what they do ("take the key") instead of an option number
+            void setCommands(bool on) { commands = on; }
+            // Makes word mean the same as of in typed commands ("torch" -> "flashlight")
+            void addCommandSynonym(std::string_view word, std::string_view of) { lexicon.addSynonym(word, of); }
+            // Counts node entries, picks, actions and turn times while playing and writes them to
+            // path (Prometheus text, JSON for .json) every period and when the game ends
+            void setMetricsFile(const std::string& path, std::chrono::milliseconds period = std::chrono::seconds(10)) {
+                metricsFile = path;
+                metricsPeriod = period;
+            }
+
             void Init();
             void Run(NODE::NodePtr rootNode, INVENTORY::Inventory& inventory);
+            void Run(const STORY::Story& story, INVENTORY::Inventory& inventory);
+            void Run(STREAM::Book& book, INVENTORY::Inventory& inventory);
     };
 
     // Implementation of Game methods
+    void Game::flush() {
+        if (out.empty()) return;
+        static OUTPUT::StreamSink console(std::cout);
+        (sink ? sink : &console)->write(out);
+        out.clear();
+    }
+
     int Game::safeInput() {
+        flush();
         int input;
         while (!(std::cin >> input)) {
-            std::cout << "Invalid input. Please enter a number: ";
+            out << "Invalid input. Please enter a number: ";
+            flush();
             std::cin.clear(); // Clear the error flags
             // Ignore the rest of the invalid input from the buffer
             std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
@@ -44,28 +105,16 @@ namespace GAME {
         return input;
     }
 
-    void Game::printInv(const INVENTORY::Inventory& inv) const {
-        std::cout << "--- INVENTORY ---\n";
-        if (inv.items.empty()) {
-            std::cout << "Inventory is empty.\n";
-        } else {
-            for (size_t i = 0; i < inv.items.size(); ++i) { // Use size_t for loop index
-                std::cout << i + 1 << ". " << inv.items[i].name << "\n"; // Print 1-based index
-            }
-        }
-        std::cout << "-----------------\n";
+    void Game::printInv(const INVENTORY::Inventory& inv) {
+        RENDER::inventory(out, inv);
     }
 
-    void Game::printName() const {
-        std::cout << "+======";
-        for (size_t i = 0; i < menuName.size(); ++i) { // Use size_t for loop index
-            std::cout << "=";
-        }
-        std::cout << "+\n|   " << menuName << "   |\n+";
-        for (size_t i = 0; i < menuName.size(); ++i) { // Use size_t for loop index
-            std::cout << "=";
-        }
-        std::cout << "======+";
+    void Game::printName() {
+        out << "+======";
+        out.append('=', menuName.size());
+        out << "+\n|   " << menuName << "   |\n+";
+        out.append('=', menuName.size());
+        out << "======+";
     }
 
     void Game::Init() {
@@ -74,117 +123,258 @@ namespace GAME {
         while (!done) {
             printName();
 
-            std::cout << "\n1. New Game\n2. Load Game\n3. Quit\n\nEnter your choice: ";
+            out << "\n1. New Game\n2. Load Game\n3. Quit\n\nEnter your choice: ";
             int input = safeInput();
 
             switch (input) {
                 case 1:
                     done = true;
                     break;
-                case 2:
-                    std::cout << "[INFO] Load game not implemented yet.\n";
-                    // * load game here
+                case 2: {
+                    std::string error;
+                    if (SAVE::readFile(saveFile, pendingLoad, &error)) {
+                        done = true;
+                    } else {
+                        pendingLoad.clear();
+                        out << "[INFO] No save game to load (" << error << ").\n\n";
+                    }
                     break;
+                }
                 case 3:
                     didExit = true;
                     done = true;
                     break;
                 default:
-                    std::cout << "\nPlease enter a valid input (1-3).\n\n";
+                    out << "\nPlease enter a valid input (1-3).\n\n";
             }
         }
+        flush();
     }
 
     void Game::Run(NODE::NodePtr rootNode, INVENTORY::Inventory& inventory) {
+        // flatten the graph once, the loop below only walks integer indices
+        std::string error;
+        STORY::Story story = STORY::compile(rootNode, nullptr, &error);
+        if (!error.empty()) {
+            out << "[ERROR] " << error << "\n";
+            flush();
+            return;
+        }
+        Run(story, inventory);
+    }
+
+    void Game::Run(const STORY::Story& story, INVENTORY::Inventory& inventory) {
+        play(story, inventory, nullptr);
+    }
+
+    void Game::Run(STREAM::Book& book, INVENTORY::Inventory& inventory) {
+        play(book.story(), inventory, &book);
+    }
+
+    void Game::play(const STORY::Story& story, INVENTORY::Inventory& inventory, STREAM::Book* book) {
         bool running = true;
 
-        if (didExit) { running = false; }
+        if (didExit || story.nodeCount() == 0) { running = false; }
 
-        if (!didExit) {
-            NODE::NodePtr currentNode = rootNode;
+        if (running) {
+            MEMORY::Arena arena; // the session's state, freed in one go when the game ends
+            SESSION::Session session(story, std::move(inventory), arena.resource());
+            const SESSION::Session& view = session; // reads that must not copy a state the history shares
+            SESSION::TurnResult turn;
+            HISTORY::History history(undoDepth);
 
-            while (running) {
-                std::cout << "\n---------\n" << currentNode->text << "\n";
-
-                // on enter actions
-                if (currentNode->onEnterAction.type != ACTION::TYPE::NONE) {
-                     // Decide the logic for on-enter actions more clearly.
-                     // This current check prevents the action if *any* of the items
-                     // in onEnterPickupItems are already in the inventory.
-                     // Is this the intended behavior?
-                    if (!inventory.hasItems(currentNode->onEnterPickupItems)) {
-                        currentNode->onEnterAction.executeAction(inventory, currentNode->onEnterPickupItems, currentNode->onEnterUseItem);
-                    } else {
-                         // Only print this message if the action *was* a pickup action
-                        if (currentNode->onEnterAction.type == ACTION::TYPE::PICKUP) {
-                            std::cout << "\n[INFO] You already have some of the items trying to be picked up here.\n";
-                        }
-                    }
+            std::unique_ptr<TELEMETRY::Recorder> recorder;
+            std::unique_ptr<TELEMETRY::Exporter> exporter;
+            if (TELEMETRY::ENABLED && !metricsFile.empty()) {
+                recorder.reset(new TELEMETRY::Recorder(story, 1)); // one player, every turn can be timed
+                exporter.reset(new TELEMETRY::Exporter(*recorder, story, metricsFile, metricsPeriod));
+                session.setTelemetry(recorder.get());
+            }
+
+            // availability of the current node's options, only worked out when it is shown.
+            // Options whose condition does not hold are always shown as unavailable.
+            bool scripted = story.code.size != 0;
+            bool npcRules = npcs && npcs->hasRules();
+            std::unique_ptr<MASKS::OptionMasks> masks;
+            std::vector<uint64_t> available;
+            if (showAvailability || scripted || npcRules) {
+                if (showAvailability) masks.reset(new MASKS::OptionMasks(story));
+                uint32_t maxOptions = 0;
+                for (const auto& node : story.nodes) maxOptions = std::max(maxOptions, node.optionCount);
+                available.resize(std::max<size_t>(1, (maxOptions + 63) / 64));
+            }
+            auto availableNow = [&](STORY::NodeId node) -> const uint64_t* {
+                if (!masks && !scripted && !npcRules) return nullptr;
+                size_t count = story.node(node).optionCount;
+                if (masks) {
+                    masks->available(node, view.inventory(), available.data());
+                } else {
+                    std::fill(available.begin(), available.end(), ~uint64_t(0));
+                }
+                for (size_t i = 0; i < count && scripted; ++i) {
+                    if (!session.allowed(i)) available[i >> 6] &= ~(uint64_t(1) << (i & 63));
                 }
+                if (npcRules) npcs->available(node, available.data());
+                return available.data();
+            };
 
-                if (currentNode->isEndNode()) {
-                    std::cout << "\n---------\nEnd of the game.\n";
-                    running = false;
-                    break;
+            // typed commands are matched against the words of every option, collected once
+            if (commands) {
+                STREAM::Page wordsPage;
+                lexicon.build(story, [&](STORY::NodeId node) -> const STORY::Story* {
+                    if (!book) return &story;
+                    std::string error;
+                    return book->page(node, wordsPage, &error) ? &wordsPage.story() : nullptr;
+                });
+            }
+            std::string line;
+            auto readChoice = [&](STORY::NodeId node) -> int {
+                if (!commands) return safeInput();
+                while (true) {
+                    flush();
+                    if (!std::getline(std::cin, line)) return -2; // no more input
+                    int number = 0;
+                    if (PARSER::number(line, number)) return number;
+                    PARSER::Result result = lexicon.match(story, node, line, &view.inventory());
+                    int choice = PARSER::choice(result);
+                    if (choice != 0) return choice;
+                    PARSER::explain(out, result); // and ask again
+                }
+            };
+
+            // the NPCs take their turn after the player's, then the node says who is there
+            OUTPUT::Buffer npcLines;
+            std::string npcText;
+            auto npcTurn = [&](STORY::NodeId from, const SESSION::TurnResult& result) {
+                if (!npcs) return;
+                npcs->notify(from, result);
+                npcs->tick();
+            };
+            auto npcNote = [&](STORY::NodeId node) -> std::string_view {
+                if (!npcs) return {};
+                npcLines.clear();
+                NPC::describe(npcLines, *npcs, node);
+                npcText.clear();
+                npcLines.appendTo(npcText);
+                return npcText;
+            };
+
+            if (!pendingLoad.empty()) {
+                std::string error;
+                STORY::NodeId node;
+                INVENTORY::Inventory loaded;
+                std::pmr::vector<int32_t> variables(session.resource());
+                if (SAVE::readSnapshot(story, pendingLoad.data(), pendingLoad.size(), node, loaded, &error, &variables)) {
+                    // the on enter action of a loaded node already ran before saving
+                    session.restore(node, std::move(loaded), &variables);
+                    turn.node = node;
+                    turn.ended = session.ended();
+                    out << "\n[INFO] Loaded " << saveFile << ".\n";
+                } else {
+                    out << "\n[INFO] Could not load " << saveFile << ": " << error << ". Starting a new game.\n";
+                }
+                pendingLoad.clear();
+            }
+            if (turn.node == STORY::NO_NODE) {
+                turn = session.start();
+            }
+
+            // text of the current node, a streamed book pages it in (and reads ahead) on every entry
+            STREAM::Page page;
+            const STORY::Story* text = &story;
+            auto turnPage = [&](STORY::NodeId node) -> bool {
+                if (!book) return true;
+                std::string error;
+                if (!book->page(node, page, &error)) {
+                    out << "\n[ERROR] " << error << ".\n";
+                    return false;
                 }
+                if (!session.ended()) book->prefetch(node);
+                text = &page.story();
+                return true;
+            };
+
+            if (undoDepth) history.record(session);
+            npcTurn(STORY::NO_NODE, turn);
+            if (turnPage(turn.node)) {
+                RENDER::arrival(out, *text, turn, turn.ended ? nullptr : availableNow(turn.node), npcNote(turn.node));
+            } else {
+                running = false;
+            }
 
-                // print all options
-                for (size_t i = 0; i < currentNode->options.size(); ++i) { // Use size_t
-                    std::cout << i + 1 << ". " << currentNode->options[i].text << "\n"; // Print 1-based index
+            while (running) {
+                if (turn.ended) {
+                    running = false;
+                    break;
                 }
 
-                int input = 0;
+                STORY::NodeId currentNode = turn.node;
                 bool validInput = false;
                 while (!validInput) {
-                    std::cout << "\n(-1 to see inventory, -2 to exit)";
-                    std::cout << "\nEnter your choice: ";
-                    int rawInput = safeInput(); // Use safeInput
+                    RENDER::prompt(out, undoDepth != 0, commands);
+                    int rawInput = readChoice(currentNode);
 
                     if (rawInput == -1) {
-                        std::cout << "\n";
-                        printInv(inventory);
+                        out << "\n";
+                        printInv(view.inventory());
                         // Reprint node text and options after showing inventory
-                        std::cout << "\n---------\n" << currentNode->text << "\n";
-                         for (size_t i = 0; i < currentNode->options.size(); ++i) {
-                            std::cout << i + 1 << ". " << currentNode->options[i].text << "\n";
-                        }
+                        RENDER::node(out, *text, currentNode);
+                        out << npcNote(currentNode);
+                        RENDER::options(out, *text, currentNode, availableNow(currentNode));
                     } else if (rawInput == -2) {
                         running = false;
                         validInput = true; // Exit the input loop
-                    } else {
-                        input = rawInput - 1; // Adjust for 0-based indexing
-                        if (input >= 0 && static_cast<size_t>(input) < currentNode->options.size()) { // Use static_cast
-                            validInput = true; // Valid option selected
+                    } else if (rawInput == -3) {
+                        std::string error;
+                        if (SAVE::saveFile(saveFile, story, currentNode, view.inventory(), &error, &session.variables())) {
+                            out << "\n[INFO] Game saved to " << saveFile << ".\n";
                         } else {
-                            std::cout << "Please enter an existing option number (1 - " << currentNode->options.size() << ").";
+                            out << "\n[INFO] Could not save: " << error << ".\n";
+                        }
+                    } else if (rawInput == -4 && undoDepth) {
+                        if (history.undo(session)) {
+                            validInput = true;
+                            turn = SESSION::TurnResult();
+                            turn.node = session.node();
+                            out << "\n[INFO] You retrace your last step.\n";
+                            if (turnPage(turn.node)) {
+                                RENDER::node(out, *text, turn.node);
+                                out << npcNote(turn.node);
+                                RENDER::options(out, *text, turn.node, availableNow(turn.node));
+                            } else {
+                                running = false;
+                            }
+                        } else {
+                            out << "There is nothing to undo.";
                         }
-                    }
-                }
-
-                // Check if the game is still running before processing the choice
-                if (!running) {
-                    break; // Exit the main game loop if the player chose to exit
-                }
-
-                // do choice actions
-                auto& chosenOption = currentNode->options[input];
-                if (chosenOption.useAction.type != ACTION::TYPE::NONE) {
-                    // Decide the logic for option actions more clearly.
-                    // This current check prevents the action if *any* of the items
-                    // in chosenOption.pickupItems are already in the inventory.
-                    // Is this the intended behavior?
-                    if (!inventory.hasItems(chosenOption.pickupItems)) {
-                        chosenOption.useAction.executeAction(inventory, chosenOption.pickupItems, chosenOption.useItem);
                     } else {
-                        // Only print this message if the action *was* a pickup action
-                        if (chosenOption.useAction.type == ACTION::TYPE::PICKUP) {
-                            std::cout << "\n[INFO] You already have some of the items trying to be picked up by this option.\n";
+                        // the session applies the option and enters the next node
+                        SESSION::TurnResult next;
+                        bool blocked = npcRules && rawInput >= 1 && static_cast<uint32_t>(rawInput) <= story.node(currentNode).optionCount &&
+                                       !npcs->allows(currentNode, static_cast<uint32_t>(rawInput - 1));
+                        if (blocked) next.status = SESSION::LOCKED;
+                        else next = session.step(rawInput - 1); // Adjust for 0-based indexing
+                        if (next.status == SESSION::INVALID_CHOICE) {
+                            out << "Please enter an existing option number (1 - " << story.node(currentNode).optionCount << ").";
+                        } else if (next.status == SESSION::LOCKED) {
+                            out << "You can't do that right now.";
+                        } else {
+                            validInput = true; // Valid option selected
+                            turn = next;
+                            if (undoDepth) history.record(session);
+                            npcTurn(currentNode, turn);
+                            if (turnPage(turn.node)) {
+                                RENDER::turn(out, *text, turn, turn.ended ? nullptr : availableNow(turn.node), npcNote(turn.node));
+                            } else {
+                                running = false;
+                            }
                         }
                     }
                 }
-
-                currentNode = currentNode->nextNodes[input];
             }
+
+            flush();
+            inventory = std::move(session.inventory());
         }
     }
 }
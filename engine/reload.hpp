@@ -0,0 +1,178 @@
+#ifndef RELOAD_HPP
+#define RELOAD_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <cstdint>
+
+#include "inventory.hpp"
+#include "session.hpp"
+#include "story.hpp"
+
+namespace RELOAD {
+    // Hot reload: a Library holds the newest version of a story and publishes new ones while
+    // sessions keep playing. Publishing builds the new version's lookup tables first and then
+    // swaps one shared_ptr (RCU style). Turns only read the generation counter, which is a
+    // plain atomic; a session fetches the version itself once per reload. That fetch and the
+    // swap go through the std::atomic_* shared_ptr functions, which libstdc++ implements with
+    // a small pool of mutexes hashed by address, so they can briefly wait on each other (a
+    // pointer copy and refcount bump, never the build).
+    //
+    // A session stays on the version it has until its next turn. Then it looks its node up
+    // by key (STORY::nodeKey) and its variables by name in the new version and moves over;
+    // items need no mapping, item ids are names interned per process. Versions are reference
+    // counted, the old one goes away when its last session has moved on.
+
+    struct Version {
+        uint64_t generation = 0;
+        STORY::Story story;
+        std::unordered_map<uint64_t, STORY::NodeId> nodes;      // key -> node
+        std::unordered_map<std::string_view, uint32_t> variables; // name -> index, views the story's text pool
+    };
+
+    typedef std::shared_ptr<const Version> VersionPtr;
+
+    // What publish() took. Only the swap is a pause, the build happens beside the old version.
+    struct PublishStats {
+        uint64_t generation = 0;
+        double buildSeconds = 0; // key and variable tables of the new version
+        uint64_t pauseNs = 0;    // shared_ptr swap, under the library's lock for it
+    };
+
+    class Library {
+    public:
+        explicit Library(STORY::Story story) { publish(std::move(story)); }
+
+        Library(const Library&) = delete;
+        Library& operator=(const Library&) = delete;
+
+        // Makes story the current version, safe to call from any thread while sessions play.
+        // Stories without node keys can be published but their sessions cannot move away
+        // from them mid game (only when they start over).
+        PublishStats publish(STORY::Story story) {
+            PublishStats stats;
+            auto begin = std::chrono::steady_clock::now();
+            auto next = std::make_shared<Version>();
+            next->story = std::move(story);
+            next->nodes.reserve(next->story.keys.size);
+            for (uint32_t i = 0; i < next->story.keys.size; ++i) next->nodes.emplace(next->story.keys[i], i);
+            for (uint32_t i = 0; i < next->story.variables.size; ++i) {
+                next->variables.emplace(next->story.text(next->story.variables[i]), i);
+            }
+
+            std::lock_guard<std::mutex> lock(writer); // publishers only
+            next->generation = latest.load(std::memory_order_relaxed) + 1;
+            stats.generation = next->generation;
+            auto swap = std::chrono::steady_clock::now();
+            VersionPtr old = std::atomic_exchange_explicit(&head, VersionPtr(std::move(next)), std::memory_order_acq_rel);
+            latest.store(stats.generation, std::memory_order_release);
+            auto end = std::chrono::steady_clock::now();
+            stats.buildSeconds = std::chrono::duration<double>(swap - begin).count();
+            stats.pauseNs = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(end - swap).count());
+
+            if (old) history.push_back(old);
+            history.erase(std::remove_if(history.begin(), history.end(),
+                                         [](const std::weak_ptr<const Version>& version) { return version.expired(); }),
+                          history.end());
+            return stats; // old is released here if no session holds it
+        }
+
+        // Takes the lock libstdc++ keeps for head's address, see above. Sessions call it only
+        // when generation() moved on.
+        VersionPtr current() const { return std::atomic_load_explicit(&head, std::memory_order_acquire); }
+
+        // The turn hot path only reads this, lock free
+        uint64_t generation() const { return latest.load(std::memory_order_acquire); }
+
+        // Older versions some session still holds
+        size_t retiring() const {
+            std::lock_guard<std::mutex> lock(writer);
+            size_t count = 0;
+            for (const auto& version : history) count += !version.expired();
+            return count;
+        }
+
+    private:
+        VersionPtr head;
+        std::atomic<uint64_t> latest{ 0 };
+        mutable std::mutex writer;
+        std::vector<std::weak_ptr<const Version>> history;
+    };
+
+    // A SESSION::Session that follows the library's versions. Like a Session it is used by
+    // one thread at a time. A turn result is valid until the next turn of the same session
+    // (its action reports may point into the version the turn started in).
+    class Session {
+    public:
+        explicit Session(const Library& library, INVENTORY::Inventory inventory = INVENTORY::Inventory())
+            : library(&library), version(library.current()), session(version->story, std::move(inventory)) {}
+
+        // Starting over always moves to the newest version
+        SESSION::TurnResult start() {
+            if (library->generation() != version->generation) {
+                previous.reset();
+                version = library->current();
+                session.migrate(version->story, STORY::NO_NODE, std::pmr::vector<int32_t>(version->story.variables.size, 0, session.resource()));
+            }
+            return session.start();
+        }
+
+        // The turn runs in the version the player was shown, then the session moves to the
+        // newest one so what it shows next comes from there
+        SESSION::TurnResult step(int choice) {
+            previous.reset();
+            SESSION::TurnResult result = session.step(choice);
+            if (result.status == SESSION::OK && sync()) {
+                result.node = session.node();
+                result.ended = session.ended();
+            }
+            return result;
+        }
+
+        // Moves to the newest version if there is one and the current node is in it (if not,
+        // it tries again next turn). Returns whether the session moved.
+        bool sync() {
+            if (library->generation() == version->generation) return false;
+            VersionPtr next = library->current();
+            STORY::NodeId node = STORY::NO_NODE;
+            if (session.node() != STORY::NO_NODE) {
+                const STORY::Story& story = version->story;
+                if (story.keys.size == 0) return false;
+                auto it = next->nodes.find(story.keys[session.node()]);
+                if (it == next->nodes.end()) return false;
+                node = it->second;
+            }
+
+            std::pmr::vector<int32_t> vars(next->story.variables.size, 0, session.resource());
+            const STORY::Story& story = version->story;
+            for (uint32_t i = 0; i < story.variables.size; ++i) {
+                auto it = next->variables.find(story.text(story.variables[i]));
+                if (it != next->variables.end()) vars[it->second] = session.variables()[i];
+            }
+            session.migrate(next->story, node, vars);
+            previous = std::move(version);
+            version = std::move(next);
+            return true;
+        }
+
+        const STORY::Story& story() const { return version->story; }
+        uint64_t generation() const { return version->generation; }
+        SESSION::Session& state() { return session; }
+        const SESSION::Session& state() const { return session; }
+
+    private:
+        const Library* library;
+        VersionPtr version;
+        VersionPtr previous; // the last turn's version, until the next turn
+        SESSION::Session session;
+    };
+}
+
+#endif
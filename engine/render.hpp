@@ -0,0 +1,89 @@
+#ifndef RENDER_HPP
+#define RENDER_HPP
+
+#include <cstdint>
+#include <string_view>
+
+#include "action.hpp"
+#include "inventory.hpp"
+#include "output.hpp"
+#include "session.hpp"
+#include "story.hpp"
+
+namespace RENDER {
+    // Turns session results into the text the game shows. Everything goes into an
+    // OUTPUT::Buffer, story text is referenced rather than copied.
+
+    inline void node(OUTPUT::Buffer& out, const STORY::Story& story, STORY::NodeId id) {
+        out << "\n---------\n";
+        out.appendRef(story.text(story.node(id).text));
+        out << "\n";
+    }
+
+    // available (see MASKS::OptionMasks), if given, marks options whose action would not work
+    inline void options(OUTPUT::Buffer& out, const STORY::Story& story, STORY::NodeId id, const uint64_t* available = nullptr) {
+        const STORY::NodeRecord& record = story.node(id);
+        for (size_t i = 0; i < record.optionCount; ++i) {
+            out << i + 1 << ". "; // Print 1-based index
+            out.appendRef(story.text(story.option(id, i).text));
+            if (available && !((available[i >> 6] >> (i & 63)) & 1u)) out << " (unavailable)";
+            out << "\n";
+        }
+    }
+
+    inline void action(OUTPUT::Buffer& out, const SESSION::ActionReport& report, bool onEnter) {
+        if (report.result == ACTION::RESULT::ALREADY_HAVE) {
+            // Only print this message if the action *was* a pickup action
+            if (report.type == ACTION::TYPE::PICKUP) {
+                if (onEnter) {
+                    out << "\n[INFO] You already have some of the items trying to be picked up here.\n";
+                } else {
+                    out << "\n[INFO] You already have some of the items trying to be picked up by this option.\n";
+                }
+            }
+            return;
+        }
+        ACTION::print(out, report.result, report.items, report.itemCount, report.useItem, report.count);
+    }
+
+    inline void actions(OUTPUT::Buffer& out, const SESSION::ActionReports& reports, bool onEnter) {
+        for (const SESSION::ActionReport& report : reports) action(out, report, onEnter);
+    }
+
+    // The node that was just entered: its text, its on enter action and either the options
+    // or the end of game line. note (who else is there, see NPC) goes before the options.
+    inline void arrival(OUTPUT::Buffer& out, const STORY::Story& story, const SESSION::TurnResult& turn, const uint64_t* available = nullptr,
+                        std::string_view note = {}) {
+        node(out, story, turn.node);
+        actions(out, turn.enterActions, true);
+        out << note;
+        if (turn.ended) {
+            out << "\n---------\nEnd of the game.\n";
+        } else {
+            options(out, story, turn.node, available);
+        }
+    }
+
+    // Everything a step() or start() produced
+    inline void turn(OUTPUT::Buffer& out, const STORY::Story& story, const SESSION::TurnResult& turn, const uint64_t* available = nullptr,
+                     std::string_view note = {}) {
+        actions(out, turn.optionActions, false);
+        arrival(out, story, turn, available, note);
+    }
+
+    inline void inventory(OUTPUT::Buffer& out, const INVENTORY::Inventory& inv) {
+        inv.print(out);
+    }
+
+    // undo and save: whether -4 and -3 do anything where the prompt is shown
+    inline void prompt(OUTPUT::Buffer& out, bool undo = false, bool commands = false, bool save = true) {
+        out << "\n(-1 to see inventory, -2 to exit";
+        if (save) out << ", -3 to save";
+        if (undo) out << ", -4 to undo";
+        out << ")";
+        if (commands) out << "\nType a number or what you do (\"examine the panel\", \"take the key\").";
+        out << "\nEnter your choice: ";
+    }
+}
+
+#endif
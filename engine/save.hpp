@@ -0,0 +1,422 @@
+#ifndef SAVE_HPP
+#define SAVE_HPP
+
+#include <string>
+#include <vector>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <unordered_map>
+#include <cstring>
+#include <cstdint>
+
+#include "inventory.hpp"
+#include "story.hpp"
+
+namespace SAVE {
+    // Save games. A snapshot is one fixed layout record: a header with the story hash and the
+    // current node, followed by the state words: the inventory as one 32 bit count per item
+    // of the story's catalog, two to a word (count i = how many of story.items[i] the player
+    // holds), then the script variables, also two to a word. Writing one allocates nothing
+    // for stories of up to 512 items and variables, bigger states are packed on the heap.
+    //
+    // For servers there is an append-only DeltaLog: many sessions share one log, each turn
+    // appends only the node and the state words that changed since that session's last record.
+
+    static const uint32_t SNAPSHOT_MAGIC = 0x56534254u; // "TBSV"
+    static const uint32_t LOG_MAGIC = 0x4C534254u;      // "TBSL"
+    static const uint32_t VERSION = 3; // 2: item counts instead of a bitmap, 3: script variables
+
+    struct SnapshotHeader {
+        uint32_t magic;
+        uint32_t version;
+        uint64_t storyHash;
+        uint32_t node;
+        uint32_t itemCount;     // counts in the words that follow
+        uint32_t variableCount; // variables after the counts
+        uint32_t reserved;
+    };
+
+    inline size_t inventoryWords(const STORY::Story& story) {
+        return (story.items.size + 1) / 2;
+    }
+
+    inline size_t variableWords(const STORY::Story& story) {
+        return (story.variables.size + 1) / 2;
+    }
+
+    inline size_t stateWords(const STORY::Story& story) {
+        return inventoryWords(story) + variableWords(story);
+    }
+
+    inline size_t snapshotSize(const STORY::Story& story) {
+        return sizeof(SnapshotHeader) + stateWords(story) * sizeof(uint64_t);
+    }
+
+    // Inventory -> catalog counts, words must hold inventoryWords(story) entries
+    inline void packInventory(const STORY::Story& story, const INVENTORY::Inventory& inv, uint64_t* words) {
+        size_t wordCount = inventoryWords(story);
+        for (size_t w = 0; w < wordCount; ++w) words[w] = 0;
+        for (uint32_t i = 0; i < story.items.size; ++i) {
+            words[i >> 1] |= uint64_t(inv.count(story.items[i])) << (32 * (i & 1));
+        }
+    }
+
+    // Catalog counts -> inventory, replaces whatever inv held. Stacks come back in catalog order.
+    inline void unpackInventory(const STORY::Story& story, const uint64_t* words, INVENTORY::Inventory& inv) {
+        inv.clear();
+        for (uint32_t i = 0; i < story.items.size; ++i) {
+            inv.addItem(story.items[i], static_cast<uint32_t>(words[i >> 1] >> (32 * (i & 1))));
+        }
+    }
+
+    // Inventory and variables -> state words, words must hold stateWords(story) entries.
+    // Without variables (nullptr) they are saved as 0.
+    inline void packState(const STORY::Story& story, const INVENTORY::Inventory& inv, const std::pmr::vector<int32_t>* variables, uint64_t* words) {
+        packInventory(story, inv, words);
+        uint64_t* packed = words + inventoryWords(story);
+        for (size_t w = 0; w < variableWords(story); ++w) packed[w] = 0;
+        if (variables && variables->size() == story.variables.size && !variables->empty()) {
+            std::memcpy(packed, variables->data(), variables->size() * sizeof(int32_t));
+        }
+    }
+
+    // The variables part of the state words
+    inline void unpackVariables(const STORY::Story& story, const uint64_t* words, std::pmr::vector<int32_t>& variables) {
+        variables.resize(story.variables.size);
+        if (!variables.empty()) std::memcpy(variables.data(), words + inventoryWords(story), variables.size() * sizeof(int32_t));
+    }
+
+    // Writes a snapshot into out, returns the bytes written or 0 if capacity is too small
+    inline size_t writeSnapshot(const STORY::Story& story, STORY::NodeId node, const INVENTORY::Inventory& inv, void* out, size_t capacity,
+                                const std::pmr::vector<int32_t>* variables = nullptr) {
+        size_t size = snapshotSize(story);
+        if (capacity < size) return 0;
+
+        SnapshotHeader header;
+        header.magic = SNAPSHOT_MAGIC;
+        header.version = VERSION;
+        header.storyHash = story.hash;
+        header.node = node;
+        header.itemCount = story.items.size;
+        header.variableCount = story.variables.size;
+        header.reserved = 0;
+
+        char* bytes = static_cast<char*>(out);
+        std::memcpy(bytes, &header, sizeof(header));
+        uint64_t words[256]; // 512 items and variables, bigger states go through the heap
+        size_t wordCount = stateWords(story);
+        if (wordCount <= 256) {
+            packState(story, inv, variables, words);
+            std::memcpy(bytes + sizeof(header), words, wordCount * sizeof(uint64_t));
+        } else {
+            std::vector<uint64_t> large(wordCount);
+            packState(story, inv, variables, large.data());
+            std::memcpy(bytes + sizeof(header), large.data(), wordCount * sizeof(uint64_t));
+        }
+        return size;
+    }
+
+    // Reads a snapshot taken on the same story, fails on a different story or corrupt data
+    inline bool readSnapshot(const STORY::Story& story, const void* data, size_t size, STORY::NodeId& node, INVENTORY::Inventory& inv,
+                             std::string* error = nullptr, std::pmr::vector<int32_t>* variables = nullptr) {
+        SnapshotHeader header;
+        if (size < sizeof(header)) {
+            if (error) *error = "save data is truncated";
+            return false;
+        }
+        std::memcpy(&header, data, sizeof(header));
+        if (header.magic != SNAPSHOT_MAGIC || header.version != VERSION) {
+            if (error) *error = "not a save game";
+            return false;
+        }
+        if (header.storyHash != story.hash || header.itemCount != story.items.size || header.variableCount != story.variables.size
+            || header.node >= story.nodeCount()) {
+            if (error) *error = "save game belongs to a different story";
+            return false;
+        }
+        if (size < snapshotSize(story)) {
+            if (error) *error = "save data is truncated";
+            return false;
+        }
+
+        std::vector<uint64_t> words(stateWords(story));
+        std::memcpy(words.data(), static_cast<const char*>(data) + sizeof(header), words.size() * sizeof(uint64_t));
+        unpackInventory(story, words.data(), inv);
+        if (variables) unpackVariables(story, words.data(), *variables);
+        node = header.node;
+        return true;
+    }
+
+    inline bool saveFile(const std::string& path, const STORY::Story& story, STORY::NodeId node, const INVENTORY::Inventory& inv,
+                         std::string* error = nullptr, const std::pmr::vector<int32_t>* variables = nullptr) {
+        std::vector<char> bytes(snapshotSize(story));
+        writeSnapshot(story, node, inv, bytes.data(), bytes.size(), variables);
+
+        std::ofstream file(path, std::ios::binary | std::ios::trunc);
+        file.write(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+        if (!file) {
+            if (error) *error = "cannot write " + path;
+            return false;
+        }
+        return true;
+    }
+
+    // Reads a whole save file, the bytes are checked against the story by readSnapshot
+    inline bool readFile(const std::string& path, std::vector<char>& bytes, std::string* error = nullptr) {
+        std::ifstream file(path, std::ios::binary | std::ios::ate);
+        if (!file) {
+            if (error) *error = "cannot open " + path;
+            return false;
+        }
+        bytes.resize(static_cast<size_t>(file.tellg()));
+        file.seekg(0);
+        file.read(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+        if (!file) {
+            if (error) *error = "cannot read " + path;
+            return false;
+        }
+        return true;
+    }
+
+    inline bool loadFile(const std::string& path, const STORY::Story& story, STORY::NodeId& node, INVENTORY::Inventory& inv,
+                         std::string* error = nullptr, std::pmr::vector<int32_t>* variables = nullptr) {
+        std::vector<char> bytes;
+        return readFile(path, bytes, error) && readSnapshot(story, bytes.data(), bytes.size(), node, inv, error, variables);
+    }
+
+    // Incremental checkpoints
+
+    enum RECORD : uint16_t {
+        FULL = 1,  // node + every state word
+        DELTA = 2  // node + (word index, new value) pairs for the words that changed
+    };
+
+    struct LogHeader {
+        uint32_t magic;
+        uint32_t version;
+        uint64_t storyHash;
+        uint32_t itemCount;
+        uint32_t variableCount;
+    };
+
+    struct RecordHeader {
+        uint32_t session;
+        uint32_t node;
+        uint16_t kind;
+        uint16_t reserved;
+        uint32_t wordCount;
+    };
+
+    struct DeltaEntry {
+        uint32_t index;
+        uint32_t reserved;
+        uint64_t value;
+    };
+
+    // What a session last wrote to the log, deltas are taken against this
+    struct Checkpoint {
+        uint32_t session = 0;
+        STORY::NodeId node = STORY::NO_NODE; // NO_NODE until the first FULL record
+        std::vector<uint64_t> words;
+        std::vector<uint64_t> scratch;
+
+        explicit Checkpoint(uint32_t session = 0) : session(session) {}
+    };
+
+    // Append-only log shared by many sessions. record() only appends to an in-memory batch,
+    // flush() hands the whole batch to the file in one write.
+    class DeltaLog {
+    public:
+        explicit DeltaLog(const STORY::Story& story) : story(story) {}
+
+        // Appends to path. A log that is already there must be for this story; a torn record
+        // at its end (a crash mid-flush) is cut off first, so new records follow the last
+        // complete one.
+        bool open(const std::string& path, std::string* error = nullptr) {
+            std::error_code missing;
+            std::uintmax_t size = std::filesystem::file_size(path, missing);
+            if (!missing && size > 0) {
+                std::vector<char> bytes;
+                if (!readFile(path, bytes, error)) return false;
+                size_t end = walk(bytes, story, path, error, [](const RecordHeader&, const char*) {});
+                if (end == 0) return false;
+                if (end < bytes.size()) {
+                    std::error_code failed;
+                    std::filesystem::resize_file(path, end, failed);
+                    if (failed) {
+                        if (error) *error = "cannot truncate " + path;
+                        return false;
+                    }
+                }
+            }
+            file.open(path, std::ios::binary | std::ios::app | std::ios::ate);
+            if (!file) {
+                if (error) *error = "cannot open " + path;
+                return false;
+            }
+            if (file.tellp() == 0) {
+                LogHeader header;
+                header.magic = LOG_MAGIC;
+                header.version = VERSION;
+                header.storyHash = story.hash;
+                header.itemCount = story.items.size;
+                header.variableCount = story.variables.size;
+                append(&header, sizeof(header));
+            }
+            return true;
+        }
+
+        // Appends what changed since the checkpoint (nothing if nothing changed), returns the bytes queued
+        size_t record(Checkpoint& checkpoint, STORY::NodeId node, const INVENTORY::Inventory& inv, const std::pmr::vector<int32_t>* variables = nullptr) {
+            size_t wordCount = stateWords(story);
+            if (checkpoint.node == STORY::NO_NODE || checkpoint.words.size() != wordCount) {
+                return recordFull(checkpoint, node, inv, variables);
+            }
+
+            checkpoint.scratch.resize(wordCount);
+            packState(story, inv, variables, checkpoint.scratch.data());
+            uint32_t changed = 0;
+            for (size_t w = 0; w < wordCount; ++w) {
+                if (checkpoint.scratch[w] != checkpoint.words[w]) ++changed;
+            }
+            if (changed == 0 && node == checkpoint.node) return 0;
+
+            size_t before = batch.size();
+            RecordHeader header = recordHeader(checkpoint.session, node, DELTA, changed);
+            append(&header, sizeof(header));
+            for (size_t w = 0; w < wordCount; ++w) {
+                if (checkpoint.scratch[w] == checkpoint.words[w]) continue;
+                DeltaEntry entry;
+                entry.index = static_cast<uint32_t>(w);
+                entry.reserved = 0;
+                entry.value = checkpoint.scratch[w];
+                append(&entry, sizeof(entry));
+                checkpoint.words[w] = checkpoint.scratch[w];
+            }
+            checkpoint.node = node;
+            return batch.size() - before;
+        }
+
+        // Writes the whole state, use for new sessions and to bound replay length
+        size_t recordFull(Checkpoint& checkpoint, STORY::NodeId node, const INVENTORY::Inventory& inv, const std::pmr::vector<int32_t>* variables = nullptr) {
+            size_t wordCount = stateWords(story);
+            checkpoint.words.resize(wordCount);
+            packState(story, inv, variables, checkpoint.words.data());
+            checkpoint.node = node;
+
+            size_t before = batch.size();
+            RecordHeader header = recordHeader(checkpoint.session, node, FULL, static_cast<uint32_t>(wordCount));
+            append(&header, sizeof(header));
+            append(checkpoint.words.data(), wordCount * sizeof(uint64_t));
+            return batch.size() - before;
+        }
+
+        bool flush() {
+            if (batch.empty()) return true;
+            file.write(batch.data(), static_cast<std::streamsize>(batch.size()));
+            file.flush();
+            batch.clear(); // keeps its capacity for the next turn
+            return static_cast<bool>(file);
+        }
+
+        // Replays a log and reports the latest state of every session it mentions, words are
+        // stateWords(story) long (see unpackInventory and unpackVariables)
+        static bool replay(const std::string& path, const STORY::Story& story,
+                           const std::function<void(uint32_t session, STORY::NodeId node, const uint64_t* words)>& onSession,
+                           std::string* error = nullptr) {
+            std::vector<char> bytes;
+            if (!readFile(path, bytes, error)) return false;
+
+            size_t wordCount = stateWords(story);
+            std::unordered_map<uint32_t, Checkpoint> sessions;
+            std::vector<uint32_t> seen; // sessions in first-seen order
+            size_t end = walk(bytes, story, path, error, [&](const RecordHeader& record, const char* payload) {
+                Checkpoint& state = sessions[record.session];
+                if (state.node == STORY::NO_NODE) {
+                    if (record.kind != FULL) return;
+                    seen.push_back(record.session);
+                }
+                if (record.kind == FULL) {
+                    state.words.resize(wordCount);
+                    std::memcpy(state.words.data(), payload, wordCount * sizeof(uint64_t));
+                } else {
+                    for (uint32_t i = 0; i < record.wordCount; ++i) {
+                        DeltaEntry entry;
+                        std::memcpy(&entry, payload + i * sizeof(entry), sizeof(entry));
+                        if (entry.index < wordCount) state.words[entry.index] = entry.value;
+                    }
+                }
+                state.node = record.node;
+            });
+            if (end == 0) return false;
+
+            for (uint32_t session : seen) {
+                onSession(session, sessions[session].node, sessions[session].words.data());
+            }
+            return true;
+        }
+
+    private:
+        // Checks the log header in bytes against story and hands every complete record to
+        // onRecord(header, payload). Returns where the last complete record ends, 0 (with
+        // error set) if the header does not belong to story.
+        template<typename OnRecord>
+        static size_t walk(const std::vector<char>& bytes, const STORY::Story& story, const std::string& path, std::string* error,
+                           OnRecord&& onRecord) {
+            LogHeader header;
+            if (bytes.size() < sizeof(header)) {
+                if (error) *error = path + " is not a save log";
+                return 0;
+            }
+            std::memcpy(&header, bytes.data(), sizeof(header));
+            if (header.magic != LOG_MAGIC || header.version != VERSION) {
+                if (error) *error = path + " is not a save log";
+                return 0;
+            }
+            if (header.storyHash != story.hash || header.itemCount != story.items.size || header.variableCount != story.variables.size) {
+                if (error) *error = path + " belongs to a different story";
+                return 0;
+            }
+
+            size_t wordCount = stateWords(story);
+            size_t offset = sizeof(header);
+            while (offset + sizeof(RecordHeader) <= bytes.size()) {
+                RecordHeader record;
+                std::memcpy(&record, bytes.data() + offset, sizeof(record));
+                size_t payload = offset + sizeof(record);
+
+                size_t entrySize = record.kind == FULL ? sizeof(uint64_t) : sizeof(DeltaEntry);
+                if ((record.kind != FULL && record.kind != DELTA) || record.node >= story.nodeCount()
+                    || (record.kind == FULL && record.wordCount != wordCount)
+                    || record.wordCount > (bytes.size() - payload) / entrySize) {
+                    break; // torn tail from a crash mid-write, everything before it is valid
+                }
+                onRecord(record, bytes.data() + payload);
+                offset = payload + record.wordCount * entrySize;
+            }
+            return offset;
+        }
+
+        static RecordHeader recordHeader(uint32_t session, STORY::NodeId node, RECORD kind, uint32_t wordCount) {
+            RecordHeader header;
+            header.session = session;
+            header.node = node;
+            header.kind = kind;
+            header.reserved = 0;
+            header.wordCount = wordCount;
+            return header;
+        }
+
+        void append(const void* data, size_t size) {
+            const char* bytes = static_cast<const char*>(data);
+            batch.insert(batch.end(), bytes, bytes + size);
+        }
+
+        const STORY::Story& story;
+        std::ofstream file;
+        std::vector<char> batch;
+    };
+}
+
+#endif
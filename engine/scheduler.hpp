@@ -0,0 +1,190 @@
+#ifndef SCHEDULER_HPP
+#define SCHEDULER_HPP
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <cstdint>
+
+#include "inventory.hpp"
+#include "reload.hpp"
+#include "session.hpp"
+#include "story.hpp"
+#include "telemetry.hpp"
+
+namespace SCHEDULER {
+    // Runs turns of many sessions on a pool of worker threads. Every session has a home
+    // worker (soft pinning, so its state tends to stay in that core's cache) and input for
+    // it is queued there. Idle workers steal from the back of other workers' queues.
+    //
+    // The story is shared read-only by every worker, turns never lock it. A session must
+    // have at most one turn in flight (submit the next choice from the callback, like a
+    // client waiting for its reply), so two workers never step the same session.
+    //
+    // reload() publishes a new version of the story while turns run; each session moves to
+    // it at its next turn (see RELOAD), so a reload costs the workers no pause.
+
+    typedef uint32_t SessionId;
+
+    struct Task {
+        SessionId session;
+        int choice; // -1 starts the session (enters the root node)
+    };
+
+    typedef std::function<void(SessionId, const SESSION::TurnResult&)> TurnCallback;
+
+    class Scheduler {
+    public:
+        Scheduler(const STORY::Story& story, size_t workerCount, TurnCallback onTurn)
+            : library(story), onTurn(std::move(onTurn)) {
+            if (workerCount == 0) workerCount = 1;
+            for (size_t i = 0; i < workerCount; ++i) {
+                queues.emplace_back(new Queue());
+            }
+        }
+
+        ~Scheduler() { stop(); }
+
+        Scheduler(const Scheduler&) = delete;
+        Scheduler& operator=(const Scheduler&) = delete;
+
+        // Sessions are added before start(), the session table does not grow while running
+        SessionId addSession(INVENTORY::Inventory inventory = INVENTORY::Inventory()) {
+            SessionId id = static_cast<SessionId>(sessions.size());
+            sessions.emplace_back(library, std::move(inventory));
+            if (telemetry) sessions.back().state().setTelemetry(telemetry);
+            return id;
+        }
+
+        size_t workerCount() const { return queues.size(); }
+        RELOAD::Session& session(SessionId id) { return sessions[id]; }
+
+        // Counts the turns of every session in recorder (per worker shards), call before
+        // start(). Sessions stop counting when they move to a reloaded version.
+        void setTelemetry(TELEMETRY::Recorder* recorder) {
+            telemetry = recorder;
+            for (auto& target : sessions) target.state().setTelemetry(recorder);
+        }
+
+        // Safe to call from any thread, also while the workers run
+        RELOAD::PublishStats reload(STORY::Story story) { return library.publish(std::move(story)); }
+        const RELOAD::Library& versions() const { return library; }
+
+        void start() {
+            running = true;
+            for (size_t i = 0; i < queues.size(); ++i) {
+                threads.emplace_back([this, i] { work(i); });
+            }
+        }
+
+        // Stops after the queued turns are done
+        void stop() {
+            if (threads.empty()) return;
+            wait();
+            {
+                std::lock_guard<std::mutex> lock(idleMutex);
+                running = false;
+            }
+            idle.notify_all();
+            for (auto& thread : threads) thread.join();
+            threads.clear();
+        }
+
+        // Queues a turn on the session's home worker, safe to call from the turn callback
+        void submit(SessionId session, int choice) {
+            pending.fetch_add(1, std::memory_order_relaxed);
+            Queue& queue = *queues[session % queues.size()];
+            {
+                std::lock_guard<std::mutex> lock(queue.mutex);
+                queue.tasks.push_back(Task{ session, choice });
+            }
+            if (sleeping.load(std::memory_order_acquire) != 0) {
+                std::lock_guard<std::mutex> lock(idleMutex);
+                idle.notify_one();
+            }
+        }
+
+        // Blocks until every submitted turn (including ones submitted by callbacks) is done
+        void wait() {
+            std::unique_lock<std::mutex> lock(idleMutex);
+            drained.wait(lock, [this] { return pending.load(std::memory_order_acquire) == 0; });
+        }
+
+    private:
+        struct Queue {
+            std::mutex mutex;
+            std::deque<Task> tasks;
+        };
+
+        bool popLocal(size_t worker, Task& task) {
+            Queue& queue = *queues[worker];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            if (queue.tasks.empty()) return false;
+            task = queue.tasks.front();
+            queue.tasks.pop_front();
+            return true;
+        }
+
+        bool steal(size_t worker, Task& task) {
+            for (size_t i = 1; i < queues.size(); ++i) {
+                Queue& victim = *queues[(worker + i) % queues.size()];
+                std::unique_lock<std::mutex> lock(victim.mutex, std::try_to_lock);
+                if (!lock.owns_lock() || victim.tasks.empty()) continue;
+                task = victim.tasks.back();
+                victim.tasks.pop_back();
+                return true;
+            }
+            return false;
+        }
+
+        void run(const Task& task) {
+            RELOAD::Session& target = sessions[task.session];
+            SESSION::TurnResult result = task.choice < 0 ? target.start() : target.step(task.choice);
+            if (onTurn) onTurn(task.session, result);
+
+            if (pending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                std::lock_guard<std::mutex> lock(idleMutex);
+                drained.notify_all();
+            }
+        }
+
+        void work(size_t worker) {
+            Task task;
+            while (true) {
+                if (popLocal(worker, task) || steal(worker, task)) {
+                    run(task);
+                    continue;
+                }
+
+                std::unique_lock<std::mutex> lock(idleMutex);
+                sleeping.fetch_add(1, std::memory_order_acq_rel);
+                // short timed wait: a submit racing with us going to sleep is picked up on the next round
+                idle.wait_for(lock, std::chrono::milliseconds(1));
+                sleeping.fetch_sub(1, std::memory_order_acq_rel);
+                if (!running && pending.load(std::memory_order_acquire) == 0) return;
+            }
+        }
+
+        RELOAD::Library library;
+        TurnCallback onTurn;
+        std::vector<RELOAD::Session> sessions;
+        TELEMETRY::Recorder* telemetry = nullptr;
+        std::vector<std::unique_ptr<Queue>> queues;
+        std::vector<std::thread> threads;
+
+        std::atomic<size_t> pending{ 0 };
+        std::atomic<size_t> sleeping{ 0 };
+        bool running = false; // guarded by idleMutex
+        std::mutex idleMutex;
+        std::condition_variable idle;
+        std::condition_variable drained;
+    };
+}
+
+#endif
@@ -0,0 +1,409 @@
+#ifndef SCRIPT_HPP
+#define SCRIPT_HPP
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+#include "inventory.hpp"
+#include "text.hpp"
+
+namespace SCRIPT {
+    // Conditions and effects written by story authors, compiled once (when the story is
+    // compiled) into bytecode for a small register machine:
+    //
+    //   condition:  has(Prybar) && !flag(panelOpen) && count(Cell) >= 2
+    //   effect:     set(panelOpen); cellsUsed += 2
+    //
+    // Expressions: integers, true/false, has(Item), count(Item), flag(name) (name != 0), a
+    // variable by name, ( ), ! and unary -, *, + and -, comparisons, && and || (short
+    // circuit). Item names are everything between the parentheses, spaces included.
+    // Effects are assignments (=, +=, -=) and set(name)/clear(name), separated by ';'.
+    // Variables are 32 bit integers that start at 0, every name a story uses is one.
+    //
+    // Running a script touches only the inventory, the variables and a register file on the
+    // stack: nothing is allocated.
+
+    enum OP : uint8_t {
+        CONST,            // r[dst] = arg
+        HAS,              // r[dst] = item arg is held
+        COUNT,            // r[dst] = how many of item arg are held
+        LOAD,             // r[dst] = variable arg
+        STORE,            // variable arg = r[a]
+        NOT,              // r[dst] = !r[a]
+        BOOL,             // r[dst] = r[a] != 0
+        NEG,              // r[dst] = -r[a]
+        ADD,              // r[dst] = r[a] + r[b]
+        SUB,
+        MUL,
+        EQ,               // r[dst] = r[a] == r[b]
+        NE,
+        LT,
+        LE,
+        JUMP_IF_ZERO,     // if r[a] == 0 continue at arg (relative to the script's first instruction)
+        JUMP_IF_NOT_ZERO,
+        OP_COUNT
+    };
+
+    struct Instr {
+        uint8_t op = CONST;
+        uint8_t dst = 0;
+        uint8_t a = 0;
+        uint8_t b = 0;
+        uint32_t arg = 0;
+    };
+
+    const uint32_t MAX_REGISTERS = 16; // also bounds how deeply expressions nest
+
+    // A compiled script: a run of the story's code array, count 0 is no script
+    struct ScriptRef {
+        uint32_t first = 0;
+        uint32_t count = 0;
+    };
+
+    namespace detail {
+        // Arithmetic wraps like the unsigned machine word instead of overflowing
+        inline int32_t wrap(uint32_t value) { return static_cast<int32_t>(value); }
+
+        template<typename Inv, typename Vars>
+        int32_t execute(const Instr* code, uint32_t count, const Inv& inv, Vars* vars) {
+            int32_t r[MAX_REGISTERS] = {};
+            uint32_t pc = 0;
+            while (pc < count) {
+                const Instr& in = code[pc++];
+                switch (in.op) {
+                    case CONST: r[in.dst] = static_cast<int32_t>(in.arg); break;
+                    case HAS: r[in.dst] = inv.hasItem(in.arg) ? 1 : 0; break;
+                    case COUNT: r[in.dst] = static_cast<int32_t>(std::min<uint32_t>(inv.count(in.arg), INT32_MAX)); break;
+                    case LOAD: r[in.dst] = vars[in.arg]; break;
+                    case STORE:
+                        if constexpr (!std::is_const<Vars>::value) vars[in.arg] = r[in.a];
+                        break;
+                    case NOT: r[in.dst] = r[in.a] == 0; break;
+                    case BOOL: r[in.dst] = r[in.a] != 0; break;
+                    case NEG: r[in.dst] = wrap(0u - static_cast<uint32_t>(r[in.a])); break;
+                    case ADD: r[in.dst] = wrap(static_cast<uint32_t>(r[in.a]) + static_cast<uint32_t>(r[in.b])); break;
+                    case SUB: r[in.dst] = wrap(static_cast<uint32_t>(r[in.a]) - static_cast<uint32_t>(r[in.b])); break;
+                    case MUL: r[in.dst] = wrap(static_cast<uint32_t>(r[in.a]) * static_cast<uint32_t>(r[in.b])); break;
+                    case EQ: r[in.dst] = r[in.a] == r[in.b]; break;
+                    case NE: r[in.dst] = r[in.a] != r[in.b]; break;
+                    case LT: r[in.dst] = r[in.a] < r[in.b]; break;
+                    case LE: r[in.dst] = r[in.a] <= r[in.b]; break;
+                    case JUMP_IF_ZERO: if (r[in.a] == 0) pc = in.arg; break;
+                    case JUMP_IF_NOT_ZERO: if (r[in.a] != 0) pc = in.arg; break;
+                    default: return 0; // loaders reject unknown opcodes
+                }
+            }
+            return r[0];
+        }
+    }
+
+    // Evaluates a condition. Inv is anything with hasItem(id) and count(id), vars holds every
+    // variable of the story. Conditions never write variables.
+    template<typename Inv>
+    bool test(const Instr* code, uint32_t count, const Inv& inv, const int32_t* vars) {
+        return count == 0 || detail::execute(code, count, inv, vars) != 0;
+    }
+
+    // Runs an effect, updating vars
+    template<typename Inv>
+    void run(const Instr* code, uint32_t count, const Inv& inv, int32_t* vars) {
+        detail::execute(code, count, inv, vars);
+    }
+
+    // The variable names of a story, a variable is its index
+    class Variables {
+    public:
+        uint32_t intern(std::string_view name) {
+            auto it = ids.find(name);
+            if (it != ids.end()) return it->second;
+            uint32_t id = static_cast<uint32_t>(names.size());
+            std::string_view stored = TEXT::intern(name);
+            names.push_back(stored);
+            ids.emplace(stored, id);
+            return id;
+        }
+
+        size_t size() const { return names.size(); }
+        std::string_view name(uint32_t id) const { return names[id]; }
+
+    private:
+        std::unordered_map<std::string_view, uint32_t> ids; // keys point into TEXT::pool()
+        std::vector<std::string_view> names;
+    };
+
+    // Compiles scripts, appending their code to one array. Registers are handed out by
+    // nesting depth: an operator leaves its value in the register its left operand used.
+    class Compiler {
+    public:
+        Compiler(std::vector<Instr>& code, Variables& variables) : code(code), variables(variables) {}
+
+        bool condition(std::string_view source, ScriptRef& ref, std::string* error = nullptr) {
+            begin(source);
+            if (!atEnd()) expression(0);
+            if (!failed && !atEnd()) fail("unexpected text");
+            return finish(ref, error);
+        }
+
+        bool effect(std::string_view source, ScriptRef& ref, std::string* error = nullptr) {
+            begin(source);
+            while (!failed && !atEnd()) {
+                statement();
+                if (!failed && !atEnd() && !accept(";")) fail("expected ';'");
+            }
+            return finish(ref, error);
+        }
+
+    private:
+        void begin(std::string_view source) {
+            text = source;
+            at = 0;
+            first = static_cast<uint32_t>(code.size());
+            failed = false;
+            message.clear();
+        }
+
+        bool finish(ScriptRef& ref, std::string* error) {
+            if (failed) {
+                code.resize(first);
+                if (error) *error = message + " at " + std::to_string(at) + " in \"" + std::string(text) + "\"";
+                ref = ScriptRef();
+                return false;
+            }
+            ref.first = first;
+            ref.count = static_cast<uint32_t>(code.size()) - first;
+            return true;
+        }
+
+        void fail(const char* what) {
+            if (!failed) message = what;
+            failed = true;
+        }
+
+        void skip() {
+            while (at < text.size() && std::isspace(static_cast<unsigned char>(text[at]))) ++at;
+        }
+
+        bool atEnd() {
+            skip();
+            return at >= text.size();
+        }
+
+        bool peek(std::string_view token) {
+            skip();
+            return text.substr(at, token.size()) == token;
+        }
+
+        bool accept(std::string_view token) {
+            if (!peek(token)) return false;
+            at += token.size();
+            return true;
+        }
+
+        void expect(std::string_view token, const char* what) {
+            if (!accept(token)) fail(what);
+        }
+
+        std::string_view identifier() {
+            skip();
+            size_t start = at;
+            while (at < text.size() && (std::isalnum(static_cast<unsigned char>(text[at])) || text[at] == '_')) ++at;
+            if (start < at && std::isdigit(static_cast<unsigned char>(text[start]))) at = start; // numbers are not names
+            return text.substr(start, at - start);
+        }
+
+        // Item name in has(...) / count(...)
+        INVENTORY::ItemId item() {
+            skip();
+            size_t close = text.find(')', at);
+            if (close == std::string_view::npos) {
+                fail("expected ')'");
+                return INVENTORY::NO_ITEM;
+            }
+            std::string_view name = text.substr(at, close - at);
+            while (!name.empty() && std::isspace(static_cast<unsigned char>(name.back()))) name.remove_suffix(1);
+            if (name.empty()) {
+                fail("expected an item name");
+                return INVENTORY::NO_ITEM;
+            }
+            at = close + 1;
+            return INVENTORY::itemTable().intern(name);
+        }
+
+        uint32_t variable() {
+            std::string_view name = identifier();
+            if (name.empty()) {
+                fail("expected a variable name");
+                return 0;
+            }
+            return variables.intern(name);
+        }
+
+        void emit(OP op, uint32_t dst, uint32_t a = 0, uint32_t b = 0, uint32_t arg = 0) {
+            if (failed) return;
+            Instr in;
+            in.op = op;
+            in.dst = static_cast<uint8_t>(dst);
+            in.a = static_cast<uint8_t>(a);
+            in.b = static_cast<uint8_t>(b);
+            in.arg = arg;
+            code.push_back(in);
+        }
+
+        uint32_t here() const { return static_cast<uint32_t>(code.size()) - first; }
+
+        void statement() {
+            std::string_view name = identifier();
+            if (name.empty()) {
+                fail("expected a statement");
+                return;
+            }
+            if ((name == "set" || name == "clear") && accept("(")) {
+                uint32_t var = variable();
+                expect(")", "expected ')'");
+                emit(CONST, 0, 0, 0, name == "set" ? 1 : 0);
+                emit(STORE, 0, 0, 0, var);
+                return;
+            }
+            uint32_t var = variables.intern(name);
+            if (accept("+=") || accept("-=")) {
+                bool add = text[at - 2] == '+';
+                emit(LOAD, 0, 0, 0, var);
+                expression(1);
+                emit(add ? ADD : SUB, 0, 0, 1);
+            } else if (!peek("==") && accept("=")) {
+                expression(0);
+            } else {
+                fail("expected '=', '+=' or '-='");
+                return;
+            }
+            emit(STORE, 0, 0, 0, var);
+        }
+
+        void expression(uint32_t r) { logical(r, true); }
+
+        // || (or) and && (and, binds tighter). The jumps land on a BOOL that turns the
+        // operand that decided it into 0 or 1.
+        void logical(uint32_t r, bool isOr) {
+            if (isOr) logical(r, false); else comparison(r);
+            std::string_view token = isOr ? "||" : "&&";
+            if (failed || !peek(token)) return;
+
+            std::vector<uint32_t> jumps; // compile time only
+            while (!failed && accept(token)) {
+                jumps.push_back(static_cast<uint32_t>(code.size()));
+                emit(isOr ? JUMP_IF_NOT_ZERO : JUMP_IF_ZERO, 0, r);
+                if (isOr) logical(r, false); else comparison(r);
+            }
+            if (failed) return;
+            uint32_t target = here();
+            emit(BOOL, r, r);
+            for (uint32_t jump : jumps) code[jump].arg = target;
+        }
+
+        void comparison(uint32_t r) {
+            sum(r);
+            struct Compare { std::string_view token; OP op; bool swap; };
+            static const Compare compares[] = {
+                { "==", EQ, false }, { "!=", NE, false }, { "<=", LE, false }, { ">=", LE, true },
+                { "<", LT, false }, { ">", LT, true },
+            };
+            for (const Compare& compare : compares) {
+                if (!accept(compare.token)) continue;
+                sum(r + 1);
+                if (compare.swap) emit(compare.op, r, r + 1, r); else emit(compare.op, r, r, r + 1);
+                return;
+            }
+        }
+
+        void sum(uint32_t r) {
+            product(r);
+            while (!failed) {
+                if (peek("+=") || peek("-=")) return;
+                bool add = accept("+");
+                if (!add && !accept("-")) return;
+                product(r + 1);
+                emit(add ? ADD : SUB, r, r, r + 1);
+            }
+        }
+
+        void product(uint32_t r) {
+            unary(r);
+            while (!failed && accept("*")) {
+                unary(r + 1);
+                emit(MUL, r, r, r + 1);
+            }
+        }
+
+        void unary(uint32_t r) {
+            if (peek("!=")) {
+                fail("expected a value");
+            } else if (accept("!")) {
+                unary(r);
+                emit(NOT, r, r);
+            } else if (accept("-")) {
+                unary(r);
+                emit(NEG, r, r);
+            } else {
+                primary(r);
+            }
+        }
+
+        void primary(uint32_t r) {
+            if (r >= MAX_REGISTERS) {
+                fail("expression is nested too deeply");
+                return;
+            }
+            if (accept("(")) {
+                expression(r);
+                expect(")", "expected ')'");
+                return;
+            }
+            skip();
+            if (at < text.size() && std::isdigit(static_cast<unsigned char>(text[at]))) {
+                uint64_t value = 0;
+                while (at < text.size() && std::isdigit(static_cast<unsigned char>(text[at]))) {
+                    value = value * 10 + static_cast<uint64_t>(text[at++] - '0');
+                    if (value > INT32_MAX) {
+                        fail("number is too big");
+                        return;
+                    }
+                }
+                emit(CONST, r, 0, 0, static_cast<uint32_t>(value));
+                return;
+            }
+
+            std::string_view name = identifier();
+            if (name.empty()) {
+                fail("expected a value");
+            } else if (name == "true" || name == "false") {
+                emit(CONST, r, 0, 0, name == "true" ? 1 : 0);
+            } else if ((name == "has" || name == "count") && accept("(")) {
+                INVENTORY::ItemId id = item();
+                emit(name == "has" ? HAS : COUNT, r, 0, 0, id);
+            } else if (name == "flag" && accept("(")) {
+                uint32_t var = variable();
+                expect(")", "expected ')'");
+                emit(LOAD, r, 0, 0, var);
+                emit(BOOL, r, r);
+            } else {
+                emit(LOAD, r, 0, 0, variables.intern(name));
+            }
+        }
+
+        std::vector<Instr>& code;
+        Variables& variables;
+        std::string_view text;
+        size_t at = 0;
+        uint32_t first = 0; // of the script being compiled
+        bool failed = false;
+        std::string message;
+    };
+}
+
+#endif
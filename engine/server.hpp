@@ -0,0 +1,507 @@
+#ifndef SERVER_HPP
+#define SERVER_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "memory.hpp"
+#include "output.hpp"
+#include "parser.hpp"
+#include "render.hpp"
+#include "session.hpp"
+#include "story.hpp"
+#include "telemetry.hpp"
+
+#if defined(__linux__)
+#include <arpa/inet.h>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#define SERVER_EPOLL 1
+#endif
+
+namespace SERVER {
+    // Plays a story over TCP, one session per connection, on a few event loop threads
+    // instead of a thread per player. The protocol is the console game's: the server sends
+    // what Game::Run would print, the client sends one number per line (an option, -1 for the
+    // inventory, -2 to leave), or with Options::commands set, what the player does in words.
+    // Everything is non-blocking. Each loop has its own epoll set and its own listening
+    // socket on the shared port (SO_REUSEPORT), so loops share nothing but the story and the
+    // kernel spreads new connections over them.
+    //
+    // Every connection's session and buffers live in its own MEMORY::Arena, freed in one
+    // go when it closes. A connection whose arena grows past Options::sessionQuota is told
+    // so and closed after that turn.
+
+#ifdef SERVER_EPOLL
+    struct Options {
+        std::string address = "127.0.0.1";
+        uint16_t port = 4000;      // 0: any free port, see Server::port()
+        size_t threads = 1;        // event loops
+        size_t maxLine = 64;       // longer input lines close the connection
+        int backlog = 4096;
+        TELEMETRY::Recorder* telemetry = nullptr; // counts every connection's turns if set
+        size_t sessionQuota = 0;   // bytes a connection's arena may hold, 0: no limit
+        const PARSER::Lexicon* commands = nullptr; // built for the story, typed commands if set
+    };
+
+    struct Stats {
+        uint64_t accepted = 0;
+        uint64_t open = 0;
+        uint64_t turns = 0;       // input lines handled
+        uint64_t overQuota = 0;   // connections closed for passing sessionQuota
+        uint64_t sessionPeak = 0; // most bytes one closed connection's arena held
+    };
+
+    class Server {
+    public:
+        Server(const STORY::Story& story, Options options = Options()) : story(story), options(options) {
+            if (this->options.threads == 0) this->options.threads = 1;
+        }
+
+        ~Server() { stop(); }
+
+        Server(const Server&) = delete;
+        Server& operator=(const Server&) = delete;
+
+        // Binds the listeners and starts the loops
+        bool start(std::string* error = nullptr) {
+            if (!loops.empty()) return true;
+            if (story.nodeCount() == 0) return fail(error, "the story has no nodes");
+            uint16_t bound = options.port;
+            for (size_t i = 0; i < options.threads; ++i) {
+                std::unique_ptr<Loop> loop(new Loop());
+                loop->server = this;
+                if (!listen(*loop, bound, error)) {
+                    closeLoop(*loop);
+                    stopLoops();
+                    return false;
+                }
+                loops.push_back(std::move(loop));
+            }
+            boundPort = bound;
+            for (auto& loop : loops) {
+                Loop* target = loop.get();
+                loop->thread = std::thread([target] { target->run(); });
+            }
+            return true;
+        }
+
+        // Closes every connection and joins the loops
+        void stop() { stopLoops(); }
+
+        uint16_t port() const { return boundPort; }
+
+        Stats stats() const {
+            Stats total;
+            for (const auto& loop : loops) {
+                total.accepted += loop->accepted.load(std::memory_order_relaxed);
+                total.open += loop->open.load(std::memory_order_relaxed);
+                total.turns += loop->turns.load(std::memory_order_relaxed);
+                total.overQuota += loop->overQuota.load(std::memory_order_relaxed);
+                total.sessionPeak = std::max(total.sessionPeak, loop->sessionPeak.load(std::memory_order_relaxed));
+            }
+            return total;
+        }
+
+    private:
+        struct Connection {
+            Connection(const STORY::Story& story, size_t quota)
+                : arena(quota), session(story, arena.resource()), input(arena.resource()), pending(arena.resource()) {}
+
+            MEMORY::Arena arena; // first, so it goes last
+            int fd = -1;
+            SESSION::Session session;
+            std::pmr::string input;   // bytes of a line not complete yet
+            std::pmr::string pending; // output the socket did not take yet
+            bool closing = false; // close once pending is out
+            bool waitingWrite = false;
+            bool hungUp = false;  // the client shut its side, only pending is left to send
+        };
+
+        struct Loop {
+            Server* server = nullptr;
+            int epoll = -1;
+            int listener = -1;
+            int wake = -1;
+            int spare = -1; // held in reserve, see acceptAll
+            bool listening = true;
+            std::thread thread;
+            std::vector<std::unique_ptr<Connection>> connections; // by fd
+            OUTPUT::Buffer out;
+            std::vector<uint64_t> available;
+            std::vector<iovec> iov;
+            std::atomic<uint64_t> accepted{ 0 };
+            std::atomic<uint64_t> open{ 0 };
+            std::atomic<uint64_t> turns{ 0 };
+            std::atomic<uint64_t> overQuota{ 0 };
+            std::atomic<uint64_t> sessionPeak{ 0 };
+
+            void run() {
+                epoll_event events[256];
+                while (true) {
+                    int count = epoll_wait(epoll, events, 256, -1);
+                    if (count < 0) {
+                        if (errno == EINTR) continue;
+                        return;
+                    }
+                    for (int i = 0; i < count; ++i) {
+                        int fd = events[i].data.fd;
+                        if (fd == wake) return;
+                        if (fd == listener) {
+                            acceptAll();
+                            continue;
+                        }
+                        Connection* connection = fd < static_cast<int>(connections.size()) ? connections[fd].get() : nullptr;
+                        if (!connection) continue;
+                        if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+                            close(*connection);
+                            continue;
+                        }
+                        if ((events[i].events & EPOLLOUT) && !sendPending(*connection)) continue;
+                        if (events[i].events & EPOLLIN) readInput(*connection);
+                    }
+                }
+            }
+
+            void acceptAll() {
+                while (true) {
+                    int fd = accept4(listener, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+                    if (fd < 0) {
+                        if (errno == EINTR || errno == ECONNABORTED) continue;
+                        if (errno == EMFILE || errno == ENFILE) {
+                            // The listener stays readable while the connection waits, turn it
+                            // away with the spare descriptor. Without one, stop listening until
+                            // a connection closes.
+                            if (spare >= 0) {
+                                ::close(spare);
+                                spare = -1;
+                                int refused = accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+                                if (refused >= 0) ::close(refused);
+                                spare = openSpare();
+                                if (refused < 0) return; // EMFILE comes before looking for a connection, there was none
+                                continue;
+                            }
+                            watchListener(false);
+                        }
+                        return; // EAGAIN
+                    }
+                    int one = 1;
+                    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+                    if (fd >= static_cast<int>(connections.size())) connections.resize(static_cast<size_t>(fd) + 1);
+                    connections[fd].reset(new Connection(server->story, server->options.sessionQuota));
+                    Connection& connection = *connections[fd];
+                    connection.fd = fd;
+                    connection.session.setTelemetry(server->options.telemetry);
+                    epoll_event event{};
+                    event.events = EPOLLIN | EPOLLRDHUP;
+                    event.data.fd = fd;
+                    epoll_ctl(epoll, EPOLL_CTL_ADD, fd, &event);
+                    accepted.fetch_add(1, std::memory_order_relaxed);
+                    open.fetch_add(1, std::memory_order_relaxed);
+
+                    SESSION::TurnResult turn = connection.session.start();
+                    RENDER::arrival(out, server->story, turn, availableNow(connection));
+                    finishTurn(connection, turn.ended);
+                }
+            }
+
+            void readInput(Connection& connection) {
+                char chunk[4096];
+                while (true) {
+                    ssize_t got = ::read(connection.fd, chunk, sizeof(chunk));
+                    if (got > 0) {
+                        if (connection.closing) continue; // leaving, input is ignored
+                        connection.input.append(chunk, static_cast<size_t>(got));
+                        size_t start = 0;
+                        size_t end;
+                        while ((end = connection.input.find('\n', start)) != std::string::npos) {
+                            if (end - start > server->options.maxLine) {
+                                close(connection);
+                                return;
+                            }
+                            if (!handleLine(connection, std::string_view(connection.input).substr(start, end - start))) return;
+                            start = end + 1;
+                        }
+                        connection.input.erase(0, start);
+                        if (connection.input.size() > server->options.maxLine) {
+                            close(connection);
+                            return;
+                        }
+                        continue;
+                    }
+                    if (got < 0 && errno == EINTR) continue;
+                    if (got < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return;
+                    if (got == 0 && !connection.pending.empty()) {
+                        // the client is done sending but may still be reading: finish the output
+                        connection.closing = true;
+                        connection.hungUp = true;
+                        watch(connection);
+                        return;
+                    }
+                    close(connection); // the client hung up (or the socket failed)
+                    return;
+                }
+            }
+
+            // One line of input, what the console game does in one pass of its input loop.
+            // Returns false once the connection is gone.
+            bool handleLine(Connection& connection, std::string_view line) {
+                turns.fetch_add(1, std::memory_order_relaxed);
+                if (connection.closing) return true;
+                const STORY::Story& story = server->story;
+                SESSION::Session& session = connection.session;
+
+                int choice = 0;
+                STORY::NodeId node = session.node();
+                if (!PARSER::number(line, choice)) {
+                    const PARSER::Lexicon* commands = server->options.commands;
+                    if (!commands) {
+                        out << "Invalid input. Please enter a number: ";
+                        return send(connection);
+                    }
+                    PARSER::Result result = commands->match(story, node, line, &session.inventory());
+                    choice = PARSER::choice(result);
+                    if (choice == 0) {
+                        PARSER::explain(out, result);
+                        return send(connection);
+                    }
+                }
+                if (choice == -1) {
+                    out << "\n";
+                    RENDER::inventory(out, session.inventory());
+                    RENDER::node(out, story, node);
+                    RENDER::options(out, story, node, availableNow(connection));
+                } else if (choice == -2) {
+                    connection.closing = true;
+                    return send(connection);
+                } else if (choice == -3) {
+                    out << "\n[INFO] Saving is not available here.\n";
+                } else if (choice == -4) {
+                    out << "\n[INFO] Undo is not available here.\n";
+                } else {
+                    SESSION::TurnResult turn = session.step(choice - 1);
+                    if (turn.status == SESSION::INVALID_CHOICE) {
+                        out << "Please enter an existing option number (1 - " << story.node(node).optionCount << ").";
+                    } else if (turn.status == SESSION::LOCKED) {
+                        out << "You can't do that right now.";
+                    } else {
+                        RENDER::turn(out, story, turn, turn.ended ? nullptr : availableNow(connection));
+                        return finishTurn(connection, turn.ended);
+                    }
+                }
+                return finishTurn(connection, false);
+            }
+
+            // Prompts for the next choice, or says goodbye after the last node
+            bool finishTurn(Connection& connection, bool ended) {
+                if (ended) {
+                    connection.closing = true;
+                } else if (connection.arena.over()) {
+                    out << "\n[INFO] This game has used more memory than it may. Goodbye.\n";
+                    connection.closing = true;
+                    overQuota.fetch_add(1, std::memory_order_relaxed);
+                } else {
+                    RENDER::prompt(out, false, server->options.commands != nullptr, false);
+                }
+                return send(connection);
+            }
+
+            // Options whose condition does not hold are shown as unavailable, like the game
+            const uint64_t* availableNow(const Connection& connection) {
+                const STORY::Story& story = server->story;
+                if (story.code.size == 0 || connection.session.node() == STORY::NO_NODE) return nullptr;
+                uint32_t count = story.node(connection.session.node()).optionCount;
+                available.assign(std::max<size_t>(1, (count + 63) / 64), ~uint64_t(0));
+                for (uint32_t i = 0; i < count; ++i) {
+                    if (!connection.session.allowed(i)) available[i >> 6] &= ~(uint64_t(1) << (i & 63));
+                }
+                return available.data();
+            }
+
+            // Writes the rendered turn, whatever the socket does not take now waits in pending.
+            // Returns false if the connection was closed.
+            bool send(Connection& connection) {
+                if (!connection.pending.empty()) {
+                    out.appendTo(connection.pending);
+                    out.clear();
+                    return true; // EPOLLOUT is already armed
+                }
+                iov.resize(out.pieceCount());
+                size_t total = 0;
+                for (size_t i = 0; i < out.pieceCount(); ++i) {
+                    std::string_view text = out.piece(i);
+                    iov[i].iov_base = const_cast<char*>(text.data());
+                    iov[i].iov_len = text.size();
+                    total += text.size();
+                }
+                ssize_t result;
+                do {
+                    result = ::writev(connection.fd, iov.data(), static_cast<int>(std::min<size_t>(iov.size(), IOV_MAX)));
+                } while (result < 0 && errno == EINTR);
+                if (result < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+                    out.clear();
+                    close(connection);
+                    return false;
+                }
+                size_t written = result < 0 ? 0 : static_cast<size_t>(result);
+                if (written < total) {
+                    // the unwritten tail goes straight into pending, which lives in the connection's arena
+                    connection.pending.reserve(total - written);
+                    for (size_t i = 0; i < out.pieceCount(); ++i) {
+                        std::string_view text = out.piece(i);
+                        size_t skip = std::min(written, text.size());
+                        written -= skip;
+                        connection.pending.append(text.data() + skip, text.size() - skip);
+                    }
+                    watchWrites(connection, true);
+                }
+                out.clear();
+                if (connection.pending.empty() && connection.closing) {
+                    close(connection);
+                    return false;
+                }
+                return true;
+            }
+
+            bool sendPending(Connection& connection) {
+                while (!connection.pending.empty()) {
+                    ssize_t result = ::write(connection.fd, connection.pending.data(), connection.pending.size());
+                    if (result < 0) {
+                        if (errno == EINTR) continue;
+                        if (errno == EAGAIN || errno == EWOULDBLOCK) return true;
+                        close(connection);
+                        return false;
+                    }
+                    connection.pending.erase(0, static_cast<size_t>(result));
+                }
+                watchWrites(connection, false);
+                if (connection.closing) {
+                    close(connection);
+                    return false;
+                }
+                return true;
+            }
+
+            static int openSpare() { return ::open("/dev/null", O_RDONLY | O_CLOEXEC); }
+
+            void watchListener(bool watch) {
+                if (listening == watch) return;
+                listening = watch;
+                epoll_event event{};
+                event.events = EPOLLIN;
+                event.data.fd = listener;
+                epoll_ctl(epoll, watch ? EPOLL_CTL_ADD : EPOLL_CTL_DEL, listener, &event);
+            }
+
+            void watchWrites(Connection& connection, bool writes) {
+                if (connection.waitingWrite == writes) return;
+                connection.waitingWrite = writes;
+                watch(connection);
+            }
+
+            // Input until the client hangs up, output while some is pending
+            void watch(Connection& connection) {
+                epoll_event event{};
+                event.events = (connection.hungUp ? 0u : static_cast<uint32_t>(EPOLLIN | EPOLLRDHUP))
+                               | (connection.waitingWrite ? static_cast<uint32_t>(EPOLLOUT) : 0u);
+                event.data.fd = connection.fd;
+                epoll_ctl(epoll, EPOLL_CTL_MOD, connection.fd, &event);
+            }
+
+            void close(Connection& connection) {
+                int fd = connection.fd;
+                epoll_ctl(epoll, EPOLL_CTL_DEL, fd, nullptr);
+                ::close(fd);
+                if (connection.arena.peak() > sessionPeak.load(std::memory_order_relaxed)) {
+                    sessionPeak.store(connection.arena.peak(), std::memory_order_relaxed);
+                }
+                connections[fd].reset();
+                open.fetch_sub(1, std::memory_order_relaxed);
+                if (spare < 0) spare = openSpare();
+                watchListener(true);
+            }
+        };
+
+        static bool fail(std::string* error, const std::string& message) {
+            if (error) *error = message;
+            return false;
+        }
+
+        bool listen(Loop& loop, uint16_t& port, std::string* error) {
+            loop.epoll = epoll_create1(EPOLL_CLOEXEC);
+            loop.wake = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+            loop.listener = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+            loop.spare = Loop::openSpare();
+            if (loop.epoll < 0 || loop.wake < 0 || loop.listener < 0 || loop.spare < 0) return fail(error, std::string("cannot create sockets: ") + std::strerror(errno));
+
+            int one = 1;
+            setsockopt(loop.listener, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+            setsockopt(loop.listener, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one));
+            sockaddr_in address{};
+            address.sin_family = AF_INET;
+            address.sin_port = htons(port);
+            if (inet_pton(AF_INET, options.address.c_str(), &address.sin_addr) != 1) return fail(error, "bad address " + options.address);
+            if (bind(loop.listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 || ::listen(loop.listener, options.backlog) != 0) {
+                return fail(error, "cannot listen on " + options.address + ":" + std::to_string(port) + ": " + std::strerror(errno));
+            }
+            socklen_t length = sizeof(address);
+            getsockname(loop.listener, reinterpret_cast<sockaddr*>(&address), &length);
+            port = ntohs(address.sin_port); // the other loops join the port the first one got
+
+            epoll_event event{};
+            event.events = EPOLLIN;
+            event.data.fd = loop.listener;
+            epoll_ctl(loop.epoll, EPOLL_CTL_ADD, loop.listener, &event);
+            event.data.fd = loop.wake;
+            epoll_ctl(loop.epoll, EPOLL_CTL_ADD, loop.wake, &event);
+            return true;
+        }
+
+        static void closeLoop(Loop& loop) {
+            for (auto& connection : loop.connections) {
+                if (connection) ::close(connection->fd);
+            }
+            loop.connections.clear();
+            loop.open.store(0, std::memory_order_relaxed);
+            for (int fd : { loop.listener, loop.wake, loop.epoll, loop.spare }) {
+                if (fd >= 0) ::close(fd);
+            }
+            loop.listener = loop.wake = loop.epoll = loop.spare = -1;
+        }
+
+        void stopLoops() {
+            for (auto& loop : loops) {
+                uint64_t one = 1;
+                if (loop->thread.joinable() && ::write(loop->wake, &one, sizeof(one)) < 0) {}
+            }
+            for (auto& loop : loops) {
+                if (loop->thread.joinable()) loop->thread.join();
+                closeLoop(*loop);
+            }
+            loops.clear();
+        }
+
+        const STORY::Story& story;
+        Options options;
+        std::vector<std::unique_ptr<Loop>> loops;
+        uint16_t boundPort = 0;
+    };
+#endif
+}
+
+#endif
@@ -0,0 +1,302 @@
+#ifndef SESSION_HPP
+#define SESSION_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <memory_resource>
+#include <utility>
+#include <vector>
+
+#include "action.hpp"
+#include "inventory.hpp"
+#include "script.hpp"
+#include "story.hpp"
+#include "telemetry.hpp"
+
+namespace SESSION {
+    // One player's progress through a story: the current node and the inventory. A Session
+    // never reads input or prints, step() applies the rules of a turn and returns what
+    // happened. Sessions only read the story, so any number of them can share one.
+    //
+    // The inventory and the variables are kept copy-on-write: copying a session or taking a
+    // snapshot shares them, and a session gets its own copy the first time a turn writes to
+    // them while they are shared. Turns without actions or effects never copy anything.
+    //
+    // A session made with a memory resource (usually a MEMORY::Arena) keeps its state and
+    // every copy of it there; its snapshots and forks must not outlive the resource.
+
+    enum STATUS {
+        OK,
+        INVALID_CHOICE, // nothing changed
+        ENDED,          // the session already reached an end node
+        LOCKED          // the option's condition does not hold, nothing changed
+    };
+
+    // One action that ran (or was skipped) during a turn. items points into the story.
+    struct ActionReport {
+        ACTION::TYPE type = ACTION::TYPE::NONE;
+        ACTION::RESULT result = ACTION::RESULT::NOTHING;
+        const INVENTORY::ItemId* items = nullptr;
+        uint32_t itemCount = 0;
+        INVENTORY::ItemId useItem = INVENTORY::NO_ITEM;
+        uint32_t count = 1; // of each item
+    };
+
+    // The reports of one action list, in the order the actions ran
+    struct ActionReports {
+        ActionReport at[ACTION::MAX_ACTIONS];
+        uint32_t count = 0;
+
+        void add(const ActionReport& report) {
+            if (count < ACTION::MAX_ACTIONS) at[count++] = report; // stories never have longer lists
+        }
+
+        const ActionReport* begin() const { return at; }
+        const ActionReport* end() const { return at + count; }
+    };
+
+    struct TurnResult {
+        STATUS status = OK;
+        STORY::NodeId node = STORY::NO_NODE; // node the player is in after the turn
+        ActionReports optionActions;         // actions of the chosen option
+        ActionReports enterActions;          // on enter actions of the node that was entered
+        bool ended = false;                  // node is an end node
+    };
+
+    // The rules for one action: see ACTION::run
+    template<typename Inv>
+    ActionReport runAction(const STORY::Story& story, Inv& inv, const ACTION::Operands& action) {
+        ActionReport report;
+        report.type = static_cast<ACTION::TYPE>(action.opcode);
+        report.items = story.pickupItems(action);
+        report.itemCount = action.itemCount;
+        report.useItem = action.item;
+        report.count = action.count;
+        report.result = ACTION::run(inv, action, report.items);
+        return report;
+    }
+
+    // Runs the actions of a node or option in order and hands each report to onAction
+    template<typename Inv, typename OnAction>
+    void runActions(const STORY::Story& story, Inv& inv, STORY::ActionRange actions, OnAction&& onAction) {
+        const ACTION::Operands* list = story.actionList(actions);
+        for (uint32_t i = 0; i < actions.count; ++i) {
+            onAction(runAction(story, inv, list[i]));
+        }
+    }
+
+    // Whether an option's condition holds, vars has story.variables.size entries
+    template<typename Inv>
+    bool allowed(const STORY::Story& story, const STORY::OptionRecord& option, const Inv& inv, const int32_t* vars) {
+        return SCRIPT::test(story.script(option.condition), option.condition.count, inv, vars);
+    }
+
+    template<typename Inv>
+    void runEffect(const STORY::Story& story, SCRIPT::ScriptRef effect, const Inv& inv, int32_t* vars) {
+        SCRIPT::run(story.script(effect), effect.count, inv, vars);
+    }
+
+    // What a turn can change besides the node, shared between sessions and snapshots until
+    // one of them writes
+    struct State {
+        typedef INVENTORY::Allocator allocator_type;
+
+        INVENTORY::Inventory inv;
+        std::pmr::vector<int32_t> vars; // story.variables.size of them, fixed once the session starts
+
+        State() = default;
+        explicit State(const allocator_type& alloc) : inv(alloc), vars(alloc) {}
+        State(const State& other, const allocator_type& alloc) : inv(other.inv, alloc), vars(other.vars, alloc) {}
+    };
+
+    // A session as it was after some turn. Taking one costs a reference count, restoring
+    // it (Session::rewind) as much.
+    struct Snapshot {
+        const STORY::Story* story = nullptr;
+        STORY::NodeId node = STORY::NO_NODE;
+        bool finished = false;
+        std::shared_ptr<State> state; // never written while a snapshot holds it
+
+        const INVENTORY::Inventory& inventory() const { return state->inv; }
+        const std::pmr::vector<int32_t>& variables() const { return state->vars; }
+    };
+
+    class Session {
+    public:
+        // memory: where the state lives, nullptr for the default heap
+        explicit Session(const STORY::Story& story, std::pmr::memory_resource* memory = nullptr)
+            : story(&story), memory(memory ? memory : std::pmr::get_default_resource()) {
+            state = std::allocate_shared<State>(INVENTORY::Allocator(this->memory));
+            state->vars.assign(story.variables.size, 0);
+        }
+        Session(const STORY::Story& story, INVENTORY::Inventory inventory, std::pmr::memory_resource* memory = nullptr)
+            : Session(story, memory) {
+            state->inv = std::move(inventory);
+        }
+
+        // Enters the story's root node (running its on enter action)
+        TurnResult start() {
+            return start(story->root);
+        }
+
+        TurnResult start(STORY::NodeId node) {
+            TurnResult result;
+            result.node = node;
+            enter(node, result, counts());
+            return result;
+        }
+
+        // Puts the session at node without running its on enter action, used by save games.
+        // Variables are reset to 0 unless given (story.variables.size of them).
+        void restore(STORY::NodeId node, INVENTORY::Inventory inventory, const std::pmr::vector<int32_t>* variables = nullptr) {
+            std::shared_ptr<State> fresh = std::allocate_shared<State>(INVENTORY::Allocator(memory));
+            fresh->inv = std::move(inventory);
+            if (variables && variables->size() == story->variables.size) fresh->vars.assign(variables->begin(), variables->end());
+            else fresh->vars.assign(story->variables.size, 0);
+            state = std::move(fresh);
+            current = node;
+            finished = story->isEndNode(node);
+        }
+
+        // Moves the session to another version of its story (see RELOAD), at node (NO_NODE:
+        // not started) with variables laid out for that story. The inventory stays as it is.
+        void migrate(const STORY::Story& next, STORY::NodeId node, const std::pmr::vector<int32_t>& variables) {
+            story = &next;
+            own().vars.assign(variables.begin(), variables.end());
+            current = node;
+            finished = node != STORY::NO_NODE && next.isEndNode(node);
+            if (telemetry && !telemetry->covers(next)) telemetry = nullptr;
+        }
+
+        // This session as it is now, see Snapshot
+        Snapshot snapshot() const {
+            Snapshot snap;
+            snap.story = story;
+            snap.node = current;
+            snap.finished = finished;
+            snap.state = state;
+            return snap;
+        }
+
+        // Goes back to a snapshot of this session (or of any session of the same story)
+        void rewind(const Snapshot& snap) {
+            if (story != snap.story && telemetry && !telemetry->covers(*snap.story)) telemetry = nullptr;
+            story = snap.story;
+            current = snap.node;
+            finished = snap.finished;
+            state = snap.state;
+        }
+
+        // A second session that goes on from here on its own. It shares this one's state
+        // until either of them writes, so thousands of forks cost little more than their
+        // differences. Same as copying the session.
+        Session fork() const { return *this; }
+
+        // Counts this session's turns in recorder (nullptr: stop counting). The recorder must
+        // be for this session's story and outlive the session's use of it.
+        void setTelemetry(TELEMETRY::Recorder* recorder) {
+            telemetry = recorder && recorder->covers(*story) ? recorder : nullptr;
+        }
+
+        // Takes option `choice` (0-based) of the current node
+        TurnResult step(int choice) {
+            std::chrono::steady_clock::time_point begin;
+            TELEMETRY::Recorder::Shard* shard = counts();
+            bool timed = shard && shard->sampleTurn();
+            if (timed) begin = std::chrono::steady_clock::now();
+            TurnResult result;
+            result.node = current;
+            if (finished || current == STORY::NO_NODE) {
+                result.status = ENDED;
+                result.ended = finished;
+                return result;
+            }
+
+            const STORY::NodeRecord& node = story->node(current);
+            if (choice < 0 || static_cast<uint32_t>(choice) >= node.optionCount) {
+                result.status = INVALID_CHOICE;
+                return result;
+            }
+
+            const STORY::OptionRecord& option = story->option(current, static_cast<size_t>(choice));
+            if (!SESSION::allowed(*story, option, state->inv, state->vars.data())) {
+                result.status = LOCKED;
+                return result;
+            }
+            if (shard) shard->pickOption(node.firstOption + static_cast<uint32_t>(choice));
+            act(option.actions, result.optionActions, shard);
+            if (option.effect.count != 0) own();
+            runEffect(*story, option.effect, state->inv, state->vars.data());
+
+            result.node = option.next;
+            enter(option.next, result, shard);
+            if (timed) {
+                shard->turn(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - begin).count()));
+            }
+            return result;
+        }
+
+        const STORY::Story& getStory() const { return *story; }
+        STORY::NodeId node() const { return current; }
+        bool ended() const { return finished; }
+        const INVENTORY::Inventory& inventory() const { return state->inv; }
+        INVENTORY::Inventory& inventory() { return own().inv; } // copies a shared state first
+        const std::pmr::vector<int32_t>& variables() const { return state->vars; }
+        std::pmr::memory_resource* resource() const { return memory; } // where the state lives
+
+        // Whether option `choice` of the current node can be taken right now
+        bool allowed(size_t choice) const {
+            if (current == STORY::NO_NODE || choice >= story->node(current).optionCount) return false;
+            return SESSION::allowed(*story, story->option(current, choice), state->inv, state->vars.data());
+        }
+
+    private:
+        // This thread's counters in the session's recorder, looked up once per turn
+        TELEMETRY::Recorder::Shard* counts() const {
+            return TELEMETRY::ENABLED && telemetry ? &telemetry->local() : nullptr;
+        }
+
+        void enter(STORY::NodeId node, TurnResult& result, TELEMETRY::Recorder::Shard* shard) {
+            current = node;
+            const STORY::NodeRecord& record = story->node(node);
+            if (shard) shard->enterNode(node);
+            act(record.actions, result.enterActions, shard);
+            if (record.effect.count != 0) own();
+            runEffect(*story, record.effect, state->inv, state->vars.data());
+            finished = story->isEndNode(node);
+            result.ended = finished;
+        }
+
+        // runActions, copying a shared state only for an action that is going to write it
+        void act(STORY::ActionRange actions, ActionReports& reports, TELEMETRY::Recorder::Shard* shard) {
+            const ACTION::Operands* list = story->actionList(actions);
+            for (uint32_t i = 0; i < actions.count; ++i) {
+                if (ACTION::writes(state->inv, list[i], story->pickupItems(list[i]))) own();
+                ActionReport report = runAction(*story, state->inv, list[i]);
+                reports.add(report);
+                if (shard) shard->action(report.type, report.result);
+            }
+        }
+
+        // The state, made this session's own before it is written. A count of 1 means no
+        // snapshot or other session can see it; the fence orders the writes after the reads
+        // of whoever dropped the last other reference.
+        State& own() {
+            if (state.use_count() != 1) state = std::allocate_shared<State>(INVENTORY::Allocator(memory), *state);
+            else std::atomic_thread_fence(std::memory_order_acquire);
+            return *state;
+        }
+
+        const STORY::Story* story;
+        std::pmr::memory_resource* memory;
+        STORY::NodeId current = STORY::NO_NODE;
+        std::shared_ptr<State> state;
+        bool finished = false;
+        TELEMETRY::Recorder* telemetry = nullptr;
+    };
+}
+
+#endif
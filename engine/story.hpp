@@ -0,0 +1,400 @@
+#ifndef STORY_HPP
+#define STORY_HPP
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_map>
+#include <memory>
+#include <cstdint>
+
+#include "action.hpp"
+#include "inventory.hpp"
+#include "nodes.hpp"
+#include "script.hpp"
+
+namespace STORY {
+    // A compiled, flat story graph. Nodes live in one array in BFS order (the root is node 0),
+    // the options of node i are the contiguous range [firstOption, firstOption + optionCount)
+    // of the option array (compressed sparse rows), and all text sits in one string pool.
+    // Traversal is a plain integer index, no shared_ptr refcounting. What a node does on
+    // enter and what an option does are short runs of the action array, in the order they run.
+
+    typedef uint32_t NodeId;
+    static const NodeId NO_NODE = 0xFFFFFFFFu;
+
+    // Slice of the text pool
+    struct TextRef {
+        uint32_t offset = 0;
+        uint32_t length = 0;
+    };
+
+    // Slice of the pickup item array
+    struct ItemRange {
+        uint32_t first = 0;
+        uint32_t count = 0;
+    };
+
+    // Slice of the action array, at most ACTION::MAX_ACTIONS long
+    struct ActionRange {
+        uint32_t first = 0;
+        uint32_t count = 0;
+    };
+
+    struct NodeRecord {
+        TextRef text;
+        uint32_t firstOption = 0;
+        uint32_t optionCount = 0;
+        ActionRange actions; // on enter
+        SCRIPT::ScriptRef effect; // on enter, after the actions
+    };
+
+    struct OptionRecord {
+        TextRef text;
+        NodeId next = NO_NODE; // the edge, options and edges share the same row
+        ActionRange actions;
+        SCRIPT::ScriptRef condition; // the option is locked while this is false
+        SCRIPT::ScriptRef effect;    // after the actions
+    };
+
+    // A run of nodes whose text (and the text of their options) is stored together and paged
+    // in as one piece, see STREAM. Text refs of those nodes and options are offsets into it.
+    struct ChapterRecord {
+        NodeId firstNode = 0;
+        uint32_t nodeCount = 0;
+        uint64_t offset = 0; // into the story file's chapter text
+        uint32_t bytes = 0;
+        uint32_t reserved = 0;
+    };
+
+    // Read-only view of one of the story arrays. The arrays are either owned by the story
+    // (compiled in memory) or point straight into a mapped story file.
+    template<typename T>
+    struct Table {
+        const T* data = nullptr;
+        uint32_t size = 0;
+
+        const T& operator[](size_t index) const { return data[index]; }
+        const T* begin() const { return data; }
+        const T* end() const { return data + size; }
+    };
+
+    // Heap backing for stories compiled in memory
+    struct Storage {
+        std::vector<NodeRecord> nodes;
+        std::vector<OptionRecord> options;
+        std::vector<ACTION::Operands> actions;
+        std::vector<INVENTORY::ItemId> pickups;
+        std::vector<INVENTORY::ItemId> items;
+        std::vector<SCRIPT::Instr> code;
+        std::vector<TextRef> variables;
+        std::vector<ChapterRecord> chapters;
+        std::vector<uint64_t> keys;
+        std::string textPool;
+    };
+
+    class Story {
+    public:
+        NodeId root = 0;
+        uint64_t hash = 0; // identifies this version of the story, see computeHash
+        Table<NodeRecord> nodes;
+        Table<OptionRecord> options;
+        Table<ACTION::Operands> actions;  // action lists of every node and option
+        Table<INVENTORY::ItemId> pickups; // item lists of every action
+        Table<INVENTORY::ItemId> items;   // every item the story mentions, by id
+        Table<SCRIPT::Instr> code;        // conditions and effects
+        Table<TextRef> variables;         // names of the script variables, in the text pool
+        Table<ChapterRecord> chapters;    // streamed stories only: node and option text is in these, not the pool
+        Table<uint64_t> keys;             // stable key of every node (or none), see nodeKey
+        std::string_view textPool;
+
+        // Keeps whatever the tables point into alive, copies of a Story share it
+        std::shared_ptr<const void> storage;
+
+        size_t nodeCount() const { return nodes.size; }
+        const NodeRecord& node(NodeId id) const { return nodes[id]; }
+
+        const OptionRecord& option(NodeId id, size_t index) const {
+            return options[nodes[id].firstOption + index];
+        }
+
+        std::string_view text(TextRef ref) const {
+            return textPool.substr(ref.offset, ref.length);
+        }
+
+        const INVENTORY::ItemId* pickupItems(ItemRange range) const {
+            return pickups.data + range.first;
+        }
+
+        const INVENTORY::ItemId* pickupItems(const ACTION::Operands& action) const {
+            return pickups.data + action.firstItem;
+        }
+
+        const ACTION::Operands* actionList(ActionRange range) const {
+            return actions.data + range.first;
+        }
+
+        const SCRIPT::Instr* script(SCRIPT::ScriptRef ref) const {
+            return code.data + ref.first;
+        }
+
+        bool isEndNode(NodeId id) const {
+            return nodes[id].optionCount == 0;
+        }
+
+        // Points the tables at heap arrays
+        static Story fromStorage(std::shared_ptr<const Storage> arrays, NodeId root = 0) {
+            Story story;
+            story.root = root;
+            story.nodes = table(arrays->nodes);
+            story.options = table(arrays->options);
+            story.actions = table(arrays->actions);
+            story.pickups = table(arrays->pickups);
+            story.items = table(arrays->items);
+            story.code = table(arrays->code);
+            story.variables = table(arrays->variables);
+            story.chapters = table(arrays->chapters);
+            story.keys = table(arrays->keys);
+            story.textPool = arrays->textPool;
+            story.storage = std::move(arrays);
+            return story;
+        }
+
+    private:
+        template<typename T>
+        static Table<T> table(const std::vector<T>& vec) {
+            Table<T> result;
+            result.data = vec.data();
+            result.size = static_cast<uint32_t>(vec.size());
+            return result;
+        }
+    };
+
+    // Node keys name a node the same way in every version of a story, so a session can find
+    // where it was after the story is reloaded (see RELOAD). Node ids do not do that, they
+    // are BFS positions and move when nodes are added. A named node's key is its name; other
+    // nodes are keyed by their text and how many nodes before them have the same text.
+    constexpr uint64_t nodeKey(std::string_view name, uint64_t salt = 0) {
+        uint64_t hash = 1469598103934665603ull ^ salt;
+        for (char c : name) hash = (hash ^ static_cast<unsigned char>(c)) * 1099511628211ull;
+        return hash;
+    }
+
+    inline uint64_t textKey(std::string_view text, uint32_t ordinal) {
+        return nodeKey(text, (uint64_t(ordinal) + 1) * 0x9E3779B97F4A7C15ull);
+    }
+
+    // FNV-1a over the story's structure, text and item names. Item ids are hashed as catalog
+    // indices and names, so the same story hashes the same in every process and file.
+    inline uint64_t computeHash(const Story& story) {
+        uint64_t hash = 1469598103934665603ull;
+        auto mix = [&](const void* data, size_t size) {
+            const unsigned char* bytes = static_cast<const unsigned char*>(data);
+            for (size_t i = 0; i < size; ++i) {
+                hash = (hash ^ bytes[i]) * 1099511628211ull;
+            }
+        };
+        auto mixWord = [&](uint32_t word) { mix(&word, sizeof(word)); };
+
+        std::unordered_map<INVENTORY::ItemId, uint32_t> catalogIndex;
+        for (uint32_t i = 0; i < story.items.size; ++i) {
+            catalogIndex.emplace(story.items[i], i);
+            std::string_view name = INVENTORY::itemTable().name(story.items[i]);
+            mix(name.data(), name.size());
+            mix("", 1);
+        }
+        auto mixItem = [&](INVENTORY::ItemId id) {
+            mixWord(id == INVENTORY::NO_ITEM ? id : catalogIndex.at(id));
+        };
+
+        mixWord(story.root);
+        for (const auto& node : story.nodes) {
+            mixWord(node.text.offset); mixWord(node.text.length);
+            mixWord(node.firstOption); mixWord(node.optionCount);
+            mixWord(node.actions.first); mixWord(node.actions.count);
+            mixWord(node.effect.first); mixWord(node.effect.count);
+        }
+        for (const auto& option : story.options) {
+            mixWord(option.text.offset); mixWord(option.text.length);
+            mixWord(option.next);
+            mixWord(option.actions.first); mixWord(option.actions.count);
+            mixWord(option.condition.first); mixWord(option.condition.count);
+            mixWord(option.effect.first); mixWord(option.effect.count);
+        }
+        for (const auto& action : story.actions) {
+            mixWord(action.opcode);
+            mixWord(action.firstItem); mixWord(action.itemCount);
+            mixItem(action.item); mixWord(action.count);
+        }
+        for (auto id : story.pickups) mixItem(id);
+        for (const auto& in : story.code) {
+            mixWord(uint32_t(in.op) | uint32_t(in.dst) << 8 | uint32_t(in.a) << 16 | uint32_t(in.b) << 24);
+            if (in.op == SCRIPT::HAS || in.op == SCRIPT::COUNT) mixItem(in.arg); else mixWord(in.arg);
+        }
+        for (const auto& name : story.variables) {
+            mixWord(name.offset); mixWord(name.length);
+        }
+        mix(story.textPool.data(), story.textPool.size());
+        return hash;
+    }
+
+    // What compile() did with the story text
+    struct BuildStats {
+        size_t texts = 0;       // node and option texts
+        size_t uniqueTexts = 0;
+        size_t textBytes = 0;   // all of them, counting repeats
+        size_t poolBytes = 0;   // the story's text pool
+
+        size_t savedBytes() const { return textBytes - poolBytes; }
+    };
+
+    // Builder helpers, these only run while compiling
+    typedef std::unordered_map<std::string_view, TextRef> TextIndex;
+
+    // Repeated text is stored once and shared by every record that uses it. The index keys
+    // point at the source text, which outlives the compile.
+    inline TextRef addText(Storage& story, TextIndex& index, std::string_view text, BuildStats& stats) {
+        ++stats.texts;
+        stats.textBytes += text.size();
+        auto it = index.find(text);
+        if (it != index.end()) return it->second;
+
+        TextRef ref;
+        ref.offset = static_cast<uint32_t>(story.textPool.size());
+        ref.length = static_cast<uint32_t>(text.size());
+        story.textPool.append(text.data(), text.size());
+        index.emplace(text, ref);
+        ++stats.uniqueTexts;
+        stats.poolBytes += text.size();
+        return ref;
+    }
+
+    inline ItemRange addItems(Storage& story, const INVENTORY::ItemVec& items) {
+        ItemRange range;
+        range.first = static_cast<uint32_t>(story.pickups.size());
+        range.count = static_cast<uint32_t>(items.size());
+        for (const auto& item : items) {
+            story.pickups.push_back(item.id);
+        }
+        return range;
+    }
+
+    // A node's or option's action as a list of operand records (none for NONE)
+    inline ActionRange addAction(Storage& story, const ACTION::Action& action, const INVENTORY::ItemVec& items, const INVENTORY::Item& useItem) {
+        ActionRange range;
+        range.first = static_cast<uint32_t>(story.actions.size());
+        if (action.type == ACTION::TYPE::NONE) return range;
+
+        ItemRange itemRange = addItems(story, items);
+        ACTION::Operands operands;
+        operands.opcode = action.type;
+        operands.firstItem = itemRange.first;
+        operands.itemCount = itemRange.count;
+        operands.item = useItem.id;
+        operands.count = action.count;
+        story.actions.push_back(operands);
+        range.count = 1;
+        return range;
+    }
+
+    // Flattens the node graph reachable from rootNode into a Story, stats (if given) gets
+    // how much text deduplication saved. Conditions and effects are compiled here; if one
+    // does not compile the story comes back empty (no nodes) with error set.
+    inline Story compile(const NODE::NodePtr& rootNode, BuildStats* stats = nullptr, std::string* error = nullptr) {
+        BuildStats localStats;
+        if (!stats) stats = &localStats;
+        *stats = BuildStats();
+        auto arrays = std::make_shared<Storage>();
+        Storage& story = *arrays;
+        if (!rootNode) return Story::fromStorage(arrays);
+
+        SCRIPT::Variables variables;
+        SCRIPT::Compiler scripts(story.code, variables);
+        bool scriptsOk = true;
+        auto script = [&](std::string_view source, bool isCondition) {
+            SCRIPT::ScriptRef ref;
+            if (source.empty() || !scriptsOk) return ref;
+            std::string message;
+            bool ok = isCondition ? scripts.condition(source, ref, &message) : scripts.effect(source, ref, &message);
+            if (!ok) {
+                scriptsOk = false;
+                if (error) *error = (isCondition ? "condition: " : "effect: ") + message;
+            }
+            return ref;
+        };
+
+        // number nodes in BFS order so neighbours end up close together
+        std::unordered_map<const NODE::Node*, NodeId> ids;
+        std::vector<const NODE::Node*> order;
+        ids.emplace(rootNode.get(), 0);
+        order.push_back(rootNode.get());
+        for (size_t i = 0; i < order.size(); ++i) {
+            for (const auto& next : order[i]->nextNodes) {
+                if (ids.emplace(next.get(), static_cast<NodeId>(order.size())).second) {
+                    order.push_back(next.get());
+                }
+            }
+        }
+
+        TextIndex textIndex;
+        std::unordered_map<std::string_view, uint32_t> textOrdinal; // of unnamed nodes
+        std::vector<bool> seenItem;
+        auto noteItem = [&](INVENTORY::ItemId id) {
+            if (id == INVENTORY::NO_ITEM) return;
+            if (id >= seenItem.size()) seenItem.resize(id + 1, false);
+            if (!seenItem[id]) {
+                seenItem[id] = true;
+                story.items.push_back(id);
+            }
+        };
+
+        story.nodes.reserve(order.size());
+        story.keys.reserve(order.size());
+        for (const NODE::Node* node : order) {
+            story.keys.push_back(node->key.empty() ? textKey(node->text, textOrdinal[node->text]++) : nodeKey(node->key));
+            NodeRecord record;
+            record.text = addText(story, textIndex, node->text, *stats);
+            record.firstOption = static_cast<uint32_t>(story.options.size());
+            record.optionCount = static_cast<uint32_t>(node->options.size());
+            record.actions = addAction(story, node->onEnterAction, node->onEnterPickupItems, node->onEnterUseItem);
+            record.effect = script(node->onEnterEffect, false);
+            noteItem(node->onEnterUseItem.id);
+            for (const auto& item : node->onEnterPickupItems) noteItem(item.id);
+
+            for (size_t i = 0; i < node->options.size(); ++i) {
+                const NODE::Option& option = node->options[i];
+                OptionRecord optionRecord;
+                optionRecord.text = addText(story, textIndex, option.text, *stats);
+                optionRecord.next = ids[node->nextNodes[i].get()];
+                optionRecord.actions = addAction(story, option.useAction, option.pickupItems, option.useItem);
+                optionRecord.condition = script(option.condition, true);
+                optionRecord.effect = script(option.effect, false);
+                noteItem(option.useItem.id);
+                for (const auto& item : option.pickupItems) noteItem(item.id);
+                story.options.push_back(optionRecord);
+            }
+
+            story.nodes.push_back(record);
+        }
+        if (!scriptsOk) return Story::fromStorage(std::make_shared<Storage>());
+
+        // items the scripts ask about belong to the catalog too, variable names go after the text
+        for (const auto& in : story.code) {
+            if (in.op == SCRIPT::HAS || in.op == SCRIPT::COUNT) noteItem(in.arg);
+        }
+        for (uint32_t i = 0; i < variables.size(); ++i) {
+            std::string_view name = variables.name(i);
+            TextRef ref;
+            ref.offset = static_cast<uint32_t>(story.textPool.size());
+            ref.length = static_cast<uint32_t>(name.size());
+            story.textPool.append(name.data(), name.size());
+            story.variables.push_back(ref);
+        }
+
+        Story result = Story::fromStorage(arrays);
+        result.hash = computeHash(result);
+        return result;
+    }
+}
+
+#endif
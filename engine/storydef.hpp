@@ -0,0 +1,323 @@
+#ifndef STORYDEF_HPP
+#define STORYDEF_HPP
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <string_view>
+
+#include "action.hpp"
+#include "inventory.hpp"
+#include "story.hpp"
+
+namespace STORYDEF {
+    // Stories written as compile-time data. Nodes, options and items are declared in
+    // constexpr arrays that refer to each other by name, and the compiler turns them into
+    // the node/option/pickup tables STORY::Story reads. The tables are static constexpr
+    // data (.rodata): no createNode, no shared_ptr, no string copies at startup.
+    //
+    // Mistakes are compile errors: an option pointing at a node that does not exist, an item
+    // missing from the item list or a duplicate name stops the constexpr build with a throw
+    // (which cannot happen in a constant expression) and the compiler shows the message.
+    //
+    //   constexpr std::string_view items[] = { "Key", "Coin" };
+    //   constexpr STORYDEF::NodeDef nodes[] = {
+    //       { "hall", "A locked door." },             // the first node is the root
+    //       { "out", "You are outside." },
+    //   };
+    //   constexpr STORYDEF::OptionDef options[] = {
+    //       { "hall", "out", "Unlock the door", ACTION::TYPE::USE, {}, "Key" },
+    //       { "out", "hall", "Pay the toll", ACTION::TYPE::USE, {}, "Coin", 3 }, // uses 3 coins
+    //   };
+    //   STORY::Story story = STORYDEF::compile<nodes, options, items>();
+    //
+    // Options of a node keep the order they are listed in. Text that repeats is stored once.
+    // Conditions and effects (SCRIPT) need STORY::compile, compile-time stories have none.
+
+    const size_t MAX_PICKUPS = ACTION::MAX_PICKUPS; // items one action can pick up
+
+    struct ItemList {
+        std::string_view names[MAX_PICKUPS];
+
+        constexpr size_t size() const {
+            size_t count = 0;
+            while (count < MAX_PICKUPS && !names[count].empty()) ++count;
+            return count;
+        }
+    };
+
+    struct NodeDef {
+        std::string_view name; // what options use as next
+        std::string_view text;
+        ACTION::TYPE action = ACTION::TYPE::NONE; // on enter
+        ItemList pickupItems = {};
+        std::string_view useItem = {};
+        uint32_t count = 1; // of each pickup item, or of the use item
+    };
+
+    struct OptionDef {
+        std::string_view from; // node the option belongs to
+        std::string_view next; // node it leads to
+        std::string_view text;
+        ACTION::TYPE action = ACTION::TYPE::NONE;
+        ItemList pickupItems = {};
+        std::string_view useItem = {};
+        uint32_t count = 1; // of each pickup item, or of the use item
+    };
+
+    namespace detail {
+        inline constexpr std::array<std::string_view, 0> NO_ITEMS{};
+
+        template<typename Nodes>
+        constexpr uint32_t nodeIndex(const Nodes& nodes, std::string_view name) {
+            for (size_t i = 0; i < std::size(nodes); ++i) {
+                if (nodes[i].name == name) return static_cast<uint32_t>(i);
+            }
+            throw "STORYDEF: an option leads to a node that is not defined";
+        }
+
+        template<typename Items>
+        constexpr INVENTORY::ItemId itemIndex(const Items& items, std::string_view name) {
+            if (name.empty()) return INVENTORY::NO_ITEM;
+            for (size_t i = 0; i < std::size(items); ++i) {
+                if (items[i] == name) return static_cast<INVENTORY::ItemId>(i);
+            }
+            throw "STORYDEF: an item is used that is not in the item list";
+        }
+
+        // Defs with an action get one operand record, their items go in the pickup array
+        template<typename Nodes, typename Options>
+        constexpr size_t actionCount(const Nodes& nodes, const Options& options) {
+            size_t count = 0;
+            for (size_t i = 0; i < std::size(nodes); ++i) count += nodes[i].action != ACTION::TYPE::NONE;
+            for (size_t i = 0; i < std::size(options); ++i) count += options[i].action != ACTION::TYPE::NONE;
+            return count;
+        }
+
+        template<typename Nodes, typename Options>
+        constexpr size_t pickupCount(const Nodes& nodes, const Options& options) {
+            size_t count = 0;
+            for (size_t i = 0; i < std::size(nodes); ++i) {
+                if (nodes[i].action != ACTION::TYPE::NONE) count += nodes[i].pickupItems.size();
+            }
+            for (size_t i = 0; i < std::size(options); ++i) {
+                if (options[i].action != ACTION::TYPE::NONE) count += options[i].pickupItems.size();
+            }
+            return count;
+        }
+
+        // Size of the text pool once repeated text is stored only once
+        template<typename Nodes, typename Options>
+        constexpr size_t textSize(const Nodes& nodes, const Options& options) {
+            auto text = [&](size_t i) {
+                return i < std::size(nodes) ? nodes[i].text : options[i - std::size(nodes)].text;
+            };
+            size_t size = 0;
+            size_t count = std::size(nodes) + std::size(options);
+            for (size_t i = 0; i < count; ++i) {
+                bool repeat = false;
+                for (size_t j = 0; j < i && !repeat; ++j) repeat = text(j) == text(i);
+                if (!repeat) size += text(i).size();
+            }
+            return size;
+        }
+
+        template<size_t N, size_t O, size_t A, size_t P, size_t I, size_t T>
+        struct Tables {
+            std::array<STORY::NodeRecord, N> nodes{};
+            std::array<STORY::OptionRecord, O> options{};
+            std::array<ACTION::Operands, A> actions{};
+            std::array<INVENTORY::ItemId, P> pickups{}; // catalog indices
+            std::array<INVENTORY::ItemId, I> items{};   // 0, 1, 2 ... (the ids when the process agrees)
+            std::array<uint64_t, N> keys{};             // STORY::nodeKey of the node names
+            std::array<char, T> text{};
+            uint64_t hash = 0;
+        };
+
+        // STORY::computeHash, worked out at compile time. The items are catalog indices here
+        // already, words are mixed in little endian order like computeHash does on x86/ARM.
+        template<typename Items, typename Built>
+        constexpr uint64_t hash(const Items& items, const Built& tables) {
+            uint64_t value = 1469598103934665603ull;
+            auto mixByte = [&](unsigned char byte) { value = (value ^ byte) * 1099511628211ull; };
+            auto mixWord = [&](uint32_t word) {
+                for (int i = 0; i < 4; ++i) mixByte(static_cast<unsigned char>(word >> (8 * i)));
+            };
+
+            for (size_t i = 0; i < std::size(items); ++i) {
+                for (char c : items[i]) mixByte(static_cast<unsigned char>(c));
+                mixByte(0);
+            }
+            mixWord(0); // root
+            for (const auto& node : tables.nodes) {
+                mixWord(node.text.offset); mixWord(node.text.length);
+                mixWord(node.firstOption); mixWord(node.optionCount);
+                mixWord(node.actions.first); mixWord(node.actions.count);
+                mixWord(node.effect.first); mixWord(node.effect.count);
+            }
+            for (const auto& option : tables.options) {
+                mixWord(option.text.offset); mixWord(option.text.length);
+                mixWord(option.next);
+                mixWord(option.actions.first); mixWord(option.actions.count);
+                mixWord(option.condition.first); mixWord(option.condition.count);
+                mixWord(option.effect.first); mixWord(option.effect.count);
+            }
+            for (const auto& action : tables.actions) {
+                mixWord(action.opcode);
+                mixWord(action.firstItem); mixWord(action.itemCount);
+                mixWord(action.item); mixWord(action.count);
+            }
+            for (auto id : tables.pickups) mixWord(id);
+            for (char c : tables.text) mixByte(static_cast<unsigned char>(c));
+            return value;
+        }
+
+        template<size_t N, size_t O, size_t A, size_t P, size_t I, size_t T, typename Nodes, typename Options, typename Items>
+        constexpr Tables<N, O, A, P, I, T> build(const Nodes& nodes, const Options& options, const Items& items) {
+            Tables<N, O, A, P, I, T> tables{};
+            if (N == 0) throw "STORYDEF: a story needs at least one node";
+            for (size_t i = 0; i < N; ++i) {
+                for (size_t j = 0; j < i; ++j) {
+                    if (nodes[i].name == nodes[j].name) throw "STORYDEF: two nodes have the same name";
+                }
+            }
+            for (size_t i = 0; i < I; ++i) {
+                if (items[i].empty()) throw "STORYDEF: an item has an empty name";
+                for (size_t j = 0; j < i; ++j) {
+                    if (items[i] == items[j]) throw "STORYDEF: an item is listed twice";
+                }
+                tables.items[i] = static_cast<INVENTORY::ItemId>(i);
+            }
+
+            std::array<uint32_t, O> from{};
+            for (size_t i = 0; i < O; ++i) from[i] = nodeIndex(nodes, options[i].from);
+
+            // every distinct text once, in the order it is first used
+            std::array<std::string_view, N + O> texts{};
+            std::array<STORY::TextRef, N + O> refs{};
+            size_t textCount = 0;
+            uint32_t textUsed = 0;
+            auto addText = [&](std::string_view text) {
+                for (size_t i = 0; i < textCount; ++i) {
+                    if (texts[i] == text) return refs[i];
+                }
+                STORY::TextRef ref;
+                ref.offset = textUsed;
+                ref.length = static_cast<uint32_t>(text.size());
+                for (char c : text) tables.text[textUsed++] = c;
+                texts[textCount] = text;
+                refs[textCount++] = ref;
+                return ref;
+            };
+
+            uint32_t pickupUsed = 0;
+            uint32_t actionUsed = 0;
+            auto addAction = [&](const auto& def) {
+                STORY::ActionRange range;
+                range.first = actionUsed;
+                ItemList list = def.pickupItems;
+                INVENTORY::ItemId useItem = itemIndex(items, def.useItem); // checked even without an action
+                for (size_t i = 0; i < list.size(); ++i) itemIndex(items, list.names[i]);
+                if (def.action == ACTION::TYPE::NONE) return range;
+                if (def.action >= ACTION::MAX_OPCODES) throw "STORYDEF: an action opcode is out of range";
+
+                ACTION::Operands& action = tables.actions[actionUsed++];
+                action.opcode = def.action;
+                action.firstItem = pickupUsed;
+                action.itemCount = static_cast<uint32_t>(list.size());
+                for (size_t i = 0; i < list.size(); ++i) tables.pickups[pickupUsed++] = itemIndex(items, list.names[i]);
+                action.item = useItem;
+                action.count = def.count;
+                range.count = 1;
+                return range;
+            };
+
+            uint32_t optionUsed = 0;
+            for (size_t n = 0; n < N; ++n) {
+                STORY::NodeRecord& record = tables.nodes[n];
+                tables.keys[n] = STORY::nodeKey(nodes[n].name);
+                record.text = addText(nodes[n].text);
+                record.actions = addAction(nodes[n]);
+                record.firstOption = optionUsed;
+
+                for (size_t o = 0; o < O; ++o) {
+                    if (from[o] != n) continue;
+                    STORY::OptionRecord& option = tables.options[optionUsed++];
+                    option.text = addText(options[o].text);
+                    option.next = nodeIndex(nodes, options[o].next);
+                    option.actions = addAction(options[o]);
+                }
+                record.optionCount = optionUsed - record.firstOption;
+            }
+
+            tables.hash = hash(items, tables);
+            return tables;
+        }
+
+        template<const auto& Nodes, const auto& Options, const auto& Items>
+        struct Compiled {
+            static constexpr size_t N = std::size(Nodes);
+            static constexpr size_t O = std::size(Options);
+            static constexpr size_t A = actionCount(Nodes, Options);
+            static constexpr size_t P = pickupCount(Nodes, Options);
+            static constexpr size_t I = std::size(Items);
+            static constexpr size_t T = textSize(Nodes, Options);
+            static constexpr Tables<N, O, A, P, I, T> tables = build<N, O, A, P, I, T>(Nodes, Options, Items);
+        };
+
+        template<typename T, size_t S>
+        STORY::Table<T> view(const std::array<T, S>& array) {
+            STORY::Table<T> table;
+            table.data = array.data();
+            table.size = static_cast<uint32_t>(S);
+            return table;
+        }
+    }
+
+    // The story, viewing the compiled tables in place. Only the item names are interned at
+    // runtime; if this process already gave them other ids, the (small) tables are copied
+    // with the ids rewritten.
+    template<const auto& Nodes, const auto& Options, const auto& Items = detail::NO_ITEMS>
+    STORY::Story compile() {
+        typedef detail::Compiled<Nodes, Options, Items> Compiled;
+        const auto& tables = Compiled::tables;
+
+        std::array<INVENTORY::ItemId, Compiled::I> ids{};
+        bool sameIds = true;
+        for (size_t i = 0; i < Compiled::I; ++i) {
+            ids[i] = INVENTORY::itemTable().intern(Items[i]);
+            sameIds = sameIds && ids[i] == i;
+        }
+
+        STORY::Story story;
+        if (sameIds) {
+            story.nodes = detail::view(tables.nodes);
+            story.options = detail::view(tables.options);
+            story.actions = detail::view(tables.actions);
+            story.pickups = detail::view(tables.pickups);
+            story.items = detail::view(tables.items);
+            story.keys = detail::view(tables.keys);
+        } else {
+            auto toId = [&](INVENTORY::ItemId index) {
+                return index == INVENTORY::NO_ITEM ? index : ids[index];
+            };
+            auto arrays = std::make_shared<STORY::Storage>();
+            arrays->nodes.assign(tables.nodes.begin(), tables.nodes.end());
+            arrays->options.assign(tables.options.begin(), tables.options.end());
+            arrays->actions.assign(tables.actions.begin(), tables.actions.end());
+            for (auto& action : arrays->actions) action.item = toId(action.item);
+            for (auto index : tables.pickups) arrays->pickups.push_back(toId(index));
+            arrays->items.assign(ids.begin(), ids.end());
+            arrays->keys.assign(tables.keys.begin(), tables.keys.end());
+            story = STORY::Story::fromStorage(arrays);
+        }
+        story.root = 0;
+        story.hash = tables.hash;
+        story.textPool = std::string_view(tables.text.data(), tables.text.size());
+        return story;
+    }
+}
+
+#endif
@@ -0,0 +1,469 @@
+#ifndef STORYFILE_HPP
+#define STORYFILE_HPP
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <fstream>
+#include <unordered_map>
+#include <type_traits>
+#include <cstring>
+#include <cstdint>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#define STORYFILE_MMAP 1
+#endif
+
+#include "action.hpp"
+#include "inventory.hpp"
+#include "script.hpp"
+#include "story.hpp"
+
+namespace STORYFILE {
+    // On-disk story format. The file is a header, a section directory and the raw story
+    // arrays, each 8 byte aligned. The loader maps the file and points the Story tables
+    // straight at the sections, nothing is parsed or copied per node.
+    //
+    //   Header | SectionEntry[sectionCount] | NODES | OPTIONS | ACTIONS | PICKUPS | ITEMS | CODE
+    //          | VARIABLES | TEXT | KEYS [| CHAPTERS | CHAPTER_TEXT]
+    //
+    // Streamed stories (see STREAM) keep node and option text out of TEXT, in chapters at the
+    // end of the file that the loader maps but never reads.
+    //
+    // Item ids inside the file (pickups, action operands, HAS and COUNT instructions) are
+    // indices into the ITEMS section (the story's item catalog, stored as TextRefs into TEXT). Records are stored in native byte order, files are not
+    // portable between little and big endian machines (the loader rejects them).
+
+    static const char MAGIC[8] = { 'T', 'B', 'A', 'S', 'T', 'O', 'R', 'Y' };
+    static const uint32_t VERSION = 7; // 2: header carries the story hash, 3: action counts, 4: action lists, 5: scripts, 6: chapters, 7: node keys
+    static const uint32_t ENDIAN_TAG = 0x01020304u;
+
+    enum SECTION : uint32_t {
+        NODES = 1,
+        OPTIONS = 2,
+        PICKUPS = 3,
+        ITEMS = 4,
+        TEXT = 5,
+        ACTIONS = 6,
+        CODE = 7,
+        VARIABLES = 8,
+        CHAPTERS = 9,
+        CHAPTER_TEXT = 10,
+        KEYS = 11
+    };
+
+    struct Header {
+        char magic[8];
+        uint32_t version;
+        uint32_t endianTag;
+        uint32_t root;
+        uint32_t sectionCount;
+        uint64_t hash; // STORY::computeHash of the story, checked by save games
+    };
+
+    struct SectionEntry {
+        uint32_t id;
+        uint32_t count;  // number of records
+        uint64_t offset; // from the start of the file
+        uint64_t bytes;
+    };
+
+    static_assert(std::is_trivially_copyable<STORY::NodeRecord>::value, "NodeRecord must be mappable");
+    static_assert(std::is_trivially_copyable<STORY::OptionRecord>::value, "OptionRecord must be mappable");
+    static_assert(std::is_trivially_copyable<ACTION::Operands>::value, "Operands must be mappable");
+    static_assert(std::is_trivially_copyable<SCRIPT::Instr>::value, "Instr must be mappable");
+    static_assert(std::is_trivially_copyable<STORY::ChapterRecord>::value, "ChapterRecord must be mappable");
+
+    namespace detail {
+        inline void setError(std::string* error, const std::string& message) {
+            if (error) *error = message;
+        }
+
+        inline void pad(std::string& out) {
+            while (out.size() % 8 != 0) out.push_back('\0');
+        }
+
+        template<typename T>
+        void appendSection(std::string& out, std::vector<SectionEntry>& directory, uint32_t id, const T* data, size_t count) {
+            pad(out);
+            SectionEntry entry;
+            entry.id = id;
+            entry.count = static_cast<uint32_t>(count);
+            entry.offset = out.size();
+            entry.bytes = count * sizeof(T);
+            out.append(reinterpret_cast<const char*>(data), static_cast<size_t>(entry.bytes));
+            directory.push_back(entry);
+        }
+
+        // Owns the bytes a loaded Story points into
+        struct Mapping {
+            const char* data = nullptr;
+            size_t size = 0;
+            bool mapped = false;
+            std::vector<uint64_t> buffer;           // fallback when mmap is not available
+            std::vector<INVENTORY::ItemId> itemIds; // catalog index -> process item id
+
+            Mapping() = default;
+            Mapping(const Mapping&) = delete;
+            Mapping& operator=(const Mapping&) = delete;
+            ~Mapping() {
+#ifdef STORYFILE_MMAP
+                if (mapped) munmap(const_cast<char*>(data), size);
+#endif
+            }
+        };
+
+        // Reads the whole file into memory, either by mapping it or by a single read
+        inline bool open(const std::string& path, Mapping& mapping, std::string* error) {
+#ifdef STORYFILE_MMAP
+            int fd = ::open(path.c_str(), O_RDONLY);
+            if (fd < 0) {
+                setError(error, "cannot open " + path);
+                return false;
+            }
+            struct stat info;
+            if (fstat(fd, &info) != 0 || info.st_size <= 0) {
+                ::close(fd);
+                setError(error, "cannot stat " + path);
+                return false;
+            }
+            void* address = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+            ::close(fd); // the mapping keeps the file alive
+            if (address == MAP_FAILED) {
+                setError(error, "cannot map " + path);
+                return false;
+            }
+            mapping.data = static_cast<const char*>(address);
+            mapping.size = static_cast<size_t>(info.st_size);
+            mapping.mapped = true;
+            return true;
+#else
+            std::ifstream file(path, std::ios::binary | std::ios::ate);
+            if (!file) {
+                setError(error, "cannot open " + path);
+                return false;
+            }
+            size_t size = static_cast<size_t>(file.tellg());
+            mapping.buffer.resize((size + 7) / 8);
+            file.seekg(0);
+            file.read(reinterpret_cast<char*>(mapping.buffer.data()), static_cast<std::streamsize>(size));
+            if (!file) {
+                setError(error, "cannot read " + path);
+                return false;
+            }
+            mapping.data = reinterpret_cast<const char*>(mapping.buffer.data());
+            mapping.size = size;
+            return true;
+#endif
+        }
+
+        // Makes the mapped records writable for the (rare) item id fixup
+        inline void setWritable(Mapping& mapping, bool writable) {
+#ifdef STORYFILE_MMAP
+            if (mapping.mapped) {
+                mprotect(const_cast<char*>(mapping.data), mapping.size, writable ? PROT_READ | PROT_WRITE : PROT_READ);
+            }
+#else
+            (void)mapping;
+            (void)writable;
+#endif
+        }
+
+        template<typename T>
+        bool section(const Mapping& mapping, const SectionEntry& entry, STORY::Table<T>& table) {
+            if (entry.offset % alignof(T) != 0 || entry.bytes != uint64_t(entry.count) * sizeof(T)) return false;
+            if (entry.offset > mapping.size || entry.bytes > mapping.size - entry.offset) return false;
+            table.data = reinterpret_cast<const T*>(mapping.data + entry.offset);
+            table.size = entry.count;
+            return true;
+        }
+
+        inline bool validText(const STORY::Story& story, STORY::TextRef ref) {
+            return ref.offset <= story.textPool.size() && ref.length <= story.textPool.size() - ref.offset;
+        }
+
+        inline bool validItems(const STORY::Story& story, STORY::ItemRange range) {
+            return range.first <= story.pickups.size && range.count <= story.pickups.size - range.first;
+        }
+
+        inline bool validItem(uint32_t itemCount, INVENTORY::ItemId id) {
+            return id == INVENTORY::NO_ITEM || id < itemCount;
+        }
+
+        inline bool validActions(const STORY::Story& story, STORY::ActionRange range) {
+            return range.count <= ACTION::MAX_ACTIONS && range.first <= story.actions.size && range.count <= story.actions.size - range.first;
+        }
+
+        inline bool usesItem(uint8_t op) {
+            return op == SCRIPT::HAS || op == SCRIPT::COUNT;
+        }
+
+        // Registers, variables, items and jumps in range. Jumps only go forward, so every
+        // script ends. Conditions (readOnly) may not store.
+        inline bool validScript(const STORY::Story& story, SCRIPT::ScriptRef ref, uint32_t itemCount, bool readOnly) {
+            if (ref.first > story.code.size || ref.count > story.code.size - ref.first) return false;
+            const SCRIPT::Instr* code = story.script(ref);
+            for (uint32_t pc = 0; pc < ref.count; ++pc) {
+                const SCRIPT::Instr& in = code[pc];
+                if (in.op >= SCRIPT::OP_COUNT || in.dst >= SCRIPT::MAX_REGISTERS || in.a >= SCRIPT::MAX_REGISTERS || in.b >= SCRIPT::MAX_REGISTERS) return false;
+                if ((in.op == SCRIPT::LOAD || in.op == SCRIPT::STORE) && in.arg >= story.variables.size) return false;
+                if (in.op == SCRIPT::STORE && readOnly) return false;
+                if (usesItem(in.op) && !validItem(itemCount, in.arg)) return false;
+                if ((in.op == SCRIPT::JUMP_IF_ZERO || in.op == SCRIPT::JUMP_IF_NOT_ZERO) && (in.arg <= pc || in.arg > ref.count)) return false;
+            }
+            return true;
+        }
+
+        inline bool inChapter(const STORY::ChapterRecord& chapter, STORY::TextRef ref) {
+            return ref.offset <= chapter.bytes && ref.length <= chapter.bytes - ref.offset;
+        }
+
+        // Chapters cover every node once, in order, and hold the text of their nodes and options
+        inline bool validChapters(const STORY::Story& story, uint64_t chapterBytes) {
+            STORY::NodeId next = 0;
+            for (const auto& chapter : story.chapters) {
+                if (chapter.firstNode != next || chapter.nodeCount > story.nodes.size - next) return false;
+                if (chapter.offset > chapterBytes || chapter.bytes > chapterBytes - chapter.offset) return false;
+                for (STORY::NodeId id = chapter.firstNode; id < chapter.firstNode + chapter.nodeCount; ++id) {
+                    const STORY::NodeRecord& node = story.nodes[id];
+                    if (!inChapter(chapter, node.text)) return false;
+                    for (uint32_t i = 0; i < node.optionCount; ++i) {
+                        if (!inChapter(chapter, story.options[node.firstOption + i].text)) return false;
+                    }
+                }
+                next += chapter.nodeCount;
+            }
+            return next == story.nodes.size;
+        }
+
+        // Bounds checks every index in the file so a corrupt story cannot walk off the mapping
+        inline bool verify(const STORY::Story& story, uint32_t itemCount, uint64_t chapterBytes) {
+            bool chaptered = story.chapters.size != 0;
+            if (story.nodes.size != 0 && story.root >= story.nodes.size) return false;
+            if (story.keys.size != 0 && story.keys.size != story.nodes.size) return false;
+            for (const auto& name : story.variables) {
+                if (!validText(story, name)) return false;
+            }
+            for (const auto& node : story.nodes) {
+                if ((!chaptered && !validText(story, node.text)) || !validActions(story, node.actions)) return false;
+                if (!validScript(story, node.effect, itemCount, false)) return false;
+                if (node.firstOption > story.options.size || node.optionCount > story.options.size - node.firstOption) return false;
+            }
+            for (const auto& option : story.options) {
+                if ((!chaptered && !validText(story, option.text)) || !validActions(story, option.actions)) return false;
+                if (!validScript(story, option.condition, itemCount, true) || !validScript(story, option.effect, itemCount, false)) return false;
+                if (option.next >= story.nodes.size) return false;
+            }
+            for (const auto& action : story.actions) {
+                STORY::ItemRange items;
+                items.first = action.firstItem;
+                items.count = action.itemCount;
+                if (action.opcode >= ACTION::MAX_OPCODES || !validItems(story, items) || !validItem(itemCount, action.item)) return false;
+            }
+            for (auto id : story.pickups) {
+                if (!validItem(itemCount, id)) return false;
+            }
+            return !chaptered || validChapters(story, chapterBytes);
+        }
+    }
+
+    // Writes a compiled story to disk. Item ids are rewritten to catalog indices so the file
+    // does not depend on the order items were interned in this process. chapterText is the
+    // text of story.chapters, only streamed stories (STREAM::save) have any.
+    inline bool save(const STORY::Story& story, const std::string& path, std::string* error = nullptr, std::string_view chapterText = {}) {
+        std::unordered_map<INVENTORY::ItemId, INVENTORY::ItemId> catalogIndex;
+        for (uint32_t i = 0; i < story.items.size; ++i) {
+            catalogIndex.emplace(story.items[i], i);
+        }
+        auto toFile = [&](INVENTORY::ItemId id) {
+            return id == INVENTORY::NO_ITEM ? INVENTORY::NO_ITEM : catalogIndex.at(id);
+        };
+
+        std::vector<STORY::NodeRecord> nodes(story.nodes.begin(), story.nodes.end());
+        std::vector<STORY::OptionRecord> options(story.options.begin(), story.options.end());
+        std::vector<ACTION::Operands> actions(story.actions.begin(), story.actions.end());
+        std::vector<INVENTORY::ItemId> pickups;
+        pickups.reserve(story.pickups.size);
+        for (auto id : story.pickups) pickups.push_back(toFile(id));
+        for (auto& action : actions) action.item = toFile(action.item);
+        std::vector<SCRIPT::Instr> code(story.code.begin(), story.code.end());
+        for (auto& in : code) {
+            if (detail::usesItem(in.op)) in.arg = toFile(in.arg);
+        }
+
+        // item names go at the end of the text pool
+        std::string text(story.textPool);
+        std::vector<STORY::TextRef> itemNames;
+        itemNames.reserve(story.items.size);
+        for (auto id : story.items) {
+            std::string_view name = INVENTORY::itemTable().name(id);
+            STORY::TextRef ref;
+            ref.offset = static_cast<uint32_t>(text.size());
+            ref.length = static_cast<uint32_t>(name.size());
+            text += name;
+            itemNames.push_back(ref);
+        }
+
+        const uint32_t sectionCount = story.chapters.size != 0 ? 11 : 9;
+        Header header;
+        std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+        header.version = VERSION;
+        header.endianTag = ENDIAN_TAG;
+        header.root = story.root;
+        header.sectionCount = sectionCount;
+        header.hash = story.hash;
+
+        // directory is patched in once the section offsets are known
+        std::string out(sizeof(Header) + sectionCount * sizeof(SectionEntry), '\0');
+        std::vector<SectionEntry> directory;
+        detail::appendSection(out, directory, NODES, nodes.data(), nodes.size());
+        detail::appendSection(out, directory, OPTIONS, options.data(), options.size());
+        detail::appendSection(out, directory, ACTIONS, actions.data(), actions.size());
+        detail::appendSection(out, directory, PICKUPS, pickups.data(), pickups.size());
+        detail::appendSection(out, directory, ITEMS, itemNames.data(), itemNames.size());
+        detail::appendSection(out, directory, CODE, code.data(), code.size());
+        detail::appendSection(out, directory, VARIABLES, story.variables.data, story.variables.size);
+        detail::appendSection(out, directory, TEXT, text.data(), text.size());
+        detail::appendSection(out, directory, KEYS, story.keys.data, story.keys.size);
+        if (story.chapters.size != 0) {
+            detail::appendSection(out, directory, CHAPTERS, story.chapters.data, story.chapters.size);
+            detail::appendSection(out, directory, CHAPTER_TEXT, chapterText.data(), chapterText.size());
+        }
+        std::memcpy(&out[0], &header, sizeof(Header));
+        std::memcpy(&out[sizeof(Header)], directory.data(), directory.size() * sizeof(SectionEntry));
+
+        std::ofstream file(path, std::ios::binary | std::ios::trunc);
+        if (!file) {
+            detail::setError(error, "cannot write " + path);
+            return false;
+        }
+        file.write(out.data(), static_cast<std::streamsize>(out.size()));
+        if (!file) {
+            detail::setError(error, "cannot write " + path);
+            return false;
+        }
+        return true;
+    }
+
+    // Maps a story file and points `story` at it in place. Only the item catalog is touched:
+    // its names are interned, and if the resulting ids are not the catalog indices the id
+    // fields are patched in the private mapping. Pass verify = false for trusted files to skip
+    // the bounds checking pass.
+    inline bool load(const std::string& path, STORY::Story& story, std::string* error = nullptr, bool verify = true) {
+        auto mapping = std::make_shared<detail::Mapping>();
+        if (!detail::open(path, *mapping, error)) return false;
+
+        Header header;
+        if (mapping->size < sizeof(Header)) {
+            detail::setError(error, path + " is not a story file");
+            return false;
+        }
+        std::memcpy(&header, mapping->data, sizeof(Header));
+        if (std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 || header.endianTag != ENDIAN_TAG) {
+            detail::setError(error, path + " is not a story file");
+            return false;
+        }
+        if (header.version != VERSION) {
+            detail::setError(error, path + " has unsupported version " + std::to_string(header.version));
+            return false;
+        }
+        if (header.sectionCount > (mapping->size - sizeof(Header)) / sizeof(SectionEntry)) {
+            detail::setError(error, path + " is truncated");
+            return false;
+        }
+
+        STORY::Story result;
+        result.root = header.root;
+        result.hash = header.hash;
+        STORY::Table<STORY::TextRef> itemNames;
+        STORY::Table<char> text;
+        STORY::Table<char> chapterText; // only its size, the text is read by STREAM
+        const auto* directory = reinterpret_cast<const SectionEntry*>(mapping->data + sizeof(Header));
+        bool ok = true;
+        for (uint32_t i = 0; i < header.sectionCount && ok; ++i) {
+            switch (directory[i].id) {
+                case NODES: ok = detail::section(*mapping, directory[i], result.nodes); break;
+                case OPTIONS: ok = detail::section(*mapping, directory[i], result.options); break;
+                case ACTIONS: ok = detail::section(*mapping, directory[i], result.actions); break;
+                case PICKUPS: ok = detail::section(*mapping, directory[i], result.pickups); break;
+                case ITEMS: ok = detail::section(*mapping, directory[i], itemNames); break;
+                case CODE: ok = detail::section(*mapping, directory[i], result.code); break;
+                case VARIABLES: ok = detail::section(*mapping, directory[i], result.variables); break;
+                case TEXT: ok = detail::section(*mapping, directory[i], text); break;
+                case CHAPTERS: ok = detail::section(*mapping, directory[i], result.chapters); break;
+                case CHAPTER_TEXT: ok = detail::section(*mapping, directory[i], chapterText); break;
+                case KEYS: ok = detail::section(*mapping, directory[i], result.keys); break;
+                default: break; // unknown sections are skipped
+            }
+        }
+        if (!ok) {
+            detail::setError(error, path + " has a corrupt section directory");
+            return false;
+        }
+        result.textPool = std::string_view(text.data, text.size);
+
+        for (const auto& name : itemNames) {
+            if (!detail::validText(result, name)) {
+                detail::setError(error, path + " has a corrupt item catalog");
+                return false;
+            }
+        }
+        if (verify && !detail::verify(result, itemNames.size, chapterText.size)) {
+            detail::setError(error, path + " failed verification");
+            return false;
+        }
+
+        // intern the catalog, the common case (fresh process) maps every index to itself
+        bool identity = true;
+        mapping->itemIds.reserve(itemNames.size);
+        for (const auto& name : itemNames) {
+            INVENTORY::ItemId id = INVENTORY::itemTable().intern(result.text(name));
+            identity = identity && id == mapping->itemIds.size();
+            mapping->itemIds.push_back(id);
+        }
+        if (!identity) {
+            // checked here even without verify, a bad id would index past the catalog
+            const auto& ids = mapping->itemIds;
+            bool inRange = true;
+            auto toProcess = [&](INVENTORY::ItemId id) {
+                if (id == INVENTORY::NO_ITEM) return id;
+                if (id >= ids.size()) {
+                    inRange = false;
+                    return INVENTORY::NO_ITEM;
+                }
+                return ids[id];
+            };
+            detail::setWritable(*mapping, true);
+            for (uint32_t i = 0; i < result.actions.size; ++i) {
+                auto& action = const_cast<ACTION::Operands&>(result.actions[i]);
+                action.item = toProcess(action.item);
+            }
+            for (uint32_t i = 0; i < result.pickups.size; ++i) {
+                auto& id = const_cast<INVENTORY::ItemId&>(result.pickups[i]);
+                id = toProcess(id);
+            }
+            for (uint32_t i = 0; i < result.code.size; ++i) {
+                auto& in = const_cast<SCRIPT::Instr&>(result.code[i]);
+                if (detail::usesItem(in.op)) in.arg = toProcess(in.arg);
+            }
+            detail::setWritable(*mapping, false);
+            if (!inRange) {
+                detail::setError(error, path + " has an item id past its catalog");
+                return false;
+            }
+        }
+        result.items.data = mapping->itemIds.data();
+        result.items.size = static_cast<uint32_t>(mapping->itemIds.size());
+
+        result.storage = std::move(mapping);
+        story = std::move(result);
+        return true;
+    }
+}
+
+#endif
@@ -0,0 +1,384 @@
+#ifndef STREAM_HPP
+#define STREAM_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "story.hpp"
+#include "storyfile.hpp"
+
+namespace STREAM {
+    // Streamed stories, for stories with more prose than should stay in memory. The story
+    // file keeps the structure (nodes, options, actions, scripts) as usual, but node and
+    // option text is grouped into chapters of consecutive nodes (nodes are in BFS order, so
+    // a chapter is a neighbourhood of the graph) stored at the end of the file.
+    //
+    // A Book maps the structure and reads chapters on demand into an LRU cache of bounded
+    // size that every session of the book shares. Entering a node queues the chapters its
+    // options lead to for a background thread, so by the time the player picks one its text
+    // is usually already there.
+    //
+    // Text handed out through a Page stays valid while the Page is alive, even if the cache
+    // evicts the chapter meanwhile: the cache holds at most its capacity, plus whatever
+    // chapters pages still pin.
+
+    struct Options {
+        uint32_t chapterBytes = 64 * 1024; // text per chapter, every chapter has at least one node
+    };
+
+    // Writes story to path as a streamed story file. Text repeated inside a chapter is
+    // stored once. The file keeps the story's hash, so save games work with both versions.
+    inline bool save(const STORY::Story& story, const std::string& path, const Options& options = Options(), std::string* error = nullptr) {
+        if (story.chapters.size != 0) {
+            if (error) *error = "the story is already streamed";
+            return false;
+        }
+
+        auto arrays = std::make_shared<STORY::Storage>();
+        arrays->nodes.assign(story.nodes.begin(), story.nodes.end());
+        arrays->options.assign(story.options.begin(), story.options.end());
+        arrays->actions.assign(story.actions.begin(), story.actions.end());
+        arrays->pickups.assign(story.pickups.begin(), story.pickups.end());
+        arrays->items.assign(story.items.begin(), story.items.end());
+        arrays->code.assign(story.code.begin(), story.code.end());
+        arrays->keys.assign(story.keys.begin(), story.keys.end());
+
+        // only the variable names stay in the resident text pool
+        for (const auto& name : story.variables) {
+            std::string_view text = story.text(name);
+            STORY::TextRef ref;
+            ref.offset = static_cast<uint32_t>(arrays->textPool.size());
+            ref.length = static_cast<uint32_t>(text.size());
+            arrays->textPool += text;
+            arrays->variables.push_back(ref);
+        }
+
+        std::string chapterText;
+        std::unordered_map<std::string_view, uint32_t> placed; // text of the open chapter -> offset in it
+        std::vector<uint32_t> owner(story.options.size, UINT32_MAX); // chapter of every option
+        STORY::ChapterRecord chapter;
+        auto place = [&](STORY::TextRef& ref) {
+            std::string_view text = story.text(ref);
+            auto it = placed.find(text);
+            if (it == placed.end()) {
+                it = placed.emplace(text, static_cast<uint32_t>(chapterText.size() - chapter.offset)).first;
+                chapterText += text;
+            }
+            ref.offset = it->second;
+        };
+        auto close = [&]() {
+            chapter.bytes = static_cast<uint32_t>(chapterText.size() - chapter.offset);
+            arrays->chapters.push_back(chapter);
+            chapter = STORY::ChapterRecord();
+            chapter.firstNode = arrays->chapters.back().firstNode + arrays->chapters.back().nodeCount;
+            chapter.offset = chapterText.size();
+            placed.clear();
+        };
+
+        for (STORY::NodeId id = 0; id < story.nodeCount(); ++id) {
+            STORY::NodeRecord& node = arrays->nodes[id];
+            place(node.text);
+            for (uint32_t i = 0; i < node.optionCount; ++i) {
+                uint32_t index = node.firstOption + i;
+                uint32_t current = static_cast<uint32_t>(arrays->chapters.size());
+                if (owner[index] != UINT32_MAX && owner[index] != current) {
+                    if (error) *error = "an option is shared by nodes in different chapters";
+                    return false;
+                }
+                if (owner[index] == UINT32_MAX) place(arrays->options[index].text);
+                owner[index] = current;
+            }
+            ++chapter.nodeCount;
+            if (chapterText.size() - chapter.offset >= options.chapterBytes) close();
+        }
+        if (chapter.nodeCount != 0) close();
+
+        STORY::Story streamed = STORY::Story::fromStorage(arrays, story.root);
+        streamed.hash = story.hash;
+        return STORYFILE::save(streamed, path, error, chapterText);
+    }
+
+    // Chapters of one book, least recently used first out. Thread safe.
+    class Cache {
+    public:
+        typedef std::shared_ptr<const std::string> Text;
+
+        struct Stats {
+            uint64_t hits = 0;
+            uint64_t misses = 0;      // read while a page waited for it
+            uint64_t prefetched = 0;  // read ahead by the background thread
+            uint64_t evictions = 0;
+            size_t bytes = 0;         // held by the cache now
+            size_t peakBytes = 0;
+            size_t capacity = 0;
+        };
+
+        explicit Cache(size_t capacityBytes) { counts.capacity = capacityBytes; }
+
+        // The cached chapter or nullptr, a hit makes it the most recently used
+        Text find(uint32_t chapter) {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto it = entries.find(chapter);
+            if (it == entries.end()) return nullptr;
+            ++counts.hits;
+            order.splice(order.end(), order, it->second.position);
+            return it->second.text;
+        }
+
+        bool contains(uint32_t chapter) const {
+            std::lock_guard<std::mutex> lock(mutex);
+            return entries.count(chapter) != 0;
+        }
+
+        // Adds a chapter that was just read, returns the cached copy if another thread was faster
+        Text insert(uint32_t chapter, Text text, bool prefetched) {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto it = entries.find(chapter);
+            if (it != entries.end()) return it->second.text;
+            if (prefetched) ++counts.prefetched; else ++counts.misses;
+
+            order.push_back(chapter);
+            entries.emplace(chapter, Entry{ text, std::prev(order.end()) });
+            counts.bytes += text->size();
+            while (counts.bytes > counts.capacity && order.size() > 1) {
+                auto victim = entries.find(order.front());
+                counts.bytes -= victim->second.text->size();
+                entries.erase(victim);
+                order.pop_front();
+                ++counts.evictions;
+            }
+            counts.peakBytes = std::max(counts.peakBytes, counts.bytes);
+            return text;
+        }
+
+        Stats stats() const {
+            std::lock_guard<std::mutex> lock(mutex);
+            return counts;
+        }
+
+    private:
+        struct Entry {
+            Text text;
+            std::list<uint32_t>::iterator position;
+        };
+
+        mutable std::mutex mutex;
+        std::unordered_map<uint32_t, Entry> entries;
+        std::list<uint32_t> order; // least recently used first
+        Stats counts;
+    };
+
+    // The text of one node and its options. story() is the book's story with its text pool
+    // pointed at the node's chapter, hand it to RENDER like any story.
+    class Page {
+    public:
+        const STORY::Story& story() const { return view; }
+
+    private:
+        friend class Book;
+
+        Cache::Text text; // keeps the chapter alive, nullptr for stories that are not streamed
+        uint32_t chapter = 0;
+        uint64_t opening = 0; // Book::open that the chapter was read under
+        STORY::Story view;
+    };
+
+    struct BookOptions {
+        size_t cacheBytes = 8 * 1024 * 1024;
+        bool prefetch = true; // read the chapters of the next nodes ahead on a background thread
+    };
+
+    // A story file opened for streaming. Stories that are not streamed work too, their text
+    // just is always there.
+    class Book {
+    public:
+        Book() = default;
+        Book(const Book&) = delete;
+        Book& operator=(const Book&) = delete;
+        ~Book() { stop(); }
+
+        // Opens path, closing whatever the book had open before. Pages taken from the
+        // earlier story keep their text but are read again on their next page() call.
+        bool open(const std::string& path, const BookOptions& options = BookOptions(), std::string* error = nullptr) {
+            stop();
+            file.close();
+            file.clear();
+            chapterBase = 0;
+            cache.reset(new Cache(options.cacheBytes));
+            opening = nextOpening();
+            if (!STORYFILE::load(path, structure, error)) return false;
+            if (structure.chapters.size == 0) return true;
+
+            file.open(path, std::ios::binary);
+            if (!file) {
+                if (error) *error = "cannot open " + path;
+                return false;
+            }
+            if (!findChapterText()) {
+                if (error) *error = path + " has no chapter text";
+                return false;
+            }
+            if (options.prefetch) {
+                stopping = false;
+                worker = std::thread([this] { prefetchLoop(); });
+            }
+            return true;
+        }
+
+        // The structure: nodes, options, actions. Node and option text is only in pages.
+        const STORY::Story& story() const { return structure; }
+
+        bool streamed() const { return structure.chapters.size != 0; }
+
+        // The text of node, read from disk if its chapter is not cached. False (with error
+        // set) if the chapter cannot be read.
+        bool page(STORY::NodeId node, Page& out, std::string* error = nullptr) {
+            if (!streamed()) {
+                out.view = structure;
+                out.text = nullptr;
+                return true;
+            }
+
+            // most turns stay in the chapter the page already holds
+            uint32_t chapter = chapterOf(node);
+            if (out.text && out.chapter == chapter && out.opening == opening) return true;
+
+            Cache::Text text = cache->find(chapter);
+            if (!text) {
+                text = read(chapter);
+                if (!text) {
+                    if (error) *error = "cannot read chapter " + std::to_string(chapter);
+                    return false;
+                }
+                text = cache->insert(chapter, text, false);
+            }
+            out.view = structure;
+            out.text = text;
+            out.chapter = chapter;
+            out.opening = opening;
+            out.view.textPool = *text;
+            return true;
+        }
+
+        // Queues the chapters node's options lead to for the background thread
+        void prefetch(STORY::NodeId node) {
+            if (!streamed() || !worker.joinable()) return;
+            const STORY::NodeRecord& record = structure.node(node);
+            uint32_t here = chapterOf(node); // pinned by the caller's page already
+            bool queued = false;
+            {
+                std::unique_lock<std::mutex> lock(queueMutex, std::defer_lock);
+                for (uint32_t i = 0; i < record.optionCount; ++i) {
+                    uint32_t chapter = chapterOf(structure.option(node, i).next);
+                    if (chapter == here) continue;
+                    if (!lock.owns_lock()) lock.lock();
+                    if (pending.count(chapter) || cache->contains(chapter)) continue;
+                    pending.insert(chapter);
+                    queue.push_back(chapter);
+                    queued = true;
+                }
+            }
+            if (queued) wake.notify_one();
+        }
+
+        Cache::Stats stats() const { return cache ? cache->stats() : Cache::Stats(); }
+
+    private:
+        uint32_t chapterOf(STORY::NodeId node) const {
+            auto it = std::upper_bound(structure.chapters.begin(), structure.chapters.end(), node,
+                                       [](STORY::NodeId id, const STORY::ChapterRecord& chapter) { return id < chapter.firstNode; });
+            return static_cast<uint32_t>(it - structure.chapters.begin()) - 1;
+        }
+
+        // Numbers every open() of every book, so a page knows whose chapter it holds
+        static uint64_t nextOpening() {
+            static std::atomic<uint64_t> count{ 0 };
+            return ++count;
+        }
+
+        // Where CHAPTER_TEXT starts in the file
+        bool findChapterText() {
+            STORYFILE::Header header;
+            if (!file.read(reinterpret_cast<char*>(&header), sizeof(header))) return false;
+            for (uint32_t i = 0; i < header.sectionCount; ++i) {
+                STORYFILE::SectionEntry entry;
+                if (!file.read(reinterpret_cast<char*>(&entry), sizeof(entry))) return false;
+                if (entry.id == STORYFILE::CHAPTER_TEXT) {
+                    chapterBase = entry.offset;
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        Cache::Text read(uint32_t chapter) {
+            const STORY::ChapterRecord& record = structure.chapters[chapter];
+            auto text = std::make_shared<std::string>(record.bytes, '\0');
+            std::lock_guard<std::mutex> lock(fileMutex);
+            file.clear();
+            file.seekg(static_cast<std::streamoff>(chapterBase + record.offset));
+            if (!file.read(&(*text)[0], static_cast<std::streamsize>(record.bytes))) return nullptr;
+            return text;
+        }
+
+        void prefetchLoop() {
+            std::unique_lock<std::mutex> lock(queueMutex);
+            while (true) {
+                wake.wait(lock, [this] { return stopping || !queue.empty(); });
+                if (stopping) return;
+                uint32_t chapter = queue.front();
+                queue.pop_front();
+                lock.unlock();
+                if (!cache->contains(chapter)) {
+                    Cache::Text text = read(chapter);
+                    if (text) cache->insert(chapter, text, true);
+                }
+                lock.lock();
+                pending.erase(chapter);
+            }
+        }
+
+        void stop() {
+            if (!worker.joinable()) return;
+            {
+                std::lock_guard<std::mutex> lock(queueMutex);
+                stopping = true;
+            }
+            wake.notify_one();
+            worker.join();
+            queue.clear();
+            pending.clear();
+        }
+
+        STORY::Story structure;
+        std::unique_ptr<Cache> cache;
+
+        std::mutex fileMutex;
+        std::ifstream file;
+        uint64_t chapterBase = 0;
+        uint64_t opening = 0;
+
+        std::mutex queueMutex;
+        std::condition_variable wake;
+        std::deque<uint32_t> queue;
+        std::unordered_set<uint32_t> pending; // queued or being read
+        std::thread worker;
+        bool stopping = false;
+    };
+}
+
+#endif
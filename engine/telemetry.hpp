@@ -0,0 +1,440 @@
+#ifndef TELEMETRY_HPP
+#define TELEMETRY_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cstdint>
+
+#include "action.hpp"
+#include "story.hpp"
+
+namespace TELEMETRY {
+    // Counts what players do: node entries, option picks, action results and how long turns
+    // take. Sessions write into the shard of their thread, a shard's counters only ever have
+    // that one writer, so counting is a plain load and store (no locked instructions, no
+    // cache line shared between threads). A session looks its shard up once per turn and
+    // calls the hooks on it. Readers add the shards up when they want numbers, off the turn
+    // path. Reading the clock costs about as much as a turn, so only one turn in sampleEvery
+    // (per thread) is timed.
+    //
+    // Define TBA_NO_TELEMETRY to compile the hooks out of the sessions.
+
+#ifdef TBA_NO_TELEMETRY
+    const bool ENABLED = false;
+#else
+    const bool ENABLED = true;
+#endif
+
+    const uint32_t RESULT_COUNT = ACTION::ALREADY_HAVE + 1;
+
+    // Turn latency buckets, log-linear like HdrHistogram: values below 16 are exact, every
+    // power of two above is split in 16, so a bucket is within 1/16 of its values.
+    const uint32_t SUB_BITS = 4;
+    const uint32_t SUB_BUCKETS = 1u << SUB_BITS;
+    const uint32_t MAX_MAGNITUDE = 37; // up to 2^40 ns, longer turns go in the last bucket
+    const uint32_t BUCKETS = (MAX_MAGNITUDE + 1) * SUB_BUCKETS;
+
+    inline uint32_t bucketOf(uint64_t value) {
+        if (value < SUB_BUCKETS) return static_cast<uint32_t>(value);
+        uint32_t msb = 63;
+        while (!(value >> msb)) --msb;
+        uint32_t magnitude = msb - SUB_BITS + 1;
+        if (magnitude > MAX_MAGNITUDE) return BUCKETS - 1;
+        return magnitude * SUB_BUCKETS + static_cast<uint32_t>((value >> (magnitude - 1)) & (SUB_BUCKETS - 1));
+    }
+
+    // Smallest value that lands in bucket
+    inline uint64_t bucketFloor(uint32_t bucket) {
+        if (bucket < SUB_BUCKETS) return bucket;
+        uint32_t magnitude = bucket / SUB_BUCKETS;
+        return uint64_t(SUB_BUCKETS + bucket % SUB_BUCKETS) << (magnitude - 1);
+    }
+
+    // Largest value that lands in bucket
+    inline uint64_t bucketCeiling(uint32_t bucket) {
+        if (bucket < SUB_BUCKETS) return bucket;
+        return bucketFloor(bucket) + (uint64_t(1) << (bucket / SUB_BUCKETS - 1)) - 1;
+    }
+
+    // Counters added up over every shard
+    struct Snapshot {
+        std::vector<uint64_t> nodes;   // entries, by node id
+        std::vector<uint64_t> options; // picks, by index into the story's option table
+        uint64_t actions[ACTION::MAX_OPCODES][RESULT_COUNT] = {};
+        std::vector<uint64_t> latency; // timed turns per bucket
+        uint64_t turns = 0;      // every turn that took an option
+        uint64_t samples = 0;    // timed turns
+        uint64_t latencySum = 0; // ns, of the timed turns
+        uint64_t latencyMax = 0; // ns
+
+        // Turn latency at quantile q (0..1), the top of the bucket it falls in
+        uint64_t quantile(double q) const {
+            if (samples == 0) return 0;
+            uint64_t rank = static_cast<uint64_t>(q * static_cast<double>(samples));
+            if (rank >= samples) rank = samples - 1;
+            uint64_t seen = 0;
+            for (uint32_t i = 0; i < latency.size(); ++i) {
+                seen += latency[i];
+                if (seen > rank) return std::min(bucketCeiling(i), latencyMax);
+            }
+            return latencyMax;
+        }
+    };
+
+    class Recorder {
+        typedef std::atomic<uint64_t> Counter;
+
+        // Only the owning thread writes, so no read-modify-write is needed
+        static void bump(Counter& counter) {
+            counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        }
+
+    public:
+        // One thread's counters, get it with local() and call the hooks on it from that
+        // thread only
+        class alignas(64) Shard {
+        public:
+            void enterNode(STORY::NodeId node) {
+                if (node < nodeCount) bump(nodes[node]);
+            }
+
+            // A turn that takes an option
+            void pickOption(uint32_t option) {
+                if (option < optionCount) bump(options[option]);
+                bump(turns);
+            }
+
+            // Whether the caller should time this turn and hand it to turn()
+            bool sampleTurn() {
+                if (++sinceSample < sampleEvery) return false;
+                sinceSample = 0;
+                return true;
+            }
+
+            void action(uint32_t opcode, ACTION::RESULT result) {
+                if (opcode < ACTION::MAX_OPCODES && result < RESULT_COUNT) bump(actions[opcode][result]);
+            }
+
+            void turn(uint64_t ns) {
+                bump(latency[bucketOf(ns)]);
+                bump(samples);
+                latencySum.store(latencySum.load(std::memory_order_relaxed) + ns, std::memory_order_relaxed);
+                if (ns > latencyMax.load(std::memory_order_relaxed)) latencyMax.store(ns, std::memory_order_relaxed);
+            }
+
+        private:
+            friend class Recorder;
+
+            std::thread::id owner;
+            uint32_t nodeCount = 0;
+            uint32_t optionCount = 0;
+            uint32_t sampleEvery = 1;
+            uint32_t sinceSample = 0; // owner only
+            std::unique_ptr<Counter[]> nodes;
+            std::unique_ptr<Counter[]> options;
+            Counter actions[ACTION::MAX_OPCODES][RESULT_COUNT] = {};
+            Counter latency[BUCKETS] = {};
+            Counter turns{ 0 };
+            Counter samples{ 0 };
+            Counter latencySum{ 0 };
+            Counter latencyMax{ 0 };
+        };
+
+        // Counts sessions of story (node and option ids are the story's), times one turn in
+        // sampleEvery
+        explicit Recorder(const STORY::Story& story, uint32_t sampleEvery = 8)
+            : nodeCount(story.nodes.size), optionCount(story.options.size), storyHash(story.hash),
+              sampleEvery(sampleEvery ? sampleEvery : 1), id(nextId().fetch_add(1, std::memory_order_relaxed)) {}
+
+        Recorder(const Recorder&) = delete;
+        Recorder& operator=(const Recorder&) = delete;
+
+        // Whether sessions of story can report here (the same version, see RELOAD)
+        bool covers(const STORY::Story& story) const {
+            return story.hash == storyHash && story.nodes.size == nodeCount && story.options.size == optionCount;
+        }
+
+        // The calling thread's shard, made on its first use. Every thread keeps the shards of
+        // the last CACHE_SLOTS recorders it used (by id, ids are never reused so a new recorder
+        // at a dead one's address does not match), a thread going back and forth between a few
+        // recorders finds each without the lock.
+        Shard& local() {
+            Slot& slot = cache()[id % CACHE_SLOTS];
+            if (slot.recorder == id) return *slot.shard;
+
+            std::lock_guard<std::mutex> lock(shardsMutex);
+            std::thread::id self = std::this_thread::get_id();
+            Shard* found = nullptr;
+            for (const auto& shard : shards) {
+                if (shard->owner == self) found = shard.get();
+            }
+            if (!found) {
+                std::unique_ptr<Shard> shard(new Shard());
+                shard->owner = self;
+                shard->nodeCount = nodeCount;
+                shard->optionCount = optionCount;
+                shard->sampleEvery = sampleEvery;
+                shard->nodes.reset(new Counter[nodeCount]());
+                shard->options.reset(new Counter[optionCount]());
+                found = shard.get();
+                shards.push_back(std::move(shard));
+            }
+            slot.recorder = id;
+            slot.shard = found;
+            return *found;
+        }
+
+        // Adds up the shards, counts from turns in flight may or may not be in it yet
+        Snapshot snapshot() const {
+            Snapshot result;
+            result.nodes.assign(nodeCount, 0);
+            result.options.assign(optionCount, 0);
+            result.latency.assign(BUCKETS, 0);
+            std::lock_guard<std::mutex> lock(shardsMutex);
+            for (const auto& shard : shards) {
+                for (uint32_t i = 0; i < nodeCount; ++i) result.nodes[i] += shard->nodes[i].load(std::memory_order_relaxed);
+                for (uint32_t i = 0; i < optionCount; ++i) result.options[i] += shard->options[i].load(std::memory_order_relaxed);
+                for (uint32_t op = 0; op < ACTION::MAX_OPCODES; ++op) {
+                    for (uint32_t r = 0; r < RESULT_COUNT; ++r) result.actions[op][r] += shard->actions[op][r].load(std::memory_order_relaxed);
+                }
+                for (uint32_t i = 0; i < BUCKETS; ++i) result.latency[i] += shard->latency[i].load(std::memory_order_relaxed);
+                result.turns += shard->turns.load(std::memory_order_relaxed);
+                result.samples += shard->samples.load(std::memory_order_relaxed);
+                result.latencySum += shard->latencySum.load(std::memory_order_relaxed);
+                result.latencyMax = std::max(result.latencyMax, shard->latencyMax.load(std::memory_order_relaxed));
+            }
+            return result;
+        }
+
+        size_t shardCount() const {
+            std::lock_guard<std::mutex> lock(shardsMutex);
+            return shards.size();
+        }
+
+    private:
+        static const uint32_t CACHE_SLOTS = 16;
+
+        struct Slot {
+            uint64_t recorder = 0;
+            Shard* shard = nullptr;
+        };
+
+        static Slot* cache() {
+            static thread_local Slot slots[CACHE_SLOTS];
+            return slots;
+        }
+
+        static std::atomic<uint64_t>& nextId() {
+            static std::atomic<uint64_t> next{ 1 };
+            return next;
+        }
+
+        uint32_t nodeCount;
+        uint32_t optionCount;
+        uint64_t storyHash;
+        uint32_t sampleEvery;
+        uint64_t id;
+        mutable std::mutex shardsMutex; // shard list only, never held while counting
+        std::vector<std::unique_ptr<Shard>> shards;
+    };
+
+    inline const char* resultName(uint32_t result) {
+        static const char* names[RESULT_COUNT] = { "nothing", "picked_up", "used", "missing_item", "already_have" };
+        return result < RESULT_COUNT ? names[result] : "unknown";
+    }
+
+    inline std::string opcodeName(uint32_t opcode) {
+        if (opcode == ACTION::PICKUP) return "pickup";
+        if (opcode == ACTION::USE) return "use";
+        if (opcode == ACTION::NONE) return "none";
+        return std::to_string(opcode);
+    }
+
+    // Prometheus text format. Counters that are still 0 are left out, the latency histogram
+    // gets one bucket per power of two.
+    inline std::string prometheus(const Snapshot& data, const STORY::Story& story) {
+        std::string out;
+        auto line = [&](const std::string& name, const std::string& labels, uint64_t value) {
+            out += name;
+            if (!labels.empty()) out += "{" + labels + "}";
+            out += " " + std::to_string(value) + "\n";
+        };
+
+        out += "# HELP tba_node_entries_total Times a session entered the node.\n# TYPE tba_node_entries_total counter\n";
+        for (uint32_t i = 0; i < data.nodes.size(); ++i) {
+            if (data.nodes[i]) line("tba_node_entries_total", "node=\"" + std::to_string(i) + "\"", data.nodes[i]);
+        }
+        out += "# HELP tba_option_picks_total Times a session took the option.\n# TYPE tba_option_picks_total counter\n";
+        for (uint32_t n = 0; n < story.nodes.size; ++n) {
+            const STORY::NodeRecord& node = story.nodes[n];
+            for (uint32_t i = 0; i < node.optionCount; ++i) {
+                uint32_t index = node.firstOption + i;
+                if (index < data.options.size() && data.options[index]) {
+                    line("tba_option_picks_total", "node=\"" + std::to_string(n) + "\",option=\"" + std::to_string(i) + "\"", data.options[index]);
+                }
+            }
+        }
+        out += "# HELP tba_actions_total Actions run, by kind and result.\n# TYPE tba_actions_total counter\n";
+        for (uint32_t op = 0; op < ACTION::MAX_OPCODES; ++op) {
+            for (uint32_t r = 0; r < RESULT_COUNT; ++r) {
+                if (data.actions[op][r]) line("tba_actions_total", "action=\"" + opcodeName(op) + "\",result=\"" + resultName(r) + "\"", data.actions[op][r]);
+            }
+        }
+
+        out += "# HELP tba_turns_total Turns that took an option.\n# TYPE tba_turns_total counter\n";
+        line("tba_turns_total", "", data.turns);
+        out += "# HELP tba_turn_latency_ns How long a turn took in the session, of the timed turns.\n# TYPE tba_turn_latency_ns histogram\n";
+        uint64_t cumulative = 0;
+        for (uint32_t i = 0; i < data.latency.size(); ++i) {
+            cumulative += data.latency[i];
+            if ((i + 1) % SUB_BUCKETS == 0 && i + 1 < data.latency.size()) {
+                line("tba_turn_latency_ns_bucket", "le=\"" + std::to_string(bucketCeiling(i)) + "\"", cumulative);
+            }
+        }
+        line("tba_turn_latency_ns_bucket", "le=\"+Inf\"", data.samples);
+        line("tba_turn_latency_ns_sum", "", data.latencySum);
+        line("tba_turn_latency_ns_count", "", data.samples);
+
+        out += "# HELP tba_turn_latency_quantile_ns Turn latency quantiles, within 1/16.\n# TYPE tba_turn_latency_quantile_ns gauge\n";
+        for (const char* q : { "0.5", "0.9", "0.99", "0.999" }) {
+            line("tba_turn_latency_quantile_ns", std::string("quantile=\"") + q + "\"", data.quantile(std::stod(q)));
+        }
+        line("tba_turn_latency_max_ns", "", data.latencyMax);
+        return out;
+    }
+
+    // The same as one JSON object. Latency buckets are [lowest value, turns] pairs of the
+    // buckets that have any.
+    inline std::string json(const Snapshot& data, const STORY::Story& story) {
+        std::string out = "{\n  \"story\": \"" + std::to_string(story.hash) + "\",\n  \"nodes\": {";
+        const char* separator = "";
+        for (uint32_t i = 0; i < data.nodes.size(); ++i) {
+            if (!data.nodes[i]) continue;
+            out += separator;
+            out += "\"" + std::to_string(i) + "\": " + std::to_string(data.nodes[i]);
+            separator = ", ";
+        }
+        out += "},\n  \"options\": [";
+        separator = "";
+        for (uint32_t n = 0; n < story.nodes.size; ++n) {
+            const STORY::NodeRecord& node = story.nodes[n];
+            for (uint32_t i = 0; i < node.optionCount; ++i) {
+                uint32_t index = node.firstOption + i;
+                if (index >= data.options.size() || !data.options[index]) continue;
+                out += separator;
+                out += "{\"node\": " + std::to_string(n) + ", \"option\": " + std::to_string(i) + ", \"picks\": " + std::to_string(data.options[index]) + "}";
+                separator = ", ";
+            }
+        }
+        out += "],\n  \"actions\": [";
+        separator = "";
+        for (uint32_t op = 0; op < ACTION::MAX_OPCODES; ++op) {
+            for (uint32_t r = 0; r < RESULT_COUNT; ++r) {
+                if (!data.actions[op][r]) continue;
+                out += separator;
+                out += "{\"action\": \"" + opcodeName(op) + "\", \"result\": \"" + resultName(r) + "\", \"count\": " + std::to_string(data.actions[op][r]) + "}";
+                separator = ", ";
+            }
+        }
+        out += "],\n  \"turns\": {\"count\": " + std::to_string(data.turns) + ", \"timed\": " + std::to_string(data.samples)
+             + ", \"sumNs\": " + std::to_string(data.latencySum)
+             + ", \"p50\": " + std::to_string(data.quantile(0.5)) + ", \"p90\": " + std::to_string(data.quantile(0.9))
+             + ", \"p99\": " + std::to_string(data.quantile(0.99)) + ", \"p999\": " + std::to_string(data.quantile(0.999))
+             + ", \"max\": " + std::to_string(data.latencyMax) + ", \"buckets\": [";
+        separator = "";
+        for (uint32_t i = 0; i < data.latency.size(); ++i) {
+            if (!data.latency[i]) continue;
+            out += separator;
+            out += "[" + std::to_string(bucketFloor(i)) + ", " + std::to_string(data.latency[i]) + "]";
+            separator = ", ";
+        }
+        out += "]}\n}\n";
+        return out;
+    }
+
+    // JSON for a path ending in .json, the Prometheus format otherwise
+    inline std::string format(const Snapshot& data, const STORY::Story& story, const std::string& path) {
+        bool asJson = path.size() >= 5 && path.compare(path.size() - 5, 5, ".json") == 0;
+        return asJson ? json(data, story) : prometheus(data, story);
+    }
+
+    // Replaces path with text (written next to it first, so readers never see half a file)
+    inline bool writeFile(const std::string& path, const std::string& text, std::string* error = nullptr) {
+        std::string temp = path + ".tmp";
+        {
+            std::ofstream file(temp, std::ios::binary | std::ios::trunc);
+            file.write(text.data(), static_cast<std::streamsize>(text.size()));
+            if (!file) {
+                if (error) *error = "cannot write " + temp;
+                return false;
+            }
+        }
+        if (std::rename(temp.c_str(), path.c_str()) != 0) {
+            if (error) *error = "cannot replace " + path;
+            return false;
+        }
+        return true;
+    }
+
+    // Writes the recorder's numbers to a file every period on its own thread, and once more
+    // when it stops. Files ending in .json get JSON, anything else the Prometheus format.
+    class Exporter {
+    public:
+        Exporter(const Recorder& recorder, const STORY::Story& story, std::string path,
+                 std::chrono::milliseconds period = std::chrono::seconds(10))
+            : recorder(recorder), story(story), path(std::move(path)), period(period) {
+            thread = std::thread([this] { loop(); });
+        }
+
+        ~Exporter() { stop(); }
+
+        Exporter(const Exporter&) = delete;
+        Exporter& operator=(const Exporter&) = delete;
+
+        void stop() {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (stopping) return;
+                stopping = true;
+            }
+            wake.notify_all();
+            thread.join();
+        }
+
+        // Writes the file now, on the calling thread
+        bool write(std::string* error = nullptr) const {
+            return writeFile(path, format(recorder.snapshot(), story, path), error);
+        }
+
+    private:
+        void loop() {
+            std::unique_lock<std::mutex> lock(mutex);
+            while (!stopping) {
+                wake.wait_for(lock, period, [this] { return stopping; });
+                lock.unlock();
+                write();
+                lock.lock();
+            }
+        }
+
+        const Recorder& recorder;
+        const STORY::Story& story;
+        std::string path;
+        std::chrono::milliseconds period;
+        std::mutex mutex;
+        std::condition_variable wake;
+        bool stopping = false;
+        std::thread thread;
+    };
+}
+
+#endif
@@ -0,0 +1,88 @@
+#ifndef TEXT_HPP
+#define TEXT_HPP
+
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <unordered_set>
+#include <vector>
+
+namespace TEXT {
+    // Interned text: one copy of every distinct string in the process, handed out as
+    // string_views that stay valid until the process exits. Node text, option labels and
+    // item names all live here, so a label used by a thousand options is stored once.
+
+    class Pool {
+    public:
+        struct Stats {
+            size_t requests = 0; // strings interned, counting repeats
+            size_t unique = 0;   // distinct strings stored
+            size_t requestedBytes = 0;
+            size_t storedBytes = 0;
+
+            size_t savedBytes() const { return requestedBytes - storedBytes; }
+        };
+
+        std::string_view intern(std::string_view text) {
+            if (text.empty()) return std::string_view();
+
+            std::lock_guard<std::mutex> lock(mutex);
+            ++counts.requests;
+            counts.requestedBytes += text.size();
+            auto it = index.find(text);
+            if (it != index.end()) return *it;
+
+            std::string_view stored = store(text);
+            index.insert(stored);
+            ++counts.unique;
+            counts.storedBytes += text.size();
+            return stored;
+        }
+
+        Stats stats() const {
+            std::lock_guard<std::mutex> lock(mutex);
+            return counts;
+        }
+
+    private:
+        static const size_t BLOCK_SIZE = 64 * 1024;
+
+        // Copies text into the current block, text that does not fit starts a new one
+        std::string_view store(std::string_view text) {
+            if (text.size() > BLOCK_SIZE / 4) {
+                blocks.emplace_back(new char[text.size()]); // long text gets its own block
+                std::memcpy(blocks.back().get(), text.data(), text.size());
+                return std::string_view(blocks.back().get(), text.size());
+            }
+            if (!current || used + text.size() > BLOCK_SIZE) {
+                blocks.emplace_back(new char[BLOCK_SIZE]);
+                current = blocks.back().get();
+                used = 0;
+            }
+            char* at = current + used;
+            std::memcpy(at, text.data(), text.size());
+            used += text.size();
+            return std::string_view(at, text.size());
+        }
+
+        mutable std::mutex mutex;
+        std::unordered_set<std::string_view> index;
+        std::vector<std::unique_ptr<char[]>> blocks;
+        char* current = nullptr;
+        size_t used = 0;
+        Stats counts;
+    };
+
+    // The process wide pool
+    inline Pool& pool() {
+        static Pool textPool;
+        return textPool;
+    }
+
+    inline std::string_view intern(std::string_view text) {
+        return pool().intern(text);
+    }
+}
+
+#endif
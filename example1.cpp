@@ -1,8 +1,8 @@
 #include <iostream>
 #include "engine/play.hpp"
 
-int main() {
-    INVENTORY::Inventory inv;
+// Builds the story graph and returns its starting node
+NODE::NodePtr buildTestGame() {
 
     NODE::NodePtr Begining = NODE::createNode("Welcome to the begining, you can walk in any direction", ACTION::TYPE::NONE, INVENTORY::Item(), INVENTORY::ItemVec());
     NODE::NodePtr walkLeft = NODE::createNode("You walked left, now there is a dead end and the game is over.", ACTION::TYPE::NONE, INVENTORY::Item(), INVENTORY::ItemVec());
@@ -22,9 +22,17 @@ int main() {
     Begining->addNextNode(walkRight, walkRightOption);
     Begining->addNextNode(walkLeft, walkLeftOption);
 
+    return Begining;
+}
+
+#ifndef TBA_NO_MAIN
+int main() {
+    INVENTORY::Inventory inv;
+
     GAME::Game game("TEST GAME");
     game.Init();
-    game.Run(Begining, inv);
+    game.Run(buildTestGame(), inv);
 
     return 0;
-}
\ No newline at end of file
+}
+#endif
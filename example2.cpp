@@ -1,8 +1,8 @@
 #include <iostream>
 #include "engine/play.hpp"
 
-int main() {
-    INVENTORY::Inventory inv;
+// Builds the story graph and returns its starting node
+NODE::NodePtr buildTheForest() {
 
     // Define Items
     INVENTORY::Item plank = INVENTORY::Item("Plank");
@@ -82,10 +82,18 @@ int main() {
 
     // Node_Home has no outgoing connections, ending the story when reached.
 
+    return nodeStart;
+}
+
+#ifndef TBA_NO_MAIN
+int main() {
+    INVENTORY::Inventory inv;
+
     // Start the game
     GAME::Game game("The Forest");
     game.Init();
-    game.Run(nodeStart, inv);
+    game.Run(buildTheForest(), inv);
 
     return 0;
-}
\ No newline at end of file
+}
+#endif
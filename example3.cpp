@@ -2,8 +2,8 @@
 
 #include "engine/play.hpp"
 
-int main() {
-    INVENTORY::Inventory playerInv;
+// Builds the story graph and returns its starting node
+NODE::NodePtr buildEchoesOfTheVoid() {
 
     // --- Define Items ---
     INVENTORY::Item itemFlashlightCasing =
@@ -271,11 +271,18 @@ int main() {
     nodeLifeSupportAnnexConsoleLit->addNextNode(nodeLifeSupportAnnexLit, optBackToLifeSupportLit);
     nodePryPanelLifeSupport->addNextNode(nodeLifeSupportAnnexLit, optBackToLifeSupportLit);
 
+    return nodeCryoBay;
+}
+
+#ifndef TBA_NO_MAIN
+int main() {
+    INVENTORY::Inventory playerInv;
 
     // --- Start the game ---
     GAME::Game game("Echoes of the Void");
     game.Init();
-    game.Run(nodeCryoBay, playerInv);
+    game.Run(buildEchoesOfTheVoid(), playerInv);
 
     return 0;
-}
\ No newline at end of file
+}
+#endif
@@ -0,0 +1,42 @@
+#include <iostream>
+#include <string_view>
+#include "engine/play.hpp"
+#include "engine/storydef.hpp"
+
+// The test game from example1.cpp, written as compile-time data
+namespace testGameDef {
+    constexpr std::string_view items[] = { "Key", "Mushroom", "CUBE" };
+
+    constexpr STORYDEF::NodeDef nodes[] = {
+        { "begining", "Welcome to the begining, you can walk in any direction" },
+        { "walkLeft", "You walked left, now there is a dead end and the game is over." },
+        { "walkRight", "You walked right, and there is a path. Do you go down it or go back?" },
+        { "downPath", "You went down the path, and there is a treasure chest! Do you open it or not?" },
+        { "openChest", "You opened the chest and there was a cube inside!", ACTION::TYPE::PICKUP, { "CUBE" } },
+    };
+
+    constexpr STORYDEF::OptionDef options[] = {
+        { "begining", "walkRight", "Walk right" },
+        { "begining", "walkLeft", "Walk left" },
+        { "walkRight", "downPath", "Go down the path", ACTION::TYPE::PICKUP, { "Key", "Mushroom" } },
+        { "walkRight", "begining", "Go back" },
+        { "downPath", "openChest", "Open the chest", ACTION::TYPE::USE, {}, "Key" },
+    };
+}
+
+// Builds the story straight from the compiled tables, nothing is allocated per node
+STORY::Story buildTestGameDef() {
+    return STORYDEF::compile<testGameDef::nodes, testGameDef::options, testGameDef::items>();
+}
+
+#ifndef TBA_NO_MAIN
+int main() {
+    INVENTORY::Inventory inv;
+
+    GAME::Game game("TEST GAME");
+    game.Init();
+    game.Run(buildTestGameDef(), inv);
+
+    return 0;
+}
+#endif
@@ -0,0 +1,80 @@
+// Story analyzer: explores every state a story can reach and reports unreachable nodes and
+// endings, softlocks (states no ending can be reached from), items that can never be picked
+// up and options whose action never works. Exits with 2 when it finds any of those, so it
+// can gate a content pipeline.
+//
+//   g++ -std=c++17 -O2 -pthread tools/analyze.cpp -o analyze
+//   ./analyze example3
+//   ./analyze echoes.tbs 8
+
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <string_view>
+
+#include "common.hpp"
+#include "../engine/analyze.hpp"
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        std::cerr << "usage: analyze <example1|example2|example3|example4|story.tbs> [threads]\n";
+        return 1;
+    }
+
+    STORY::Story story;
+    if (!loadStory(argv[1], story)) return 1;
+
+    ANALYZE::Options options;
+    if (argc > 2) options.threads = static_cast<size_t>(std::strtoul(argv[2], nullptr, 10));
+    ANALYZE::Report report;
+    std::string error;
+    if (!ANALYZE::explore(story, report, options, &error)) {
+        std::cerr << "[ERROR] " << error << "\n";
+        return 1;
+    }
+
+    std::cout << "story:     " << argv[1] << " (" << story.nodeCount() << " nodes, " << story.items.size << " items)\n"
+              << "states:    " << report.states << " reachable, " << report.transitions << " transitions, "
+              << report.depth << " turns deep\n"
+              << "time:      " << report.seconds * 1000 << " ms on " << report.threads << " threads\n"
+              << "endings:   " << (report.endingReachable ? "reachable" : "NONE reachable") << "\n";
+
+    std::cout << "unreachable nodes: " << report.unreachableNodes.size() << "\n";
+    for (STORY::NodeId id : report.unreachableNodes) {
+        std::cout << "  " << describe(story, id) << (story.isEndNode(id) ? "  (ending)" : "") << "\n";
+    }
+
+    std::cout << "softlocked states: " << report.softlocks << "\n";
+    for (const auto& softlock : report.softlockSamples) {
+        std::cout << "  " << describe(story, softlock.node) << "\n    holding [";
+        for (size_t i = 0; i < softlock.items.size(); ++i) {
+            std::cout << (i ? ", " : "") << ACTION::itemName(softlock.items[i]);
+            if (softlock.counts[i] > 1) std::cout << " x" << softlock.counts[i];
+        }
+        std::cout << "]";
+        for (size_t i = 0; i < softlock.variables.size(); ++i) {
+            if (softlock.variables[i] != 0) std::cout << " " << story.text(story.variables[i]) << "=" << softlock.variables[i];
+        }
+        std::cout << " after choices";
+        for (int choice : softlock.path) std::cout << " " << choice + 1;
+        std::cout << "\n";
+    }
+
+    std::cout << "unobtainable items: " << report.unobtainableItems.size() << "\n";
+    for (INVENTORY::ItemId id : report.unobtainableItems) {
+        std::cout << "  " << ACTION::itemName(id) << "\n";
+    }
+
+    std::cout << "options that never work: " << report.deadOptions.size() << "\n";
+    for (const auto& option : report.deadOptions) {
+        STREAM::Page page;
+        if (story.chapters.size != 0 && !storyBook().page(option.node, page)) continue;
+        const STORY::Story& text = story.chapters.size != 0 ? page.story() : story;
+        std::cout << "  " << describe(story, option.node) << "\n    " << option.index + 1 << ". "
+                  << text.text(story.option(option.node, option.index).text) << "\n";
+    }
+
+    bool clean = report.endingReachable && report.unreachableNodes.empty() && report.softlocks == 0
+        && report.unobtainableItems.empty() && report.deadOptions.empty();
+    return clean ? 0 : 2;
+}
@@ -0,0 +1,56 @@
+// What the command line tools and benchmarks share: picking a story by name (one of the
+// examples or a story file) and naming a node in a report. Include it instead of the
+// example files.
+
+#ifndef TOOLS_COMMON_HPP
+#define TOOLS_COMMON_HPP
+
+#include <iostream>
+#include <string>
+#include <string_view>
+
+#ifndef TBA_NO_MAIN
+#define TBA_NO_MAIN
+#endif
+#include "../example1.cpp"
+#include "../example2.cpp"
+#include "../example3.cpp"
+#include "../example4.cpp"
+#include "../engine/storyfile.hpp"
+#include "../engine/stream.hpp"
+
+// The story file loadStory opened, streamed ones keep their text here
+inline STREAM::Book& storyBook() {
+    static STREAM::Book book;
+    return book;
+}
+
+// example1 to example4, or a story file (read through storyBook())
+inline bool loadStory(const std::string& name, STORY::Story& story) {
+    if (name == "example1") story = STORY::compile(buildTestGame());
+    else if (name == "example2") story = STORY::compile(buildTheForest());
+    else if (name == "example3") story = STORY::compile(buildEchoesOfTheVoid());
+    else if (name == "example4") story = buildTestGameDef();
+    else {
+        std::string error;
+        if (!storyBook().open(name, STREAM::BookOptions(), &error)) {
+            std::cerr << "[ERROR] " << error << "\n";
+            return false;
+        }
+        story = storyBook().story();
+    }
+    return true;
+}
+
+// "#12 The first line of the node text..."
+inline std::string describe(const STORY::Story& story, STORY::NodeId id) {
+    STREAM::Page page;
+    if (story.chapters.size != 0 && !storyBook().page(id, page)) return "#" + std::to_string(id);
+    std::string_view text = (story.chapters.size != 0 ? page.story() : story).text(story.node(id).text);
+    text = text.substr(0, text.find('\n'));
+    std::string out = "#" + std::to_string(id) + " " + std::string(text.substr(0, 60));
+    if (text.size() > 60) out += "...";
+    return out;
+}
+
+#endif
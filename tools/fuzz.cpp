@@ -0,0 +1,67 @@
+// Random playthrough fuzzer: plays millions of random playthroughs of a story on every
+// core and prints node visit frequencies, the ending distribution, the average length of
+// a playthrough and how often USE actions fail for lack of the item.
+//
+//   g++ -std=c++17 -O2 -pthread tools/fuzz.cpp -o fuzz
+//   ./fuzz example2
+//   ./fuzz story.tbs 10000000 8 42
+
+#include <algorithm>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "common.hpp"
+#include "../engine/fuzz.hpp"
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        std::cerr << "usage: fuzz <example1|example2|example3|example4|story.tbs> [playthroughs] [threads] [seed]\n";
+        return 1;
+    }
+
+    STORY::Story story;
+    if (!loadStory(argv[1], story)) return 1;
+
+    FUZZ::Options options;
+    if (argc > 2) options.playthroughs = std::strtoull(argv[2], nullptr, 10);
+    if (argc > 3) options.threads = static_cast<size_t>(std::strtoul(argv[3], nullptr, 10));
+    if (argc > 4) options.seed = std::strtoull(argv[4], nullptr, 10);
+
+    FUZZ::Report report;
+    std::string error;
+    if (!FUZZ::run(story, report, options, &error)) {
+        std::cerr << "[ERROR] " << error << "\n";
+        return 1;
+    }
+
+    double playthroughs = static_cast<double>(std::max<uint64_t>(1, report.playthroughs));
+    std::cout << std::fixed << std::setprecision(2)
+              << "story:        " << argv[1] << " (" << story.nodeCount() << " nodes)\n"
+              << "playthroughs: " << report.playthroughs << " in " << report.seconds * 1000 << " ms on "
+              << report.threads << " threads (" << static_cast<uint64_t>(report.turns / std::max(report.seconds, 1e-9)) << " turns/s)\n"
+              << "finished:     " << report.finished << " (" << 100.0 * report.finished / playthroughs << "%), "
+              << report.playthroughs - report.finished - report.lockedIn << " cut off after " << options.maxTurns << " turns";
+    if (report.lockedIn) std::cout << ", " << report.lockedIn << " stuck with every option locked";
+    std::cout << "\n"
+              << "avg length:   " << report.averageTurns() << " turns\n"
+              << "failed USE:   " << report.failedUses << " of " << report.useActions << " ("
+              << 100.0 * report.failedUseRate() << "%)\n";
+
+    std::cout << "endings:\n";
+    for (STORY::NodeId id = 0; id < story.nodeCount(); ++id) {
+        if (!story.isEndNode(id)) continue;
+        std::cout << "  " << std::setw(6) << 100.0 * report.endings[id] / playthroughs << "%  " << describe(story, id) << "\n";
+    }
+
+    std::cout << "visits per playthrough:\n";
+    for (STORY::NodeId id = 0; id < story.nodeCount(); ++id) {
+        std::cout << "  " << std::setw(8) << report.nodeVisits[id] / playthroughs << "  " << describe(story, id);
+        if (report.failedUsesAt[id]) std::cout << "  (" << report.failedUsesAt[id] << " failed USE)";
+        std::cout << "\n";
+    }
+    return 0;
+}
@@ -0,0 +1,72 @@
+// Story compiler: builds one of the example stories with NODE::createNode/addNextNode,
+// flattens it and writes it out in the binary story format. With a chapter size (in KB)
+// the story is written for streaming (see STREAM). -O runs OPTIMIZE over the graph first and
+// reports what it saved.
+//
+//   g++ -std=c++17 -O2 -pthread tools/storyc.cpp -o storyc
+//   ./storyc example3 echoes.tbs
+//   ./storyc example3 echoes.tbs 4
+//   ./storyc -O example3 echoes.tbs
+
+#include <iostream>
+#include <string>
+#include <cstring>
+#include <cstdlib>
+
+#define TBA_NO_MAIN
+#include "../example1.cpp"
+#include "../example2.cpp"
+#include "../example3.cpp"
+#include "../engine/optimize.hpp"
+#include "../engine/storyfile.hpp"
+#include "../engine/stream.hpp"
+
+int main(int argc, char** argv) {
+    bool optimize = argc > 1 && std::strcmp(argv[1], "-O") == 0;
+    if (optimize) {
+        --argc;
+        ++argv;
+    }
+    if (argc != 3 && argc != 4) {
+        std::cerr << "usage: storyc [-O] <example1|example2|example3> <out.tbs> [chapter KB]\n";
+        return 1;
+    }
+
+    NODE::NodePtr root;
+    if (std::strcmp(argv[1], "example1") == 0) root = buildTestGame();
+    else if (std::strcmp(argv[1], "example2") == 0) root = buildTheForest();
+    else if (std::strcmp(argv[1], "example3") == 0) root = buildEchoesOfTheVoid();
+    else {
+        std::cerr << "unknown story " << argv[1] << "\n";
+        return 1;
+    }
+
+    if (optimize) {
+        OPTIMIZE::Report report;
+        root = OPTIMIZE::optimize(root, &report);
+        std::cout << "[INFO] Optimized: " << report.nodesBefore << " -> " << report.nodesAfter << " nodes, " << report.edgesBefore
+                  << " -> " << report.edgesAfter << " options, " << report.bytesBefore << " -> " << report.bytesAfter << " bytes ("
+                  << report.duplicates << " duplicate nodes merged, " << report.chained << " chained nodes folded)\n";
+    }
+
+    STORY::BuildStats stats;
+    std::string error;
+    STORY::Story story = STORY::compile(root, &stats, &error);
+    if (!error.empty()) {
+        std::cerr << "[ERROR] " << error << "\n";
+        return 1;
+    }
+    STREAM::Options chapters;
+    if (argc == 4) chapters.chapterBytes = static_cast<uint32_t>(std::atoi(argv[3])) * 1024;
+    bool saved = argc == 4 ? STREAM::save(story, argv[2], chapters, &error) : STORYFILE::save(story, argv[2], &error);
+    if (!saved) {
+        std::cerr << "[ERROR] " << error << "\n";
+        return 1;
+    }
+
+    std::cout << "[INFO] Wrote " << story.nodeCount() << " nodes, " << story.options.size << " options, "
+              << story.items.size << " items to " << argv[2] << "\n";
+    std::cout << "[INFO] Text: " << stats.texts << " strings, " << stats.uniqueTexts << " unique, "
+              << stats.poolBytes << " of " << stats.textBytes << " bytes stored (" << stats.savedBytes() << " saved)\n";
+    return 0;
+}
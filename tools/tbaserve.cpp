@@ -0,0 +1,95 @@
+// Serves a compiled story file over TCP (see SERVER): every connection plays its own game,
+// one number per line like the console. Runs until stdin closes or gets a line. --metrics
+// writes telemetry to a file, --quota caps the memory of one connection's game in KB,
+// --commands lets players type what they do as well as option numbers.
+//
+//   g++ -std=c++17 -O2 -pthread tools/tbaserve.cpp -o tbaserve
+//   ./tbaserve echoes.tbs 4000 2
+//   ./tbaserve echoes.tbs 4000 2 --metrics metrics.prom
+//   ./tbaserve echoes.tbs 4000 2 --quota 16 --commands
+//   nc 127.0.0.1 4000
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+
+#include "../engine/parser.hpp"
+#include "../engine/server.hpp"
+#include "../engine/storyfile.hpp"
+#include "../engine/telemetry.hpp"
+
+static const char* USAGE = "usage: tbaserve <story.tbs> [port] [threads] [--metrics file] [--quota KB] [--commands]\n";
+
+int main(int argc, char** argv) {
+    const char* path = nullptr;
+    const char* port = nullptr;
+    const char* threads = nullptr;
+    const char* metrics = nullptr;
+    SERVER::Options options;
+    options.address = "0.0.0.0";
+    bool commands = false;
+    for (int i = 1; i < argc; ++i) {
+        bool hasValue = i + 1 < argc;
+        if (std::strcmp(argv[i], "--metrics") == 0 && hasValue) metrics = argv[++i];
+        else if (std::strcmp(argv[i], "--quota") == 0 && hasValue) options.sessionQuota = static_cast<size_t>(std::atoi(argv[++i])) * 1024;
+        else if (std::strcmp(argv[i], "--commands") == 0) commands = true;
+        else if (std::strncmp(argv[i], "--", 2) != 0 && !path) path = argv[i];
+        else if (std::strncmp(argv[i], "--", 2) != 0 && !port) port = argv[i];
+        else if (std::strncmp(argv[i], "--", 2) != 0 && !threads) threads = argv[i];
+        else {
+            std::cerr << USAGE;
+            return 1;
+        }
+    }
+    if (!path) {
+        std::cerr << USAGE;
+        return 1;
+    }
+    if (port) options.port = static_cast<uint16_t>(std::atoi(port));
+    if (threads) options.threads = static_cast<size_t>(std::atoi(threads));
+
+    STORY::Story story;
+    std::string error;
+    if (!STORYFILE::load(path, story, &error)) {
+        std::cerr << "[ERROR] " << error << "\n";
+        return 1;
+    }
+    if (story.chapters.size != 0) {
+        std::cerr << "[ERROR] " << path << " is a streamed story, the server needs all of its text in memory\n";
+        return 1;
+    }
+
+    std::unique_ptr<TELEMETRY::Recorder> recorder;
+    std::unique_ptr<TELEMETRY::Exporter> exporter;
+    if (metrics) {
+        recorder.reset(new TELEMETRY::Recorder(story));
+        exporter.reset(new TELEMETRY::Exporter(*recorder, story, metrics));
+        options.telemetry = recorder.get();
+    }
+    PARSER::Lexicon lexicon;
+    if (commands) {
+        if (!lexicon.build(story, &error)) {
+            std::cerr << "[ERROR] " << error << "\n";
+            return 1;
+        }
+        options.commands = &lexicon;
+    }
+
+    SERVER::Server server(story, options);
+    if (!server.start(&error)) {
+        std::cerr << "[ERROR] " << error << "\n";
+        return 1;
+    }
+    std::cout << "serving " << path << " on port " << server.port() << " with " << options.threads
+              << " threads, press Enter to stop\n";
+    std::string line;
+    std::getline(std::cin, line);
+    SERVER::Stats stats = server.stats();
+    server.stop();
+
+    std::cout << stats.accepted << " connections, " << stats.turns << " lines, largest game " << stats.sessionPeak << " bytes, "
+              << stats.overQuota << " over the quota\n";
+    return 0;
+}